@@ -37,3 +37,5 @@ endif()
 find_package_handle_standard_args(EASYLOGGINGPP REQUIRED_VARS EASYLOGGINGPP_INCLUDE_DIR)
 
 add_definitions(-DELPP_THREAD_SAFE -DELPP_FEATURE_CRASH_LOG -DELPP_DISABLE_DEFAULT_CRASH_HANDLING -DELPP_STL_LOGGING)
+# debug logs are compiled out of release builds
+set_property(DIRECTORY APPEND PROPERTY COMPILE_DEFINITIONS $<$<OR:$<CONFIG:Release>,$<CONFIG:MinSizeRel>>:ELPP_DISABLE_DEBUG_LOGS>)
@@ -0,0 +1,78 @@
+/**
+ * This file is part of Poster Safari.
+ *
+ *  Poster Safari is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Poster Safari is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with Poster Safari.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ * 
+ *  Copyright 2017 Moritz Dannehl, Rebecca Lühmann, Nicolas Marin, Michael Nieß, Julian Wolff
+ * 
+ */
+
+#include "compression.h"
+
+#include <zlib.h>
+
+namespace Postr
+{
+    namespace Compression
+    {
+        bool compress(const std::string& input, std::string& output, Format format, int level)
+        {
+            z_stream stream = {};
+            //window bits 15 plus 16 selects the gzip container
+            int windowBits = (format == Gzip) ? 15+16 : 15;
+            if(deflateInit2(&stream, level, Z_DEFLATED, windowBits, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+                return false;
+            
+            output.resize(deflateBound(&stream, input.size()));
+            stream.next_in = (Bytef*)input.data();
+            stream.avail_in = input.size();
+            stream.next_out = (Bytef*)&output[0];
+            stream.avail_out = output.size();
+            
+            int status = deflate(&stream, Z_FINISH);
+            output.resize(stream.total_out);
+            deflateEnd(&stream);
+            
+            return status == Z_STREAM_END;
+        }
+        
+        bool decompress(const std::string& input, std::string& output)
+        {
+            z_stream stream = {};
+            //window bits 15 plus 32 detects gzip and zlib headers
+            if(inflateInit2(&stream, 15+32) != Z_OK)
+                return false;
+            
+            stream.next_in = (Bytef*)input.data();
+            stream.avail_in = input.size();
+            
+            output.clear();
+            char chunk[64*1024];
+            int status;
+            do
+            {
+                stream.next_out = (Bytef*)chunk;
+                stream.avail_out = sizeof(chunk);
+                status = inflate(&stream, Z_NO_FLUSH);
+                if(status != Z_OK && status != Z_STREAM_END)
+                    break;
+                output.append(chunk, sizeof(chunk) - stream.avail_out);
+            } while(status != Z_STREAM_END);
+            
+            inflateEnd(&stream);
+            return status == Z_STREAM_END;
+        }
+    }
+}
@@ -0,0 +1,60 @@
+/**
+ * This file is part of Poster Safari.
+ *
+ *  Poster Safari is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Poster Safari is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with Poster Safari.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ * 
+ *  Copyright 2017 Moritz Dannehl, Rebecca Lühmann, Nicolas Marin, Michael Nieß, Julian Wolff
+ * 
+ */
+
+#ifndef POSTR_COMPRESSION_H
+#define POSTR_COMPRESSION_H
+
+#include <string>
+
+namespace Postr 
+{
+    namespace Compression
+    {
+        /**
+         * @brief Container formats of deflate compressed data
+         */
+        enum Format
+        {
+            Gzip,       ///< gzip header and trailer, as used by "Content-Encoding: gzip"
+            Deflate     ///< zlib header and trailer, as used by "Content-Encoding: deflate"
+        };
+        
+        /**
+         * @brief Compress a buffer
+         * @param input Data to compress
+         * @param output Compressed data
+         * @param format Container format of the compressed data
+         * @param level zlib compression level in range 1 (fastest) to 9 (smallest)
+         * @return true on success
+         */
+        bool compress(const std::string& input, std::string& output, Format format = Gzip, int level = 6);
+        
+        /**
+         * @brief Decompress a gzip or zlib compressed buffer. The format is detected automatically.
+         * @param input Compressed data
+         * @param output Decompressed data
+         * @return true on success
+         */
+        bool decompress(const std::string& input, std::string& output);
+    }
+}
+
+#endif //POSTR_COMPRESSION_H
@@ -22,6 +22,10 @@
 #include "couchdb.h"
 
 #include <sstream>
+#include <algorithm>
+#include <cstdlib>
+#include <chrono>
+#include <ctime>
 
 #include <curlpp/cURLpp.hpp>
 #include <curlpp/Easy.hpp>
@@ -33,9 +37,15 @@
 
 #include "base64.h"
 #include "util.h"
+#include "compression.h"
+#include "tracer.h"
 
 namespace Postr
 {
+    constexpr const char* CouchDB::IndexDesignDoc;
+    constexpr const char* CouchDB::UnprocessedIndex;
+    constexpr const char* CouchDB::EventIndex;
+    
     CouchDB::CouchDB(const std::string& url, const long port, const std::string& user, const std::string& pass, bool debug)
         : m_id(Postr::Util::uuid())
         , m_url(url)
@@ -43,6 +53,10 @@ namespace Postr
         , m_user(user)
         , m_pass(pass)
         , m_debugDB(debug)
+        , m_leaseDuration(600)
+        , m_compressResponses(true)
+        , m_compressRequests(false)
+        , m_minCompressedSize(1024)
     {
     }
 
@@ -55,8 +69,106 @@ namespace Postr
         return m_id;
     }
 
+    void CouchDB::setCompression(bool responses, bool requests, size_t minRequestSize)
+    {
+        m_compressResponses = responses;
+        m_compressRequests = requests;
+        m_minCompressedSize = minRequestSize;
+    }
+    
+    CouchDB::TransferStats CouchDB::transferStats() const
+    {
+        std::lock_guard<std::mutex> lk(m_transferMutex);
+        return m_transferStats;
+    }
+    
+    double CouchDB::TransferStats::secondsSaved() const
+    {
+        uint64_t bytes = bytesSent + bytesReceived;
+        if(bytes == 0 || transferSeconds <= 0)
+            return 0;
+        
+        //bytes that did not have to be transferred at the measured throughput
+        double throughput = bytes / transferSeconds;
+        double saved = (uncompressedBytesSent - bytesSent) + (uncompressedBytesReceived - (double)std::min(bytesReceived, uncompressedBytesReceived));
+        return saved / throughput - compressionSeconds;
+    }
+    
+    void CouchDB::acceptCompression(curlpp::Easy& request) const
+    {
+        //an empty string lets curl offer all encodings it supports and decode responses transparently
+        if(m_compressResponses)
+            request.setOpt(new curlpp::options::Encoding(""));
+    }
+    
+    void CouchDB::compressBody(std::string& body, std::list<std::string>& header) const
+    {
+        if(!m_compressRequests || body.size() < m_minCompressedSize)
+            return;
+        
+        auto start = std::chrono::steady_clock::now();
+        std::string compressed;
+        if(!Compression::compress(body, compressed, Compression::Gzip, 1) || compressed.size() >= body.size())
+            return;
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        
+        {
+            std::lock_guard<std::mutex> lk(m_transferMutex);
+            m_transferStats.compressedRequests++;
+            m_transferStats.uncompressedBytesSent += body.size() - compressed.size();
+            m_transferStats.compressionSeconds += seconds;
+        }
+        
+        body.swap(compressed);
+        header.push_back("Content-Encoding: gzip");
+    }
+    
+    void CouchDB::recordTransfer(curlpp::Easy& request, size_t uncompressedBytesReceived, const std::string& document) const
+    {
+        uint64_t sent = (uint64_t)curlpp::infos::SizeUpload::get(request);
+        uint64_t received = (uint64_t)curlpp::infos::SizeDownload::get(request);
+        double seconds = curlpp::infos::TotalTime::get(request);
+        
+        if(Tracer::enabled() && Tracer::sampled(document))
+        {
+            //the request has just finished, curl measured how long it took
+            std::string url = curlpp::infos::EffectiveUrl::get(request);
+            size_t host = url.find("://");
+            size_t path = url.find('/', (host == std::string::npos) ? 0 : host+3);
+            Tracer::Clock::time_point end = Tracer::Clock::now();
+            Tracer::complete("http", (path == std::string::npos) ? url : url.substr(path), document, 
+                             end - std::chrono::duration_cast<Tracer::Clock::duration>(std::chrono::duration<double>(seconds)), end);
+        }
+        
+        std::lock_guard<std::mutex> lk(m_transferMutex);
+        m_transferStats.requests++;
+        m_transferStats.bytesSent += sent;
+        m_transferStats.uncompressedBytesSent += sent;
+        //curl counts the body bytes on the wire, before decoding
+        m_transferStats.bytesReceived += received;
+        m_transferStats.uncompressedBytesReceived += std::max<uint64_t>(received, uncompressedBytesReceived);
+        if(uncompressedBytesReceived > received)
+            m_transferStats.compressedResponses++;
+        m_transferStats.transferSeconds += seconds;
+        
+        //log the effect of compression now and then
+        if(m_transferStats.requests % 1000 == 0 && (m_compressResponses || m_compressRequests))
+        {
+            LOG(INFO) << "transferred " << (m_transferStats.bytesSent+m_transferStats.bytesReceived)/1024 << " KiB instead of " 
+                      << (m_transferStats.uncompressedBytesSent+m_transferStats.uncompressedBytesReceived)/1024 << " KiB in " 
+                      << m_transferStats.requests << " requests, saving approximately " << m_transferStats.secondsSaved() << "s";
+        }
+    }
+    
     double CouchDB::progressCallback(double dltotal, double dlnow, double ultotal, double ulnow) const
     {
+        //curl calls this many times per second, redrawing at a low rate is enough to watch a transfer
+        static thread_local std::chrono::steady_clock::time_point lastPrint;
+        auto now = std::chrono::steady_clock::now();
+        if(now - lastPrint < std::chrono::milliseconds(100))
+            return 0;
+        lastPrint = now;
+        
         if(dlnow < dltotal && dlnow >= 0)
         {
             Output::printProgress("http download", 100*dlnow/dltotal, false);
@@ -88,12 +200,14 @@ namespace Postr
             request.setOpt(new curlpp::options::Verbose(false));
 
             request.setOpt(new curlpp::options::UserPwd((m_user+":"+m_pass).c_str()));
+            acceptCompression(request);
 
             std::stringstream ss;
             request.setOpt(new curlpp::options::WriteStream(&ss));
             request.perform();
 
             std::string response = ss.str();
+            recordTransfer(request, response.size());
 
             Data resp(response);
 
@@ -111,7 +225,18 @@ namespace Postr
         return ret;
     }
     
-    MetaData CouchDB::getSelectedDocumentIds(const std::string& sel, int limit, bool interactive)
+    std::string CouchDB::findQuery(const std::string& sel, int limit, const std::string& fields, const std::string& useIndex)
+    {
+        std::string query = "{ \"selector\": " + sel + ", \"limit\": " + std::to_string(limit);
+        if(!fields.empty())
+            query += ", \"fields\": " + fields;
+        if(!useIndex.empty())
+            query += ", \"use_index\": [ \"" + std::string(IndexDesignDoc) + "\", \"" + useIndex + "\" ]";
+        query += " }";
+        return query;
+    }
+    
+    MetaData CouchDB::findDocuments(const std::string& db, const std::string& sel, int limit, const std::string& fields, bool interactive, const std::string& useIndex)
     {
         try {
             curlpp::Cleanup cleaner;
@@ -124,32 +249,44 @@ namespace Postr
                 request.setOpt(progressBar);
             }
 
-            request.setOpt(new curlpp::options::Url(("http://"+m_url+"/"+posterDB()+"/_find").c_str()));
+            request.setOpt(new curlpp::options::Url(("http://"+m_url+"/"+db+"/_find").c_str()));
             request.setOpt(new curlpp::options::Port(m_port));
             request.setOpt(new curlpp::options::Verbose(false));
 
             request.setOpt(new curlpp::options::UserPwd((m_user+":"+m_pass).c_str()));
+            acceptCompression(request);
 
             std::list<std::string> header;
             header.push_back("Content-Type: application/json");
             header.push_back("Accept: application/json");
-            header.push_back("Referer: http://localhost/"+posterDB()+"");
+            header.push_back("Referer: http://localhost/"+db+"");
             header.push_back("Host: localhost");
+
+            std::string selector = findQuery(sel, limit, fields, useIndex);
+
+            compressBody(selector, header);
             request.setOpt(new curlpp::options::HttpHeader(header));
 
-            std::string selector = "{ \"selector\": " + sel + ", \"limit\": " + std::to_string(limit) + ", \"fields\": [ \"_id\", \"_rev\" ] }";
-            
             request.setOpt(new curlpp::options::PostFields(selector));
             request.setOpt(new curlpp::options::PostFieldSize(selector.length()));
 
+            auto start = std::chrono::steady_clock::now();
+
             std::stringstream ss;
             request.setOpt(new curlpp::options::WriteStream(&ss));
             request.perform();
 
+            auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+
             std::string response = ss.str();
+            recordTransfer(request, response.size());
 
             Data resp(response);
 
+            //CouchDB adds a warning if no index could be used for this query
+            if(resp.meta.isMember("warning"))
+                LOG_EVERY_N(100, WARNING) << "query on " << db << " took " << duration.count() << "ms: " << resp.meta["warning"].asString() << ". selector: " << sel;
+
             return resp.meta["docs"];
         }
         catch ( curlpp::LogicError & e ) {
@@ -161,7 +298,97 @@ namespace Postr
         return MetaData();
     }
     
+    MetaData CouchDB::getSelectedDocumentIds(const std::string& sel, int limit, bool interactive)
+    {
+        return findDocuments(posterDB(), sel, limit, "[ \"_id\", \"_rev\" ]", interactive);
+    }
+    
     MetaData CouchDB::getSelectedDocumentIdsByEvents(const std::string& sel, int limit, bool interactive)
+    {
+        MetaData events = findDocuments(eventDB(), sel, limit, "[ \"_id\", \"_rev\" ]", interactive);
+        if(!events.isArray() || !events.size())
+            return MetaData();
+        
+        std::string selector = "{                                        "
+                               "         \"event\" : {                  "
+                               "                  \"$in\": [            ";
+        for(const Postr::MetaData& doc : events)
+        {
+            selector += "\"" + doc["_id"].asString() + "\",";
+        }
+        selector = selector.substr(0,selector.length()-1);
+        selector += "              ]                         "
+                    "         }                              "
+                    "}                                       ";
+        
+        return getSelectedDocumentIds(selector, limit, interactive);
+    }
+    
+    std::string CouchDB::pendingSelector()
+    {
+        //select documents which have an image but no event yet
+        return "{"
+               "        \"$and\": ["
+               "        {"
+               "            \"_attachments.userimage\": {\"$exists\": true}"
+               "        },"
+               "        {   \"$not\": {"
+               "                \"event\": { \"$and\": ["
+               "                    {\"$exists\": true},"
+               "                    {\"$ne\": null}"
+               "                ]}"
+               "            }"
+               "        }"
+               "        ]"
+               "}";
+    }
+    
+    std::string CouchDB::unprocessedSelector() const
+    {
+        //select pending documents which are not currently being processed by any engine or whose lease expired
+        return "{"
+               "        \"$and\": ["
+               "        " + pendingSelector() + ","
+               "        {   \"$or\": ["
+               "            {   \"$not\": {"
+               "                    \"processedBy\": { \"$and\": ["
+               "                        {\"$exists\": true},"
+               "                        {\"$ne\": null}"
+               "                    ]}"
+               "                }"
+               "            },"
+               "            {"
+               "                \"leaseExpires\": {\"$lt\": " + std::to_string(std::time(nullptr)) + "}"
+               "            }"
+               "            ]"
+               "        }"
+               "        ]"
+               "}";
+    }
+    
+    MetaData CouchDB::renewLeases(std::vector<Data>& docs, bool interactive)
+    {
+        Json::Int64 expires = std::time(nullptr) + m_leaseDuration;
+        for(Data& doc : docs)
+        {
+            doc.meta["processedBy"] = m_id;
+            doc.meta["leaseExpires"] = expires;
+        }
+        
+        return updateDocuments(docs, false, interactive);
+    }
+    
+    void CouchDB::setLeaseDuration(int seconds)
+    {
+        m_leaseDuration = seconds;
+    }
+    
+    int CouchDB::leaseDuration() const
+    {
+        return m_leaseDuration;
+    }
+    
+    bool CouchDB::createIndex(const std::string& db, const std::string& name, const std::string& index, bool interactive)
     {
         try {
             curlpp::Cleanup cleaner;
@@ -174,44 +401,99 @@ namespace Postr
                 request.setOpt(progressBar);
             }
 
-            request.setOpt(new curlpp::options::Url(("http://"+m_url+"/"+eventDB()+"/_find").c_str()));
+            request.setOpt(new curlpp::options::Url(("http://"+m_url+"/"+db+"/_index").c_str()));
             request.setOpt(new curlpp::options::Port(m_port));
             request.setOpt(new curlpp::options::Verbose(false));
 
             request.setOpt(new curlpp::options::UserPwd((m_user+":"+m_pass).c_str()));
+            acceptCompression(request);
 
             std::list<std::string> header;
             header.push_back("Content-Type: application/json");
             header.push_back("Accept: application/json");
-            header.push_back("Referer: http://localhost/"+eventDB()+"");
+            header.push_back("Referer: http://localhost/"+db+"");
             header.push_back("Host: localhost");
+
+            std::string postdata = "{ \"index\": " + index + ", \"ddoc\": \"" + IndexDesignDoc + "\", \"name\": \"" + name + "\", \"type\": \"json\" }";
+            
+            compressBody(postdata, header);
             request.setOpt(new curlpp::options::HttpHeader(header));
 
-            std::string selector = "{ \"selector\": " + sel + ", \"limit\": " + std::to_string(limit) + ", \"fields\": [ \"_id\", \"_rev\" ] }";
-            request.setOpt(new curlpp::options::PostFields(selector));
-            request.setOpt(new curlpp::options::PostFieldSize(selector.length()));
+            request.setOpt(new curlpp::options::PostFields(postdata));
+            request.setOpt(new curlpp::options::PostFieldSize(postdata.length()));
 
             std::stringstream ss;
             request.setOpt(new curlpp::options::WriteStream(&ss));
             request.perform();
 
             std::string response = ss.str();
+            recordTransfer(request, response.size());
 
             Data resp(response);
-            
-            selector = "{                                        "
-                        "         \"event\" : {                  "
-                        "                  \"$in\": [            ";
-            for(const Postr::MetaData& doc : resp.meta["docs"])
+
+            if(!resp.meta["error"].asString().empty())
             {
-                selector += "\"" + doc["_id"].asString() + "\",";
+                LOG(ERROR) << "failed creating index " << name << " on " << db << ": " << resp.meta["error"].asString() << ". " << resp.meta["reason"].asString();
+                return false;
             }
-            selector = selector.substr(0,selector.length()-1);
-            selector += "              ]                         "
-                        "         }                              "
-                        "}                                       ";
+
+            if(resp.meta["result"].asString() == "created")
+                LOG(INFO) << "created index " << name << " on " << db;
+
+            return true;
+        }
+        catch ( curlpp::LogicError & e ) {
+            LOG(ERROR) << e.what() << std::endl;
+        }
+        catch ( curlpp::RuntimeError & e ) {
+            LOG(ERROR) << e.what() << std::endl;
+        }
+        return false;
+    }
+    
+    MetaData CouchDB::explainQuery(const std::string& db, const std::string& query, bool interactive)
+    {
+        try {
+            curlpp::Cleanup cleaner;
+            curlpp::Easy request;
+
+            if(interactive)
+            {
+                curlpp::options::ProgressFunction progressBar([this](double dltotal, double dlnow, double ultotal, double ulnow){return progressCallback(dltotal, dlnow, ultotal, ulnow);});
+                request.setOpt(new curlpp::options::NoProgress(0));
+                request.setOpt(progressBar);
+            }
+
+            request.setOpt(new curlpp::options::Url(("http://"+m_url+"/"+db+"/_explain").c_str()));
+            request.setOpt(new curlpp::options::Port(m_port));
+            request.setOpt(new curlpp::options::Verbose(false));
+
+            request.setOpt(new curlpp::options::UserPwd((m_user+":"+m_pass).c_str()));
+            acceptCompression(request);
+
+            std::list<std::string> header;
+            header.push_back("Content-Type: application/json");
+            header.push_back("Accept: application/json");
+            header.push_back("Referer: http://localhost/"+db+"");
+            header.push_back("Host: localhost");
             
-            return getSelectedDocumentIds(selector, limit, interactive);
+            std::string body = query;
+            compressBody(body, header);
+            request.setOpt(new curlpp::options::HttpHeader(header));
+
+            request.setOpt(new curlpp::options::PostFields(body));
+            request.setOpt(new curlpp::options::PostFieldSize(body.length()));
+
+            std::stringstream ss;
+            request.setOpt(new curlpp::options::WriteStream(&ss));
+            request.perform();
+
+            std::string response = ss.str();
+            recordTransfer(request, response.size());
+
+            Data resp(response);
+
+            return resp.meta;
         }
         catch ( curlpp::LogicError & e ) {
             LOG(ERROR) << e.what() << std::endl;
@@ -221,32 +503,54 @@ namespace Postr
         }
         return MetaData();
     }
+    
+    bool CouchDB::ensureIndexes(bool create, bool interactive)
+    {
+        struct IndexedQuery
+        {
+            std::string name;
+            std::string index;
+            std::string selector;
+            std::string useIndex;
+        };
+        
+        const std::vector<IndexedQuery> queries = {
+            //getNextDocument and claimDocuments
+            {UnprocessedIndex, "{ \"fields\": [ \"_id\" ], \"partial_filter_selector\": " + pendingSelector() + " }", unprocessedSelector(), UnprocessedIndex},
+            //getSelectedDocumentIdsByEvents
+            {EventIndex, "{ \"fields\": [ \"event\" ] }", "{ \"event\": { \"$in\": [ \"\" ] } }", ""}
+        };
+        
+        bool indexed = true;
+        for(const IndexedQuery& query : queries)
+        {
+            if(create)
+                createIndex(posterDB(), query.name, query.index, interactive);
+            
+            MetaData plan = explainQuery(posterDB(), findQuery(query.selector, 1, "", query.useIndex), interactive);
+            
+            //the special _all_docs index means CouchDB scans the whole table
+            std::string usedIndex = plan["index"]["name"].asString();
+            if(plan["index"]["type"].asString() == "special" || usedIndex.empty())
+            {
+                auto start = std::chrono::steady_clock::now();
+                findDocuments(posterDB(), query.selector, 1, "[ \"_id\" ]", interactive, query.useIndex);
+                auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+                
+                LOG(WARNING) << "query for index " << query.name << " falls back to a full scan of " << posterDB() << " (" << duration.count() << "ms)";
+                indexed = false;
+            }
+            else
+                LOG(DEBUG) << "query for index " << query.name << " uses index " << usedIndex;
+        }
+        
+        return indexed;
+    }
 
     bool CouchDB::getNextDocument(std::string& id, std::string& rev, bool interactive)
     {
-        
         //select the first document which is not currently being processed by any engine
-        MetaData docs = getSelectedDocumentIds("{"
-                            "        \"$and\": ["
-                            "        {   \"$not\": {"
-                            "                \"processedBy\": { \"$and\": ["
-                            "                    {\"$exists\": true},"
-                            "                    {\"$ne\": null}"
-                            "                ]}"
-                            "            }"
-                            "        },"
-                            "        {"
-                            "            \"_attachments.userimage\": {\"$exists\": true}"
-                            "        },"
-                            "        {   \"$not\": {"
-                            "                \"event\": { \"$and\": ["
-                            "                    {\"$exists\": true},"
-                            "                    {\"$ne\": null}"
-                            "                ]}"
-                            "            }"
-                            "        }"
-                            "        ]"
-                            "}", 1, interactive);
+        MetaData docs = findDocuments(posterDB(), unprocessedSelector(), 1, "[ \"_id\", \"_rev\" ]", interactive, UnprocessedIndex);
     
         if(!docs.isArray() || !docs.size())
             return false;
@@ -257,6 +561,79 @@ namespace Postr
         LOG(INFO) << "fetching document with id " << id;
         return true;
     }
+    
+    int CouchDB::claimDocuments(int count, std::vector<Data>& docs, bool dryrun, bool interactive)
+    {
+        MetaData candidates = findDocuments(posterDB(), unprocessedSelector(), count, "", interactive, UnprocessedIndex);
+        
+        if(!candidates.isArray() || !candidates.size())
+            return 0;
+        
+        std::vector<Data> claims(candidates.size());
+        for(int i=0; i < candidates.size(); ++i)
+        {
+            claims[i].meta = candidates[i];
+            if(!dryrun)
+            {
+                if(claims[i].meta.isMember("leaseExpires"))
+                    LOG(INFO) << "reclaiming document with id " << claims[i].meta["_id"].asString() << " from engine " << claims[i].meta["processedBy"].asString() << " whose lease expired";
+                claims[i].meta["processedBy"] = m_id;
+                claims[i].meta["leaseExpires"] = (Json::Int64)(std::time(nullptr) + m_leaseDuration);
+            }
+        }
+        
+        if(dryrun)
+        {
+            docs.insert(docs.end(), claims.begin(), claims.end());
+            return claims.size();
+        }
+        
+        MetaData status = updateDocuments(claims, false, interactive);
+        
+        int claimed = 0;
+        for(int i=0; i < status.size() && i < claims.size(); ++i)
+        {
+            std::string id = claims[i].meta["_id"].asString();
+            if(status[i]["id"].asString() == id && status[i]["error"].asString().empty())
+            {
+                LOG(INFO) << "claimed document with id " << id;
+                docs.push_back(claims[i]);
+                ++claimed;
+            }
+            else
+            {
+                //another engine is processing this document
+                LOG(DEBUG) << "failed to claim document with id " << id << ": " << status[i]["error"].asString();
+            }
+        }
+        
+        return claimed;
+    }
+    
+    int CouchDB::releaseDocuments(std::vector<Data>& docs, bool interactive)
+    {
+        if(docs.empty())
+            return 0;
+        
+        for(Data& doc : docs)
+        {
+            doc.meta.removeMember("processedBy");
+            doc.meta.removeMember("leaseExpires");
+        }
+        
+        MetaData status = updateDocuments(docs, false, interactive);
+        
+        int released = 0;
+        for(int i=0; i < status.size(); ++i)
+        {
+            if(status[i]["error"].asString().empty())
+                ++released;
+            else
+                LOG(ERROR) << "failed to release document with id " << status[i]["id"].asString() << ": " << status[i]["error"].asString() << ". " << status[i]["reason"].asString();
+        }
+        
+        return released;
+    }
 
     bool CouchDB::getDocumentId(int index, std::string& id, std::string& rev, bool interactive)
     {
@@ -276,6 +653,7 @@ namespace Postr
             request.setOpt(new curlpp::options::Verbose(false));
 
             request.setOpt(new curlpp::options::UserPwd((m_user+":"+m_pass).c_str()));
+            acceptCompression(request);
 
             std::list<std::string> header;
             header.push_back("Content-Type: application/json");
@@ -289,6 +667,7 @@ namespace Postr
             request.perform();
 
             std::string response = ss.str();
+            recordTransfer(request, response.size());
 
             Data resp(response);
 
@@ -335,6 +714,7 @@ namespace Postr
             request.setOpt(new curlpp::options::Verbose(false));
 
             request.setOpt(new curlpp::options::UserPwd((m_user+":"+m_pass).c_str()));
+            acceptCompression(request);
 
             std::list<std::string> header;
             header.push_back("Content-Type: application/json");
@@ -348,6 +728,7 @@ namespace Postr
             request.perform();
 
             std::string response = ss.str();
+            recordTransfer(request, response.size());
 
             Data resp(response);
 
@@ -412,12 +793,14 @@ namespace Postr
             request.setOpt(new curlpp::options::Verbose(false));
 
             request.setOpt(new curlpp::options::UserPwd((m_user+":"+m_pass).c_str()));
+            acceptCompression(request);
 
             std::stringstream ss;
             request.setOpt(new curlpp::options::WriteStream(&ss));
             request.perform();
 
             std::string response = ss.str();
+            recordTransfer(request, response.size(), id);
 
             data.assign(response);
 
@@ -436,8 +819,11 @@ namespace Postr
         return "";
     }
 
-    std::string CouchDB::fetchAttachment(const std::string& id, const std::string& rev, const std::string& name, bool interactive, bool fromEvent)
+    MetaData CouchDB::fetchDocuments(const std::vector<std::string>& ids, bool includeDocs, bool fromEvent, bool interactive)
     {
+        if(ids.empty())
+            return MetaData(Json::arrayValue);
+        
         try
         {
             curlpp::Cleanup cleaner;
@@ -450,8 +836,89 @@ namespace Postr
                 request.setOpt(progressBar);
             }
 
+            std::string db = (!fromEvent)?posterDB():eventDB();
+
             std::list<std::string> header;
+            header.push_back("Content-Type: application/json");
             header.push_back("Accept: application/json");
+            header.push_back("Referer: http://localhost/"+db+"");
+            header.push_back("Host: localhost");
+
+            std::string url = m_url+"/"+db+"/_all_docs";
+            if(includeDocs)
+                url += "?include_docs=true";
+
+            request.setOpt(new curlpp::options::Url(url.c_str()));
+            request.setOpt(new curlpp::options::Port(m_port));
+            request.setOpt(new curlpp::options::Verbose(false));
+
+            request.setOpt(new curlpp::options::UserPwd((m_user+":"+m_pass).c_str()));
+            acceptCompression(request);
+
+            Data keys;
+            keys.meta["keys"] = MetaData(Json::arrayValue);
+            for(const std::string& id : ids)
+            {
+                keys.meta["keys"].append(id);
+            }
+            std::string postdata = keys.serialize(false);
+
+            compressBody(postdata, header);
+            request.setOpt(new curlpp::options::HttpHeader(header));
+
+            request.setOpt(new curlpp::options::PostFields(postdata));
+            request.setOpt(new curlpp::options::PostFieldSize(postdata.length()));
+
+            std::stringstream ss;
+            request.setOpt(new curlpp::options::WriteStream(&ss));
+            request.perform();
+
+            std::string response = ss.str();
+            recordTransfer(request, response.size());
+            Data resp(response);
+
+            if(!resp.meta["error"].asString().empty())
+                LOG(ERROR) << resp.meta["error"].asString() << ". " << resp.meta["reason"].asString();
+
+            return resp.meta["rows"];
+        }
+        catch ( curlpp::LogicError & e ) {
+            LOG(ERROR) << e.what() << std::endl;
+        }
+        catch ( curlpp::RuntimeError & e ) {
+            LOG(ERROR) << e.what() << std::endl;
+        }
+
+        return MetaData(Json::arrayValue);
+    }
+
+    std::string CouchDB::fetchAttachment(const std::string& id, const std::string& rev, const std::string& name, bool interactive, bool fromEvent)
+    {
+        std::vector<unsigned char> buffer;
+        if(!fetchAttachment(id, rev, name, buffer, interactive, fromEvent))
+            return "";
+        
+        return base64_encode(buffer.data(), buffer.size());
+    }
+
+    bool CouchDB::fetchAttachment(const std::string& id, const std::string& rev, const std::string& name, std::vector<unsigned char>& buffer, bool interactive, bool fromEvent)
+    {
+        buffer.clear();
+        
+        try
+        {
+            curlpp::Cleanup cleaner;
+            curlpp::Easy request;
+
+            if(interactive)
+            {
+                curlpp::options::ProgressFunction progressBar([this](double dltotal, double dlnow, double ultotal, double ulnow){return progressCallback(dltotal, dlnow, ultotal, ulnow);});
+                request.setOpt(new curlpp::options::NoProgress(0));
+                request.setOpt(progressBar);
+            }
+
+            std::list<std::string> header;
+            header.push_back("Accept: */*");
             header.push_back("Referer: http://localhost/"+posterDB()+"");
             header.push_back("Host: localhost");
             request.setOpt(new curlpp::options::HttpHeader(header));
@@ -467,17 +934,111 @@ namespace Postr
             request.setOpt(new curlpp::options::Verbose(false));
 
             request.setOpt(new curlpp::options::UserPwd((m_user+":"+m_pass).c_str()));
-
-            std::stringstream ss;
-            request.setOpt(new curlpp::options::WriteStream(&ss));
+            acceptCompression(request);
+
+            //reserve the whole attachment as soon as its size is known to avoid reallocations
+            request.setOpt(new curlpp::options::HeaderFunction([&buffer](char* data, size_t size, size_t nmemb) {
+                std::string line(data, size*nmemb);
+                std::string key = line.substr(0, line.find_first_of(':'));
+                std::transform(key.begin(), key.end(), key.begin(), ::tolower);
+                if(key == "content-length")
+                {
+                    long length = std::atol(line.substr(key.length()+1).c_str());
+                    if(length > 0)
+                        buffer.reserve(length);
+                }
+                return size*nmemb;
+            }));
+            
+            request.setOpt(new curlpp::options::WriteFunction([&buffer](char* data, size_t size, size_t nmemb) {
+                buffer.insert(buffer.end(), data, data+size*nmemb);
+                return size*nmemb;
+            }));
             request.perform();
+            recordTransfer(request, buffer.size(), id);
 
             if(curlpp::infos::ResponseCode::get(request) != 200)
-                return "";
+            {
+                buffer.clear();
+                return false;
+            }
 
-            std::string response = ss.str();
+            return true;
+        }
+        catch ( curlpp::LogicError & e ) {
+            LOG(ERROR) << e.what() << std::endl;
+        }
+        catch ( curlpp::RuntimeError & e ) {
+            LOG(ERROR) << e.what() << std::endl;
+        }
 
-            return base64_encode(reinterpret_cast<const unsigned char*>(response.data()), response.length());
+        buffer.clear();
+        return false;
+    }
+
+    std::string CouchDB::updateAttachment(const std::string& id, const std::string& rev, const std::string& name, const std::string& contentType, const std::vector<unsigned char>& buffer, bool toEvent, bool interactive)
+    {
+        if(id.empty())
+            return "";
+        
+        try
+        {
+            curlpp::Cleanup cleaner;
+            curlpp::Easy request;
+
+            if(interactive)
+            {
+                curlpp::options::ProgressFunction progressBar([this](double dltotal, double dlnow, double ultotal, double ulnow){return progressCallback(dltotal, dlnow, ultotal, ulnow);});
+                request.setOpt(new curlpp::options::NoProgress(0));
+                request.setOpt(progressBar);
+            }
+
+            std::string db = (!toEvent)?posterDB():eventDB();
+
+            std::list<std::string> header;
+            header.push_back("Content-Type: "+contentType);
+            header.push_back("Accept: application/json");
+            header.push_back("Referer: http://localhost/"+db+"");
+            header.push_back("Host: localhost");
+            request.setOpt(new curlpp::options::HttpHeader(header));
+
+            std::string url = m_url+"/"+db+"/"+id+"/"+name;
+            if(!rev.empty())
+            {
+                url += "?rev="+rev;
+            }
+
+            request.setOpt(new curlpp::options::Url(url.c_str()));
+            request.setOpt(new curlpp::options::Port(m_port));
+            request.setOpt(new curlpp::options::Verbose(false));
+
+            request.setOpt(new curlpp::options::UserPwd((m_user+":"+m_pass).c_str()));
+            acceptCompression(request);
+
+            //stream the attachment directly from the buffer
+            size_t offset = 0;
+            request.setOpt(new curlpp::options::Put(true));
+            request.setOpt(new curlpp::options::InfileSize(buffer.size()));
+            request.setOpt(new curlpp::options::ReadFunction([&buffer, &offset](char* data, size_t size, size_t nmemb) {
+                size_t length = std::min(size*nmemb, buffer.size()-offset);
+                std::copy(buffer.begin()+offset, buffer.begin()+offset+length, data);
+                offset += length;
+                return length;
+            }));
+
+            std::stringstream wss;
+            request.setOpt(new curlpp::options::WriteStream(&wss));
+            request.perform();
+
+            std::string response = wss.str();
+            recordTransfer(request, response.size(), id);
+            Data resp(response);
+
+            if(!resp.meta["error"].asString().empty())
+                LOG(ERROR) << resp.meta["error"].asString() << ". " << resp.meta["reason"].asString();
+
+            if(resp.meta["id"].asString() == id)
+                return resp.meta["rev"].asString();
         }
         catch ( curlpp::LogicError & e ) {
             LOG(ERROR) << e.what() << std::endl;
@@ -509,7 +1070,6 @@ namespace Postr
             header.push_back("Accept: application/json");
             header.push_back("Referer: http://localhost/"+posterDB()+"");
             header.push_back("Host: localhost");
-            request.setOpt(new curlpp::options::HttpHeader(header));
 
             std::string url = m_url+"/"+posterDB()+"/"+id;
 
@@ -518,6 +1078,7 @@ namespace Postr
             request.setOpt(new curlpp::options::Verbose(false));
 
             request.setOpt(new curlpp::options::UserPwd((m_user+":"+m_pass).c_str()));
+            acceptCompression(request);
 
             if(data.meta["_id"].asString() != id)
                 LOG(WARNING) << "updating document " << id << " with content id " << data.meta["_id"].asString();
@@ -526,6 +1087,9 @@ namespace Postr
             std::string putdata = data.serialize(false);
             request.setOpt(new curlpp::options::Put(true));
 
+            compressBody(putdata, header);
+            request.setOpt(new curlpp::options::HttpHeader(header));
+
             std::stringstream rss(putdata);
             request.setOpt(new curlpp::options::ReadStream(&rss));
 
@@ -534,6 +1098,7 @@ namespace Postr
             request.perform();
 
             std::string response = wss.str();
+            recordTransfer(request, response.size(), id);
             Data resp(response);
 
             if(!resp.meta["error"].asString().empty())
@@ -558,6 +1123,87 @@ namespace Postr
         return false;
     }
     
+    MetaData CouchDB::updateDocuments(std::vector<Data>& docs, bool toEvent, bool interactive)
+    {
+        if(docs.empty())
+            return MetaData(Json::arrayValue);
+        
+        try
+        {
+            curlpp::Cleanup cleaner;
+            curlpp::Easy request;
+
+            if(interactive)
+            {
+                curlpp::options::ProgressFunction progressBar([this](double dltotal, double dlnow, double ultotal, double ulnow){return progressCallback(dltotal, dlnow, ultotal, ulnow);});
+                request.setOpt(new curlpp::options::NoProgress(0));
+                request.setOpt(progressBar);
+            }
+
+            std::string db = (!toEvent)?posterDB():eventDB();
+
+            std::list<std::string> header;
+            header.push_back("Content-Type: application/json");
+            header.push_back("Accept: application/json");
+            header.push_back("Referer: http://localhost/"+db+"");
+            header.push_back("Host: localhost");
+
+            std::string url = m_url+"/"+db+"/_bulk_docs";
+
+            request.setOpt(new curlpp::options::Url(url.c_str()));
+            request.setOpt(new curlpp::options::Port(m_port));
+            request.setOpt(new curlpp::options::Verbose(false));
+
+            request.setOpt(new curlpp::options::UserPwd((m_user+":"+m_pass).c_str()));
+            acceptCompression(request);
+
+            Data bulk;
+            bulk.meta["docs"] = MetaData(Json::arrayValue);
+            for(const Data& doc : docs)
+            {
+                bulk.meta["docs"].append(doc.meta);
+            }
+            std::string postdata = bulk.serialize(false);
+
+            compressBody(postdata, header);
+            request.setOpt(new curlpp::options::HttpHeader(header));
+
+            request.setOpt(new curlpp::options::PostFields(postdata));
+            request.setOpt(new curlpp::options::PostFieldSize(postdata.length()));
+
+            std::stringstream ss;
+            request.setOpt(new curlpp::options::WriteStream(&ss));
+            request.perform();
+
+            std::string response = ss.str();
+            recordTransfer(request, response.size());
+            Data resp(response);
+
+            if(!resp.meta.isArray())
+            {
+                LOG(ERROR) << resp.meta["error"].asString() << ". " << resp.meta["reason"].asString();
+                return MetaData(Json::arrayValue);
+            }
+
+            //CouchDB reports the results in the same order as the documents were sent
+            for(int i=0; i < resp.meta.size() && i < docs.size(); ++i)
+            {
+                if(resp.meta[i]["error"].asString().empty() && resp.meta[i]["id"].asString() == docs[i].meta["_id"].asString())
+                    docs[i].meta["_rev"] = resp.meta[i]["rev"];
+            }
+
+            return resp.meta;
+        }
+        catch ( curlpp::LogicError & e ) {
+            LOG(ERROR) << e.what() << std::endl;
+        }
+        catch ( curlpp::RuntimeError & e ) {
+            LOG(ERROR) << e.what() << std::endl;
+        }
+
+        return MetaData(Json::arrayValue);
+    }
+    
     std::string CouchDB::updateEvent(Data& data, bool interactive)
     {
         try
@@ -593,17 +1239,20 @@ namespace Postr
             header.push_back("Accept: application/json");
             header.push_back("Referer: http://localhost/"+eventDB()+"");
             header.push_back("Host: localhost");
-            request.setOpt(new curlpp::options::HttpHeader(header));
 
             request.setOpt(new curlpp::options::Url(url.c_str()));
             request.setOpt(new curlpp::options::Port(m_port));
             request.setOpt(new curlpp::options::Verbose(false));
 
             request.setOpt(new curlpp::options::UserPwd((m_user+":"+m_pass).c_str()));
+            acceptCompression(request);
 
             std::string putdata = data.serialize(false);
             request.setOpt(new curlpp::options::Put(true));
 
+            compressBody(putdata, header);
+            request.setOpt(new curlpp::options::HttpHeader(header));
+
             std::stringstream rss(putdata);
             request.setOpt(new curlpp::options::ReadStream(&rss));
 
@@ -612,13 +1261,17 @@ namespace Postr
             request.perform();
 
             std::string response = wss.str();
+            recordTransfer(request, response.size());
             Data resp(response);
 
             if(!resp.meta["error"].asString().empty())
                 LOG(ERROR) << resp.meta["error"].asString() << ". " << resp.meta["reason"].asString();
 
             if(resp.meta.isMember("id"))
+            {
+                data.meta["_rev"] = resp.meta["rev"];
                 return resp.meta["id"].asString();
+            }
         }
         catch ( curlpp::LogicError & e ) {
             LOG(ERROR) << e.what() << std::endl;
@@ -652,7 +1305,6 @@ namespace Postr
             header.push_back("Accept: application/json");
             header.push_back("Referer: http://localhost/"+posterDB()+""); 
             header.push_back("Host: localhost");
-            request.setOpt(new curlpp::options::HttpHeader(header));
 
             std::string url = m_url+"/"+eventDB()+"";
 
@@ -661,9 +1313,13 @@ namespace Postr
             request.setOpt(new curlpp::options::Verbose(false));
 
             request.setOpt(new curlpp::options::UserPwd((m_user+":"+m_pass).c_str()));
+            acceptCompression(request);
 
             std::string postdata = data.serialize(false);
 
+            compressBody(postdata, header);
+            request.setOpt(new curlpp::options::HttpHeader(header));
+
             request.setOpt(new curlpp::options::PostFields(postdata));
             request.setOpt(new curlpp::options::PostFieldSize(postdata.length()));
 
@@ -672,13 +1328,17 @@ namespace Postr
             request.perform();
 
             std::string response = ss.str();
+            recordTransfer(request, response.size());
             Data resp(response);
 
             if(!resp.meta["error"].asString().empty())
                 LOG(ERROR) << resp.meta["error"].asString() << ". " << resp.meta["reason"].asString();
 
             if(resp.meta.isMember("id"))
+            {
+                data.meta["_rev"] = resp.meta["rev"];
                 return resp.meta["id"].asString();
+            }
         }
         catch ( curlpp::LogicError & e ) {
             LOG(ERROR) << e.what() << std::endl;
@@ -726,12 +1386,14 @@ namespace Postr
             request.setOpt(new curlpp::options::Verbose(false));
 
             request.setOpt(new curlpp::options::UserPwd((m_user+":"+m_pass).c_str()));
+            acceptCompression(request);
 
             std::stringstream ss;
             request.setOpt(new curlpp::options::WriteStream(&ss));
             request.perform();
 
             std::string response = ss.str();
+            recordTransfer(request, response.size(), id);
 
             data.assign(response);
 
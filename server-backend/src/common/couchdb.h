@@ -24,11 +24,41 @@
 
 #include "postrdata.h"
 
+#include <list>
+#include <mutex>
+#include <cstdint>
+
+namespace curlpp
+{
+    class Easy;
+}
+
 namespace Postr 
 {
     class CouchDB 
     {
     public:
+        /**
+         * @brief Counters of the bytes sent to and received from the database
+         */
+        struct TransferStats
+        {
+            uint64_t requests = 0;
+            uint64_t compressedRequests = 0;
+            uint64_t compressedResponses = 0;
+            uint64_t bytesSent = 0;             ///< request bytes on the wire
+            uint64_t uncompressedBytesSent = 0; ///< request bytes before compression
+            uint64_t bytesReceived = 0;         ///< response bytes on the wire
+            uint64_t uncompressedBytesReceived = 0; ///< response bytes after decompression
+            double compressionSeconds = 0;      ///< time spent compressing request bodies
+            double transferSeconds = 0;         ///< time spent in http transactions
+            
+            /**
+             * @brief Estimate the transfer time saved by compression based on the measured throughput, minus the time spent compressing.
+             */
+            double secondsSaved() const;
+        };
+        
         /**
          * @brief Constructor
          * @param url URL of the database server
@@ -50,7 +80,49 @@ namespace Postr
          * @return true on success, false else
          */
         bool getNextDocument(std::string& id, std::string& rev, bool interactive = false);
-        
+
+        /**
+         * @brief Claim a batch of documents available in DB for this engine
+         * Fetches up to count candidate documents and sets their processedBy and leaseExpires entries in a single _bulk_docs request.
+         * Documents that have been claimed by another engine in the meantime are skipped.
+         * A claim is only valid until its lease expires. Use renewLeases to extend it.
+         * @param count maximum number of documents to claim
+         * @param docs claimed documents are appended to this vector (without attachments)
+         * @param dryrun if true, documents are fetched but not marked as processed by this engine
+         * @param interactive show progress bar for http transaction
+         * @return number of documents appended to docs
+         */
+        int claimDocuments(int count, std::vector<Data>& docs, bool dryrun = false, bool interactive = false);
+
+        /**
+         * @brief Release documents claimed by claimDocuments so that other engines may process them
+         * @param docs documents to release. The _rev field of each released document will be updated.
+         * @param interactive show progress bar for http transaction
+         * @return number of released documents
+         */
+        int releaseDocuments(std::vector<Data>& docs, bool interactive = false);
+
+        /**
+         * @brief Extend the leases of documents claimed by claimDocuments
+         * @param docs claimed documents. The _rev and leaseExpires fields of each renewed document will be updated.
+         * @param interactive show progress bar for http transaction
+         * @return An array containing an object with id and rev or error and reason for each document, in the order of docs
+         */
+        MetaData renewLeases(std::vector<Data>& docs, bool interactive = false);
+
+        /**
+         * @brief Set the time a claim is valid without being renewed
+         * Documents whose lease expired may be claimed by any engine.
+         * @param seconds duration of a lease in seconds
+         */
+        void setLeaseDuration(int seconds);
+
+        /**
+         * @brief Get the time a claim is valid without being renewed
+         * @return duration of a lease in seconds
+         */
+        int leaseDuration() const;
+
         /**
          * @brief Return the id and revision number of the document at given index available in DB
          * @param index index of the document to retreive
@@ -99,6 +171,16 @@ namespace Postr
          */
         std::string fetchDocument(const std::string& id, const std::string& rev, Data& data, bool withAttachments = false, bool interactive = true);
         
+        /**
+         * @brief Fetch multiple documents with a single _all_docs request
+         * @param ids IDs of the documents
+         * @param includeDocs include the documents, else only their current revisions are fetched
+         * @param fromEvent fetch from eventDB instead of posterDB
+         * @param interactive show progress bar for http transaction
+         * @return An array with a row for each id, containing the revision in value.rev and the document in doc, or an error
+         */
+        MetaData fetchDocuments(const std::vector<std::string>& ids, bool includeDocs = true, bool fromEvent = false, bool interactive = false);
+        
         /**
          * @brief Fetch an attachment 
          * @param id id of the document to fetch an attachment from
@@ -110,6 +192,32 @@ namespace Postr
          */
         std::string fetchAttachment(const std::string& id, const std::string& rev, const std::string& name, bool interactive = true, bool fromEvent = false);
         
+        /**
+         * @brief Fetch the raw binary content of an attachment
+         * The buffer is sized from the Content-Length of the response and can be passed to cv::imdecode without further copies.
+         * @param id id of the document to fetch an attachment from
+         * @param rev revision of the document to fetch an attachment from
+         * @param name name of the attachment
+         * @param buffer receives the content of the attachment
+         * @param interactive show progress bar for http transaction
+         * @param fromEvent fetch Attachment from eventDB instead of posterDB
+         * @return true on success, false else
+         */
+        bool fetchAttachment(const std::string& id, const std::string& rev, const std::string& name, std::vector<unsigned char>& buffer, bool interactive = true, bool fromEvent = false);
+        
+        /**
+         * @brief Upload binary content as an attachment of a document
+         * @param id id of the document to attach to
+         * @param rev current revision of the document
+         * @param name name of the attachment
+         * @param contentType MIME type of the attachment
+         * @param buffer content of the attachment
+         * @param toEvent attach to a document in eventDB instead of posterDB
+         * @param interactive show progress bar for http transaction
+         * @return A new revision string for the document or an empty string on error
+         */
+        std::string updateAttachment(const std::string& id, const std::string& rev, const std::string& name, const std::string& contentType, const std::vector<unsigned char>& buffer, bool toEvent = false, bool interactive = false);
+        
         /**
          * @brief Update a document in DB
          * @param id ID of the document
@@ -118,10 +226,19 @@ namespace Postr
          * @return true on success, false else
          */
         bool updateDocument(const std::string& id, Data& data, bool interactive = false);
-        
+
+        /**
+         * @brief Create or update multiple documents in DB with a single _bulk_docs request
+         * @param docs Documents to write to DB. The _rev field of each successfully written document will be updated.
+         * @param toEvent write to eventDB instead of posterDB
+         * @param interactive show progress bar for http transaction
+         * @return An array containing an object with id and rev or error and reason for each document, in the order of docs
+         */
+        MetaData updateDocuments(std::vector<Data>& docs, bool toEvent = false, bool interactive = false);
+
         /**
          * Creates a new event in DB
-         * @param data event data
+         * @param data event data. The _rev field will be updated.
          * @param interactive show progress bar for http transaction
          * @return id of the new event
          */
@@ -129,7 +246,7 @@ namespace Postr
         
         /**
          * Updates or creates a new event in DB
-         * @param data event data
+         * @param data event data. The _rev field will be updated.
          * @param interactive show progress bar for http transaction
          * @return id of the new event
          */
@@ -151,12 +268,120 @@ namespace Postr
          */
         std::string id() const;
         
+        /**
+         * @brief Create the Mango indexes needed by the queries of this class if they do not exist yet
+         * and verify with _explain that CouchDB uses them.
+         * A warning including the measured query latency is logged for every query that falls back to a full scan.
+         * @param create create missing indexes. If false, indexes are only verified.
+         * @param interactive show progress bar for http transaction
+         * @return true if all queries use an index, false else
+         */
+        bool ensureIndexes(bool create = true, bool interactive = false);
+        
+        /**
+         * @brief Configure compression of http bodies
+         * Response compression is negotiated with Accept-Encoding and decoded transparently.
+         * CouchDB itself sends uncompressed responses, they are only compressed by a reverse proxy in front of it.
+         * Request bodies are sent with "Content-Encoding: gzip", which requires a CouchDB version that accepts compressed requests.
+         * @param responses Accept gzip and deflate compressed responses
+         * @param requests Compress JSON request bodies
+         * @param minRequestSize Request bodies smaller than this number of bytes are sent uncompressed
+         */
+        void setCompression(bool responses, bool requests = false, size_t minRequestSize = 1024);
+        
+        /**
+         * @brief Transfer counters since this instance has been created
+         */
+        TransferStats transferStats() const;
+        
     private:
         /**
          * @brief Progress callback for http transactions
          */
         double progressCallback(double dltotal, double dlnow, double ultotal, double ulnow) const;
         
+        /**
+         * @brief Let a request accept compressed responses if enabled
+         */
+        void acceptCompression(curlpp::Easy& request) const;
+        
+        /**
+         * @brief Compress a request body if enabled and the body is large enough
+         * @param body The request body, replaced by the compressed body
+         * @param header The request headers. Content-Encoding is added if the body has been compressed.
+         */
+        void compressBody(std::string& body, std::list<std::string>& header) const;
+        
+        /**
+         * @brief Update the transfer counters after a request has been performed
+         * @param request The performed request
+         * @param uncompressedBytesReceived Size of the decoded response body
+         * @param document ID of the document the request belongs to, empty for requests concerning several documents
+         */
+        void recordTransfer(curlpp::Easy& request, size_t uncompressedBytesReceived, const std::string& document = "") const;
+
+        /**
+         * @brief Run a _find query against a table
+         * @param db name of the table
+         * @param selector The selector all documents must match
+         * @param limit Maximum number of documents in result
+         * @param fields json array of fields to return. Full documents are returned if empty.
+         * @param interactive show progress bar for http transaction
+         * @param useIndex name of the index to use. CouchDB chooses an index if empty.
+         * @return An array of the matching documents
+         */
+        MetaData findDocuments(const std::string& db, const std::string& selector, int limit, const std::string& fields, bool interactive, const std::string& useIndex = "");
+        
+        /**
+         * @brief Build the request body of a _find or _explain query
+         */
+        static std::string findQuery(const std::string& selector, int limit, const std::string& fields, const std::string& useIndex);
+        
+        /**
+         * @brief Create a Mango index in the design document of this engine, if it does not exist
+         * @param db name of the table
+         * @param name name of the index
+         * @param index json definition of the index
+         * @param interactive show progress bar for http transaction
+         * @return true if the index exists, false else
+         */
+        bool createIndex(const std::string& db, const std::string& name, const std::string& index, bool interactive);
+        
+        /**
+         * @brief Ask CouchDB which index it would use for a query
+         * @param db name of the table
+         * @param query request body of a _find query
+         * @param interactive show progress bar for http transaction
+         * @return the query plan as returned by _explain
+         */
+        MetaData explainQuery(const std::string& db, const std::string& query, bool interactive);
+
+        /**
+         * @brief Returns a selector matching all documents that still need to be processed by an engine
+         * and are not claimed by an engine or whose lease has expired
+         */
+        std::string unprocessedSelector() const;
+        
+        /**
+         * @brief Returns a selector matching all documents that still need to be processed by an engine, regardless of any claims
+         */
+        static std::string pendingSelector();
+        
+        /**
+         * @brief Name of the design document holding the indexes created by ensureIndexes
+         */
+        static constexpr const char* IndexDesignDoc = "postr-indexes";
+        
+        /**
+         * @brief Name of the partial index matching pendingSelector
+         */
+        static constexpr const char* UnprocessedIndex = "postr-pending";
+        
+        /**
+         * @brief Name of the index on the event field of posters
+         */
+        static constexpr const char* EventIndex = "postr-event";
+
         /**
          * @brief Returns the name of the events table in DB
          */
@@ -179,6 +404,12 @@ namespace Postr
         std::string m_user;
         std::string m_pass;
         bool m_debugDB;
+        int m_leaseDuration;
+        bool m_compressResponses;
+        bool m_compressRequests;
+        size_t m_minCompressedSize;
+        mutable TransferStats m_transferStats;
+        mutable std::mutex m_transferMutex;
     };
 }
 
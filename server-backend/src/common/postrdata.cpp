@@ -22,6 +22,7 @@
 #include "postrdata.h"
 
 #include <iostream>
+#include <set>
 #include <opencv2/highgui.hpp>
 
 namespace Postr 
@@ -130,6 +131,37 @@ namespace Postr
         setlocale(LC_ALL, locale);
     }
     
+    static size_t metaSize(const MetaData& value)
+    {
+        size_t size = sizeof(MetaData);
+        if(value.isString())
+            size += value.asString().size();
+        else if(value.isArray())
+        {
+            for(const MetaData& element : value)
+                size += metaSize(element);
+        }
+        else if(value.isObject())
+        {
+            for(auto it = value.begin(); it != value.end(); ++it)
+                size += it.name().size() + metaSize(*it);
+        }
+        return size;
+    }
+    
+    size_t Data::memoryUsage() const
+    {
+        size_t size = metaSize(meta);
+        std::set<const uchar*> buffers;
+        for(const ImageData& image : images)
+        {
+            if(!image.datastart || !buffers.insert(image.datastart).second)
+                continue;
+            size += image.u ? image.u->size : (size_t)(image.dataend - image.datastart);
+        }
+        return size;
+    }
+    
     void Data::swap(Data& other)
     {
         meta.swap(other.meta);
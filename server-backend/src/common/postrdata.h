@@ -80,6 +80,13 @@ namespace Postr
          */
         std::string serialize(bool includeImages = true, bool beautify = false) const;
         
+        /**
+         * @brief Approximate number of bytes held by this Data
+         * Images sharing a buffer are counted once. Metadata is estimated from the number of values and the length of strings.
+         * @return the number of bytes
+         */
+        size_t memoryUsage() const;
+        
         virtual void log(el::base::type::ostream_t& os) const override;
         
         /**
@@ -0,0 +1,163 @@
+/**
+ * This file is part of Poster Safari.
+ *
+ *  Poster Safari is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Poster Safari is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with Poster Safari.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ * 
+ *  Copyright 2017 Moritz Dannehl, Rebecca Lühmann, Nicolas Marin, Michael Nieß, Julian Wolff
+ * 
+ */
+
+#include "tracer.h"
+
+#include <fstream>
+#include <functional>
+#include <algorithm>
+
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include <json/json.h>
+
+#include "easylogging++.h"
+
+#undef LOG
+#define LOG(LEVEL) (CLOG(LEVEL, ELPP_CURR_FILE_LOGGER_ID) << "[Tracer] ")
+
+namespace Postr
+{
+    /**
+     * Events beyond this number are dropped to bound the memory used by long runs
+     */
+    static const size_t MaxEvents = 4000000;
+    
+#ifndef WORKER_LIBRARY
+    std::atomic_bool Tracer::m_enabled(false);
+    std::string Tracer::m_filename;
+    double Tracer::m_sampleRate = 1;
+    Tracer::Clock::time_point Tracer::m_start;
+    std::vector<Tracer::Event> Tracer::m_events;
+    size_t Tracer::m_dropped = 0;
+    std::mutex Tracer::m_mutex;
+#endif
+    
+    Tracer::Span::Span(const char *category, const std::string& name, const std::string& document)
+        : m_category(category)
+        , m_active(Tracer::enabled() && Tracer::sampled(document))
+    {
+        if(m_active)
+        {
+            m_name = name;
+            m_document = document;
+            m_begin = Clock::now();
+        }
+    }
+    
+    Tracer::Span::~Span()
+    {
+        if(m_active)
+            Tracer::complete(m_category, m_name, m_document, m_begin, Clock::now());
+    }
+    
+    void Tracer::start(const std::string& filename, double sampleRate)
+    {
+        std::lock_guard<std::mutex> lk(m_mutex);
+        m_filename = filename;
+        m_sampleRate = std::max(0., std::min(1., sampleRate));
+        m_start = Clock::now();
+        m_events.clear();
+        m_dropped = 0;
+        m_enabled = true;
+        LOG(INFO) << "tracing " << 100*m_sampleRate << "% of all documents to " << m_filename;
+    }
+    
+    bool Tracer::stop()
+    {
+        std::lock_guard<std::mutex> lk(m_mutex);
+        if(!m_enabled)
+            return false;
+        m_enabled = false;
+        
+        std::ofstream file(m_filename, std::ios::trunc);
+        if(!file)
+        {
+            LOG(ERROR) << "could not write trace to " << m_filename;
+            return false;
+        }
+        
+        long pid = ::getpid();
+        file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+        for(size_t i=0; i < m_events.size(); ++i)
+        {
+            const Event& event = m_events[i];
+            file << "{\"ph\":\"X\",\"cat\":\"" << event.category << "\",\"name\":" << Json::valueToQuotedString(event.name.c_str())
+                 << ",\"ts\":" << event.begin << ",\"dur\":" << event.duration
+                 << ",\"pid\":" << pid << ",\"tid\":" << event.thread;
+            if(!event.document.empty())
+                file << ",\"args\":{\"document\":" << Json::valueToQuotedString(event.document.c_str()) << "}";
+            file << ((i+1 < m_events.size()) ? "},\n" : "}\n");
+        }
+        file << "]}\n";
+        
+        if(m_dropped > 0)
+            LOG(WARNING) << "dropped " << m_dropped << " trace events. Use a lower sample rate to trace long runs";
+        LOG(INFO) << "wrote " << m_events.size() << " trace events to " << m_filename;
+        
+        m_events.clear();
+        m_events.shrink_to_fit();
+        return file.good();
+    }
+    
+    bool Tracer::sampled(const std::string& document)
+    {
+        if(m_sampleRate >= 1)
+            return true;
+        //events not belonging to a document would fill the trace of a long sampled run
+        if(document.empty())
+            return false;
+        return (std::hash<std::string>()(document) % 10000) < m_sampleRate*10000;
+    }
+    
+    void Tracer::complete(const char *category, const std::string& name, const std::string& document, Clock::time_point begin, Clock::time_point end, long thread)
+    {
+        if(!enabled() || !sampled(document))
+            return;
+        
+        std::lock_guard<std::mutex> lk(m_mutex);
+        if(m_events.size() >= MaxEvents)
+        {
+            ++m_dropped;
+            return;
+        }
+        m_events.push_back({category, name, document,
+            std::chrono::duration_cast<std::chrono::microseconds>(begin - m_start).count(),
+            std::chrono::duration_cast<std::chrono::microseconds>(end - begin).count(),
+            thread});
+    }
+    
+    long Tracer::currentThread()
+    {
+        static thread_local long id = ::syscall(SYS_gettid);
+        return id;
+    }
+    
+    std::string Tracer::documentId(const MetaData& meta)
+    {
+        if(meta.isMember("_id") && !meta["_id"].asString().empty())
+            return meta["_id"].asString();
+        if(meta.isMember("filename"))
+            return meta["filename"].asString();
+        return "";
+    }
+}
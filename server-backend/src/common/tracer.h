@@ -0,0 +1,138 @@
+/**
+ * This file is part of Poster Safari.
+ *
+ *  Poster Safari is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Poster Safari is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with Poster Safari.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ * 
+ *  Copyright 2017 Moritz Dannehl, Rebecca Lühmann, Nicolas Marin, Michael Nieß, Julian Wolff
+ * 
+ */
+
+#ifndef TRACER_H
+#define TRACER_H
+
+#include "metadata.h"
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <mutex>
+
+namespace Postr
+{
+    /**
+     * @brief Records the execution of documents in the pipeline as Chrome trace events.
+     * Stages, joins, waits for busy workers and CouchDB requests are recorded with the ID of the document and the thread.
+     * The trace is written when the Tracer is stopped and can be viewed in Perfetto (https://ui.perfetto.dev) or chrome://tracing.
+     * Tracing is disabled by default. While disabled, recording an event only costs an atomic load.
+     */
+    class Tracer
+    {
+    public:
+        typedef std::chrono::steady_clock Clock;
+        
+        /**
+         * @brief Records the time between its construction and destruction as one event
+         */
+        class Span
+        {
+        public:
+            /**
+             * @param category category of the event, e.g. "stage" or "http"
+             * @param name name of the event
+             * @param document ID of the document the event belongs to. Empty for events not belonging to a document.
+             */
+            Span(const char *category, const std::string& name, const std::string& document = "");
+            ~Span();
+            
+        private:
+            const char *m_category;
+            std::string m_name;
+            std::string m_document;
+            Clock::time_point m_begin;
+            bool m_active;
+        };
+        
+        /**
+         * @brief Start recording events
+         * @param filename file to write the trace to when stop() is called
+         * @param sampleRate fraction of documents in range [0,1] to record events of. Whether a document is recorded depends on its ID only, so all events of a sampled document are recorded.
+         * Events not belonging to a document are only recorded if all documents are.
+         */
+        static void start(const std::string& filename, double sampleRate = 1);
+        
+        /**
+         * @brief Stop recording events and write the trace
+         * @return true if the trace has been written
+         */
+        static bool stop();
+        
+        /**
+         * @brief Check whether events are recorded
+         */
+        static bool enabled()
+        {
+            return m_enabled.load(std::memory_order_acquire);
+        }
+        
+        /**
+         * @brief Check whether events of a document are recorded
+         * @param document ID of the document, empty for events not belonging to a document
+         */
+        static bool sampled(const std::string& document);
+        
+        /**
+         * @brief Record an event that has already ended
+         * @param category category of the event
+         * @param name name of the event
+         * @param document ID of the document the event belongs to
+         * @param begin time the event began
+         * @param end time the event ended
+         * @param thread ID of the thread the event happened on as returned by currentThread()
+         */
+        static void complete(const char *category, const std::string& name, const std::string& document, Clock::time_point begin, Clock::time_point end, long thread = currentThread());
+        
+        /**
+         * @brief ID of the calling thread as shown by the operating system
+         */
+        static long currentThread();
+        
+        /**
+         * @brief ID of a document used in events. The CouchDB ID or the filename of local documents.
+         */
+        static std::string documentId(const MetaData& meta);
+        
+    private:
+        struct Event
+        {
+            const char *category;
+            std::string name;
+            std::string document;
+            long long begin;        ///< microseconds since start()
+            long long duration;     ///< microseconds
+            long thread;
+        };
+        
+        static std::atomic_bool m_enabled;
+        static std::string m_filename;
+        static double m_sampleRate;
+        static Clock::time_point m_start;
+        static std::vector<Event> m_events;
+        static size_t m_dropped;
+        static std::mutex m_mutex;
+    };
+}
+
+#endif //TRACER_H
@@ -31,7 +31,6 @@
 
 #include <opencv2/imgcodecs.hpp>
 
-#include "base64.h"
 
 DocumentModel::DocumentModel(QObject* parent, bool debug)
     : QAbstractListModel(parent)
@@ -222,21 +221,12 @@ void DocumentModel::fetchData(const QModelIndex& index, bool force)
     
     emit dataChanged(index, index);
     
-    std::string image;
-    image = m_engine.fetchAttachment(m_userData[i].meta["_id"].asString(), m_userData[i].meta["_rev"].asString(), "userimage_thumb", true);
-    if(image.empty())
-        image = m_engine.fetchAttachment(m_userData[i].meta["_id"].asString(), m_userData[i].meta["_rev"].asString(), "userimage", true);
-    
-    image = image.substr(image.find_first_of(':')+1);
-    //std::string type = image.substr(0,image.find_first_of(';'));
-    image = image.substr(image.find_first_of(',')+1);
-
-    std::string decoded = base64_decode(image);
-    
-    std::vector<uchar> imdata(decoded.begin(), decoded.end());
+    std::vector<uchar> imdata;
+    if(!m_engine.fetchAttachment(m_userData[i].meta["_id"].asString(), m_userData[i].meta["_rev"].asString(), "userimage_thumb", imdata, true))
+        m_engine.fetchAttachment(m_userData[i].meta["_id"].asString(), m_userData[i].meta["_rev"].asString(), "userimage", imdata, true);
 
     if(!imdata.empty())
-        m_userImage[i] = cv::imdecode(cv::Mat(imdata),cv::IMREAD_ANYCOLOR);
+        m_userImage[i] = cv::imdecode(imdata,cv::IMREAD_ANYCOLOR);
     
     emit dataChanged(index, index);
     
@@ -244,19 +234,11 @@ void DocumentModel::fetchData(const QModelIndex& index, bool force)
     {
         std::string key = m_userData[i].meta["event"].asString();
         
-        std::string image;
-        image = m_engine.fetchAttachment(m_postrData[key].meta["_id"].asString(),m_postrData[key].meta["_rev"].asString(), "best", true, true);
-        
-        image = image.substr(image.find_first_of(':')+1);
-        //std::string type = image.substr(0,image.find_first_of(';'));
-        image = image.substr(image.find_first_of(',')+1);
-
-        std::string decoded = base64_decode(image);
-        
-        std::vector<uchar> imdata(decoded.begin(), decoded.end());
+        std::vector<uchar> imdata;
+        m_engine.fetchAttachment(m_postrData[key].meta["_id"].asString(),m_postrData[key].meta["_rev"].asString(), "best", imdata, true, true);
 
         if(!imdata.empty())
-            m_postrImage[key] = cv::imdecode(cv::Mat(imdata),cv::IMREAD_ANYCOLOR);
+            m_postrImage[key] = cv::imdecode(imdata,cv::IMREAD_ANYCOLOR);
         
         emit dataChanged(index, index);
     }
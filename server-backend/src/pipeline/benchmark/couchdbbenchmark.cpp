@@ -0,0 +1,202 @@
+/**
+ * This file is part of Poster Safari.
+ *
+ *  Poster Safari is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Poster Safari is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with Poster Safari.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ *  Copyright 2017 Moritz Dannehl, Rebecca Lühmann, Nicolas Marin, Michael Nieß, Julian Wolff
+ *
+ */
+
+#include "couchdbstub.h"
+#include "couchdbstream.h"
+
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/imgproc.hpp>
+
+#include <iostream>
+#include <iomanip>
+#include <thread>
+#include <chrono>
+#include <atomic>
+
+#include "argagg.hpp"
+
+#include "util.h"
+
+/**
+ * Drives a CouchDBStream against an in-memory CouchDB stand-in and reports
+ * the number of documents processed per second and the latency of each endpoint.
+ */
+int main(int argc, char** argv)
+{
+    argagg::parser argparser {{
+        { "help", {"-h", "--help"},
+        "shows this help message", 0},
+        { "documents", {"-n", "--documents"},
+        "number of poster documents in the database (default 200)", 1},
+        { "image", {"-i", "--image"},
+        "image attached to every poster (default: generated 1240x1754 JPEG)", 1},
+        { "batch-size", {"-B", "--batch-size"},
+        "number of documents claimed with a single request (default 10)", 1},
+        { "prefetch", {"-p", "--prefetch"},
+        "number of queued documents whose images are prefetched (default 2)", 1},
+        { "consumers", {"-c", "--consumers"},
+        "number of threads reading from the stream concurrently (default 1)", 1},
+        { "processing", {"-w", "--processing"},
+        "simulated processing time per document in milliseconds (default 0)", 1},
+        { "latency", {"-l", "--latency"},
+        "latency in milliseconds added to every request (default 0)", 1},
+        { "jitter", {"-j", "--jitter"},
+        "maximum random latency in milliseconds added on top of --latency (default 0)", 1},
+        { "conflicts", {"-x", "--conflicts"},
+        "probability of document updates failing with a conflict (default 0)", 1},
+        { "compress", {"-z", "--compress"},
+        "compress request bodies", 0},
+        { "proxy-gzip", {"-g", "--proxy-gzip"},
+        "gzip JSON responses like a compressing reverse proxy in front of CouchDB (CouchDB itself doesn't)", 0},
+        { "no-compression", {"-u", "--no-compression"},
+        "neither accept compressed responses nor compress requests", 0},
+        { "timeout", {"-t", "--timeout"},
+        "abort after this number of seconds (default 300)", 1},
+        { "verbose", {"-v", "--verbose"},
+        "log to stdout (set to a value in range 1 (FATAL) to 6 (DEBUG) to specify the log level)", 1},
+    }};
+
+    argagg::parser_results args;
+    try {
+        args = argparser.parse(argc, argv);
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    if (args["help"])
+    {
+        std::cout << "Usage: postr-couchdb-benchmark [options]" << std::endl << argparser;
+        return 0;
+    }
+
+    int documents = args["documents"].as<int>(200);
+    int batchsize = args["batch-size"].as<int>(10);
+    int prefetch = args["prefetch"].as<int>(2);
+    int consumers = std::max(1, args["consumers"].as<int>(1));
+    int processing = args["processing"].as<int>(0);
+    int timeout = args["timeout"].as<int>(300);
+
+    Postr::Worker::initializeLog(args["verbose"].as<int>(2));
+    Postr::Worker::interactive = false;
+
+    cv::Mat image;
+    if(args["image"])
+        image = cv::imread(args["image"].as<std::string>());
+    if(image.empty())
+    {
+        //a gradient with some noise compresses roughly like a photo of a poster
+        image = cv::Mat(1754, 1240, CV_8UC3);
+        cv::randu(image, cv::Scalar::all(0), cv::Scalar::all(64));
+        for(int y=0; y < image.rows; ++y)
+            image.row(y) += cv::Scalar(y*191/image.rows, 128, 255-y*191/image.rows);
+    }
+    std::vector<uchar> encoded;
+    cv::imencode(".jpg", image, encoded);
+
+    Postr::CouchDBStub stub(std::max(16, consumers*4));
+    stub.setLatency(args["latency"].as<int>(0), args["jitter"].as<int>(0));
+    stub.setConflictRate(args["conflicts"].as<double>(0));
+    stub.setResponseCompression(args["proxy-gzip"]);
+    int port = stub.start();
+    if(port < 0)
+        return 1;
+
+    for(int i=0; i < documents; ++i)
+        stub.addPoster(encoded);
+
+    std::cout << "database: " << documents << " posters with " << encoded.size()/1024 << " KiB images" << std::endl;
+
+    std::atomic_int processed(0);
+    auto start = std::chrono::steady_clock::now();
+    double readSeconds = 0;
+    {
+        Postr::CouchDBStream stream("127.0.0.1", port, "benchmark", "benchmark", false, false, batchsize, prefetch);
+        stream.setCompression(!args["no-compression"], args["compress"] && !args["no-compression"]);
+
+        //get() blocks while no documents are available, close the stream to stop waiting
+        std::atomic_bool done(false);
+        std::thread watchdog([&]{
+            auto deadline = start + std::chrono::seconds(timeout);
+            while(!done && std::chrono::steady_clock::now() < deadline)
+                std::this_thread::sleep_for(std::chrono::milliseconds(50));
+            if(!done)
+                stream.close();
+        });
+
+        std::vector<std::thread> threads;
+        for(int i=0; i < consumers; ++i)
+        {
+            threads.push_back(std::thread([&]{
+                while(processed < documents && stream.is_open())
+                {
+                    Postr::Data data;
+                    stream.get(data);
+                    if(data.meta["_id"].asString().empty() || data.originalImage() < 0)
+                        break;
+
+                    if(processing > 0)
+                        std::this_thread::sleep_for(std::chrono::milliseconds(processing));
+
+                    data.meta["result"]["title"] = "Benchmark " + data.meta["_id"].asString();
+                    data.meta["images"]["best"] = data.meta["images"]["original"];
+                    stream.handleResult(data);
+                    ++processed;
+                }
+            }));
+        }
+        for(std::thread& thread : threads)
+            thread.join();
+
+        readSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        done = true;
+        watchdog.join();
+        //the destructor waits for all results to be written
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    Postr::MetaData linked;
+    linked["event"]["$exists"] = true;
+    int committed = stub.countDocuments("poster", linked);
+
+    std::cout << std::fixed << std::setprecision(1);
+    std::cout << "read " << processed << " documents in " << readSeconds << "s (" << processed/std::max(readSeconds, 1e-9) << " docs/s)" << std::endl;
+    std::cout << "committed " << committed << " documents in " << seconds << "s (" << committed/std::max(seconds, 1e-9) << " docs/s)" << std::endl;
+    if(args["proxy-gzip"])
+        std::cout << "responses were gzipped as by a reverse proxy, CouchDB alone sends them uncompressed" << std::endl;
+    std::cout << std::endl;
+
+    std::cout << std::left << std::setw(36) << "endpoint" << std::right
+              << std::setw(10) << "requests" << std::setw(10) << "conflicts"
+              << std::setw(10) << "avg ms" << std::setw(10) << "max ms"
+              << std::setw(12) << "KiB in" << std::setw(12) << "KiB out" << std::endl;
+    for(const auto& endpoint : stub.statistics())
+    {
+        const Postr::CouchDBStub::EndpointStats& stats = endpoint.second;
+        std::cout << std::left << std::setw(36) << endpoint.first << std::right
+                  << std::setw(10) << stats.requests << std::setw(10) << stats.conflicts
+                  << std::setw(10) << stats.totalMs/std::max(1, stats.requests) << std::setw(10) << stats.maxMs
+                  << std::setw(12) << stats.bytesIn/1024. << std::setw(12) << stats.bytesOut/1024. << std::endl;
+    }
+
+    stub.stop();
+    return (committed == documents) ? 0 : 1;
+}
@@ -0,0 +1,1186 @@
+/**
+ * This file is part of Poster Safari.
+ *
+ *  Poster Safari is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Poster Safari is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with Poster Safari.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ *  Copyright 2017 Moritz Dannehl, Rebecca Lühmann, Nicolas Marin, Michael Nieß, Julian Wolff
+ *
+ */
+
+#include "couchdbstub.h"
+
+#include <sstream>
+#include <chrono>
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include <json/json.h>
+
+#include "easylogging++.h"
+
+#include "base64.h"
+#include "util.h"
+#include "compression.h"
+
+#undef LOG
+#define LOG(LEVEL) (CLOG(LEVEL, ELPP_CURR_FILE_LOGGER_ID) << "[CouchDB Stub] ")
+
+namespace Postr
+{
+    namespace
+    {
+        std::string serialize(const MetaData& value)
+        {
+            Json::FastWriter writer;
+            return writer.write(value);
+        }
+
+        bool parse(const std::string& str, MetaData& value)
+        {
+            Json::Reader reader;
+            return reader.parse(str, value);
+        }
+
+        std::string urlDecode(const std::string& str)
+        {
+            std::string decoded;
+            decoded.reserve(str.size());
+            for(size_t i=0; i < str.size(); ++i)
+            {
+                if(str[i] == '%' && i+2 < str.size())
+                {
+                    decoded += (char)std::strtol(str.substr(i+1, 2).c_str(), nullptr, 16);
+                    i += 2;
+                }
+                else if(str[i] == '+')
+                    decoded += ' ';
+                else
+                    decoded += str[i];
+            }
+            return decoded;
+        }
+
+        std::string lower(std::string str)
+        {
+            std::transform(str.begin(), str.end(), str.begin(), ::tolower);
+            return str;
+        }
+
+        std::string trim(const std::string& str)
+        {
+            size_t begin = str.find_first_not_of(" \t\r\n");
+            if(begin == std::string::npos)
+                return "";
+            size_t end = str.find_last_not_of(" \t\r\n");
+            return str.substr(begin, end-begin+1);
+        }
+
+        const char* statusText(int status)
+        {
+            switch(status)
+            {
+                case 200: return "OK";
+                case 201: return "Created";
+                case 202: return "Accepted";
+                case 400: return "Bad Request";
+                case 404: return "Object Not Found";
+                case 405: return "Method Not Allowed";
+                case 409: return "Conflict";
+                default: return "Internal Server Error";
+            }
+        }
+
+        /**
+         * @brief Resolve a dotted field path like "_attachments.userimage" in a document
+         */
+        const MetaData* resolve(const MetaData& doc, const std::string& path)
+        {
+            const MetaData* value = &doc;
+            std::stringstream ss(path);
+            std::string key;
+            while(std::getline(ss, key, '.'))
+            {
+                if(!value->isObject() || !value->isMember(key))
+                    return nullptr;
+                value = &((*value)[key]);
+            }
+            return value;
+        }
+
+        int compare(const MetaData& a, const MetaData& b)
+        {
+            if(a.isNumeric() && b.isNumeric())
+            {
+                double da = a.asDouble(), db = b.asDouble();
+                return (da < db)?-1:((da > db)?1:0);
+            }
+            if(a < b)
+                return -1;
+            if(b < a)
+                return 1;
+            return 0;
+        }
+
+        bool sameType(const MetaData& a, const MetaData& b)
+        {
+            return (a.isNumeric() && b.isNumeric()) || (a.isString() && b.isString()) || a.type() == b.type();
+        }
+    }
+
+    CouchDBStub::CouchDBStub(int threads)
+        : m_latency(0)
+        , m_jitter(0)
+        , m_conflictRate(0)
+        , m_compressResponses(false)
+        , m_random(std::random_device()())
+        , m_threadCount(std::max(1, threads))
+        , m_socket(-1)
+        , m_port(-1)
+        , m_running(false)
+    {
+    }
+
+    CouchDBStub::~CouchDBStub()
+    {
+        stop();
+    }
+
+    int CouchDBStub::start(int port)
+    {
+        if(m_running)
+            return m_port;
+
+        m_socket = ::socket(AF_INET, SOCK_STREAM, 0);
+        if(m_socket < 0)
+        {
+            LOG(ERROR) << "could not create socket: " << std::strerror(errno);
+            return -1;
+        }
+
+        int reuse = 1;
+        ::setsockopt(m_socket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+        sockaddr_in address;
+        std::memset(&address, 0, sizeof(address));
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        address.sin_port = htons(port);
+
+        if(::bind(m_socket, (sockaddr*)&address, sizeof(address)) < 0 || ::listen(m_socket, 128) < 0)
+        {
+            LOG(ERROR) << "could not listen on port " << port << ": " << std::strerror(errno);
+            ::close(m_socket);
+            m_socket = -1;
+            return -1;
+        }
+
+        socklen_t length = sizeof(address);
+        ::getsockname(m_socket, (sockaddr*)&address, &length);
+        m_port = ntohs(address.sin_port);
+
+        m_running = true;
+        for(int i=0; i < m_threadCount; ++i)
+            m_workers.push_back(std::thread(&CouchDBStub::work, this));
+        m_listenthread = std::thread(&CouchDBStub::listen, this);
+
+        LOG(INFO) << "listening on 127.0.0.1:" << m_port;
+        return m_port;
+    }
+
+    void CouchDBStub::stop()
+    {
+        if(!m_running)
+            return;
+
+        {
+            std::lock_guard<std::mutex> lk(m_connectionmutex);
+            m_running = false;
+            //wake up threads blocked in accept or recv
+            ::shutdown(m_socket, SHUT_RDWR);
+            for(int socket : m_open)
+                ::shutdown(socket, SHUT_RDWR);
+        }
+        m_connectioncondition.notify_all();
+
+        if(m_listenthread.joinable())
+            m_listenthread.join();
+        for(std::thread& worker : m_workers)
+            worker.join();
+        m_workers.clear();
+
+        for(int socket : m_connections)
+            ::close(socket);
+        m_connections.clear();
+
+        ::close(m_socket);
+        m_socket = -1;
+        m_port = -1;
+    }
+
+    int CouchDBStub::port() const
+    {
+        return m_port;
+    }
+
+    void CouchDBStub::setLatency(int ms, int jitter)
+    {
+        m_latency = std::max(0, ms);
+        m_jitter = std::max(0, jitter);
+    }
+
+    void CouchDBStub::setConflictRate(double rate)
+    {
+        std::lock_guard<std::mutex> lk(m_dbmutex);
+        m_conflictRate = std::min(1., std::max(0., rate));
+    }
+
+    void CouchDBStub::setResponseCompression(bool enabled)
+    {
+        m_compressResponses = enabled;
+    }
+
+    std::string CouchDBStub::addPoster(const std::vector<unsigned char>& image, const std::string& contentType, const std::string& db)
+    {
+        std::lock_guard<std::mutex> lk(m_dbmutex);
+        Database& database = m_databases[db];
+
+        std::string id = Util::uuid();
+        Document& doc = database.docs[id];
+        doc.body["_id"] = id;
+        doc.body["type"] = "poster";
+        doc.attachments["userimage"].contentType = contentType;
+        doc.attachments["userimage"].data = image;
+        newRevision(database, doc);
+        return id;
+    }
+
+    int CouchDBStub::countDocuments(const std::string& db, const MetaData& selector) const
+    {
+        std::lock_guard<std::mutex> lk(m_dbmutex);
+        auto database = m_databases.find(db);
+        if(database == m_databases.end())
+            return 0;
+
+        int count = 0;
+        for(const auto& doc : database->second.docs)
+        {
+            if(matches(documentJson(doc.first, doc.second, false), selector))
+                ++count;
+        }
+        return count;
+    }
+
+    std::map<std::string, CouchDBStub::EndpointStats> CouchDBStub::statistics() const
+    {
+        std::lock_guard<std::mutex> lk(m_statsmutex);
+        return m_stats;
+    }
+
+    void CouchDBStub::resetStatistics()
+    {
+        std::lock_guard<std::mutex> lk(m_statsmutex);
+        m_stats.clear();
+    }
+
+    void CouchDBStub::listen()
+    {
+        while(m_running)
+        {
+            int socket = ::accept(m_socket, nullptr, nullptr);
+            if(socket < 0)
+            {
+                if(m_running && errno != EINTR)
+                    LOG(WARNING) << "accept failed: " << std::strerror(errno);
+                continue;
+            }
+
+            int nodelay = 1;
+            ::setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+
+            //don't let idle keep-alive connections block a worker forever
+            timeval timeout;
+            timeout.tv_sec = 5;
+            timeout.tv_usec = 0;
+            ::setsockopt(socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+            {
+                std::lock_guard<std::mutex> lk(m_connectionmutex);
+                if(!m_running)
+                {
+                    ::close(socket);
+                    break;
+                }
+                m_connections.push_back(socket);
+            }
+            m_connectioncondition.notify_one();
+        }
+    }
+
+    void CouchDBStub::work()
+    {
+        while(true)
+        {
+            int socket;
+            {
+                std::unique_lock<std::mutex> lk(m_connectionmutex);
+                m_connectioncondition.wait(lk, [this]{
+                    return !m_running || !m_connections.empty();
+                });
+                if(!m_running)
+                    return;
+                socket = m_connections.front();
+                m_connections.pop_front();
+                m_open.insert(socket);
+            }
+
+            handleConnection(socket);
+
+            {
+                std::lock_guard<std::mutex> lk(m_connectionmutex);
+                m_open.erase(socket);
+            }
+            ::close(socket);
+        }
+    }
+
+    void CouchDBStub::handleConnection(int socket)
+    {
+        thread_local std::mt19937 random(std::random_device{}());
+
+        std::string buffer;
+        while(m_running)
+        {
+            Request request;
+            if(!readRequest(socket, buffer, request))
+                return;
+            size_t bytesIn = request.body.size();
+            
+            if(lower(request.headers["content-encoding"]) == "gzip" || lower(request.headers["content-encoding"]) == "deflate")
+            {
+                std::string decompressed;
+                if(!Compression::decompress(request.body, decompressed))
+                {
+                    writeResponse(socket, error(400, "bad_request", "invalid compressed request body"), false);
+                    return;
+                }
+                request.body.swap(decompressed);
+            }
+
+            auto start = std::chrono::steady_clock::now();
+
+            int latency = m_latency;
+            if(m_jitter > 0)
+                latency += std::uniform_int_distribution<int>(0, m_jitter)(random);
+            if(latency > 0)
+                std::this_thread::sleep_for(std::chrono::milliseconds(latency));
+
+            std::string endpoint;
+            Response response = dispatch(request, endpoint);
+
+            //CouchDB sends uncompressed responses, only a reverse proxy in front of it compresses them
+            std::string accepted = lower(request.headers["accept-encoding"]);
+            if(m_compressResponses && accepted.find("gzip") != std::string::npos && response.contentType == "application/json" && response.body.size() >= 1024)
+            {
+                std::string compressed;
+                if(Compression::compress(response.body, compressed, Compression::Gzip))
+                {
+                    response.body.swap(compressed);
+                    response.contentEncoding = "gzip";
+                }
+            }
+
+            bool keepAlive = lower(request.headers["connection"]) != "close";
+            bool written = writeResponse(socket, response, keepAlive);
+
+            double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            {
+                std::lock_guard<std::mutex> lk(m_statsmutex);
+                EndpointStats& stats = m_stats[request.method + " " + endpoint];
+                stats.requests++;
+                if(response.status == 409)
+                    stats.conflicts++;
+                stats.totalMs += ms;
+                stats.maxMs = std::max(stats.maxMs, ms);
+                stats.bytesIn += bytesIn;
+                stats.bytesOut += response.body.size();
+            }
+
+            if(!written || !keepAlive)
+                return;
+        }
+    }
+
+    bool CouchDBStub::readRequest(int socket, std::string& buffer, Request& request)
+    {
+        char chunk[64*1024];
+        auto receive = [&]() {
+            ssize_t received = ::recv(socket, chunk, sizeof(chunk), 0);
+            if(received <= 0)
+                return false;
+            buffer.append(chunk, received);
+            return true;
+        };
+
+        size_t headerEnd;
+        while((headerEnd = buffer.find("\r\n\r\n")) == std::string::npos)
+        {
+            if(!receive())
+                return false;
+        }
+
+        std::stringstream head(buffer.substr(0, headerEnd));
+        buffer.erase(0, headerEnd+4);
+
+        std::string line;
+        std::getline(head, line);
+        std::string target;
+        std::stringstream(line) >> request.method >> target;
+        while(std::getline(head, line))
+        {
+            size_t colon = line.find(':');
+            if(colon != std::string::npos)
+                request.headers[lower(trim(line.substr(0, colon)))] = trim(line.substr(colon+1));
+        }
+
+        if(lower(request.headers["expect"]) == "100-continue")
+        {
+            const std::string resume = "HTTP/1.1 100 Continue\r\n\r\n";
+            ::send(socket, resume.data(), resume.size(), MSG_NOSIGNAL);
+        }
+
+        if(lower(request.headers["transfer-encoding"]) == "chunked")
+        {
+            while(true)
+            {
+                size_t lineEnd;
+                while((lineEnd = buffer.find("\r\n")) == std::string::npos)
+                {
+                    if(!receive())
+                        return false;
+                }
+                size_t size = std::strtoul(buffer.substr(0, lineEnd).c_str(), nullptr, 16);
+                buffer.erase(0, lineEnd+2);
+
+                while(buffer.size() < size+2)
+                {
+                    if(!receive())
+                        return false;
+                }
+                request.body.append(buffer, 0, size);
+                buffer.erase(0, size+2);
+
+                if(size == 0)
+                    break;
+            }
+        }
+        else if(request.headers.count("content-length"))
+        {
+            size_t size = std::strtoul(request.headers["content-length"].c_str(), nullptr, 10);
+            while(buffer.size() < size)
+            {
+                if(!receive())
+                    return false;
+            }
+            request.body = buffer.substr(0, size);
+            buffer.erase(0, size);
+        }
+
+        size_t queryStart = target.find('?');
+        std::string path = target.substr(0, queryStart);
+        //clients may send absolute URLs
+        size_t scheme = path.find("://");
+        if(scheme != std::string::npos)
+            path = path.substr(std::min(path.size(), path.find('/', scheme+3)));
+
+        std::stringstream segments(path);
+        std::string segment;
+        while(std::getline(segments, segment, '/'))
+        {
+            if(!segment.empty())
+                request.path.push_back(urlDecode(segment));
+        }
+
+        if(queryStart != std::string::npos)
+        {
+            std::stringstream parameters(target.substr(queryStart+1));
+            std::string parameter;
+            while(std::getline(parameters, parameter, '&'))
+            {
+                size_t equals = parameter.find('=');
+                if(equals == std::string::npos)
+                    request.query[urlDecode(parameter)] = "";
+                else
+                    request.query[urlDecode(parameter.substr(0, equals))] = urlDecode(parameter.substr(equals+1));
+            }
+        }
+
+        return true;
+    }
+
+    bool CouchDBStub::writeResponse(int socket, const Response& response, bool keepAlive)
+    {
+        const std::string head = "HTTP/1.1 " + std::to_string(response.status) + " " + statusText(response.status) + "\r\n"
+                           "Server: CouchDB (Postr stub)\r\n"
+                           "Content-Type: " + response.contentType + "\r\n"
+                           "Content-Length: " + std::to_string(response.body.size()) + "\r\n"
+                           + (response.contentEncoding.empty() ? "" : "Content-Encoding: " + response.contentEncoding + "\r\n") +
+                           "Connection: " + (keepAlive?"keep-alive":"close") + "\r\n"
+                           "\r\n";
+
+        for(const std::string* part : {&head, &response.body})
+        {
+            size_t sent = 0;
+            while(sent < part->size())
+            {
+                ssize_t n = ::send(socket, part->data()+sent, part->size()-sent, MSG_NOSIGNAL);
+                if(n <= 0)
+                    return false;
+                sent += n;
+            }
+        }
+        return true;
+    }
+
+    CouchDBStub::Response CouchDBStub::dispatch(const Request& request, std::string& endpoint)
+    {
+        const std::vector<std::string>& path = request.path;
+        if(path.empty())
+        {
+            endpoint = "/";
+            MetaData welcome;
+            welcome["couchdb"] = "Welcome";
+            welcome["version"] = "stub";
+            return json(200, welcome);
+        }
+
+        std::lock_guard<std::mutex> lk(m_dbmutex);
+        Database& db = m_databases[path[0]];
+
+        if(path.size() == 1)
+        {
+            endpoint = "/{db}";
+            if(request.method == "GET" || request.method == "HEAD")
+            {
+                MetaData info;
+                info["db_name"] = path[0];
+                info["doc_count"] = (Json::UInt64)db.docs.size();
+                info["update_seq"] = (Json::Int64)db.seq;
+                return json(200, info);
+            }
+            if(request.method == "PUT")
+            {
+                MetaData ok;
+                ok["ok"] = true;
+                return json(201, ok);
+            }
+            if(request.method == "POST")
+            {
+                MetaData body;
+                if(!parse(request.body, body) || !body.isObject())
+                    return error(400, "bad_request", "invalid UTF-8 JSON");
+                body.removeMember("_rev");
+                int status;
+                MetaData result = storeDocument(db, body, status);
+                return json(status, result);
+            }
+            return error(405, "method_not_allowed", "Only GET,HEAD,POST,PUT allowed");
+        }
+
+        if(path.size() == 2 && path[1][0] == '_')
+        {
+            endpoint = "/{db}/" + path[1];
+            if(path[1] == "_all_docs")
+                return allDocs(db, request);
+            if(path[1] == "_find" && request.method == "POST")
+                return find(db, request);
+            if(path[1] == "_index" && request.method == "POST")
+                return createIndex(db, request);
+            if(path[1] == "_explain" && request.method == "POST")
+                return explain(db, request);
+            if(path[1] == "_bulk_docs" && request.method == "POST")
+                return bulkDocs(db, request);
+            if(path[1] == "_changes")
+                return changes(db, request);
+            return error(405, "method_not_allowed", "Method not allowed for " + path[1]);
+        }
+
+        //design documents have a slash in their ID
+        std::string id = path[1];
+        size_t next = 2;
+        if(id == "_design" && path.size() > 2)
+        {
+            id += "/" + path[2];
+            next = 3;
+        }
+
+        if(path.size() == next)
+        {
+            endpoint = "/{db}/{docid}";
+            if(request.method == "GET" || request.method == "HEAD")
+                return getDocument(db, id, request);
+            if(request.method == "PUT")
+            {
+                MetaData body;
+                if(!parse(request.body, body) || !body.isObject())
+                    return error(400, "bad_request", "invalid UTF-8 JSON");
+                body["_id"] = id;
+                if(request.query.count("rev"))
+                    body["_rev"] = request.query.at("rev");
+                int status;
+                MetaData result = storeDocument(db, body, status);
+                return json(status, result);
+            }
+            if(request.method == "DELETE")
+            {
+                MetaData body;
+                body["_id"] = id;
+                body["_deleted"] = true;
+                if(request.query.count("rev"))
+                    body["_rev"] = request.query.at("rev");
+                int status;
+                MetaData result = storeDocument(db, body, status);
+                return json(status == 201 ? 200 : status, result);
+            }
+            return error(405, "method_not_allowed", "Only DELETE,GET,HEAD,PUT allowed");
+        }
+
+        if(path.size() == next+1)
+        {
+            endpoint = "/{db}/{docid}/{attname}";
+            if(request.method == "GET" || request.method == "HEAD")
+                return getAttachment(db, id, path[next], request);
+            if(request.method == "PUT")
+                return putAttachment(db, id, path[next], request);
+            return error(405, "method_not_allowed", "Only GET,HEAD,PUT allowed");
+        }
+
+        endpoint = "unknown";
+        return error(404, "not_found", "missing");
+    }
+
+    CouchDBStub::Response CouchDBStub::allDocs(Database& db, const Request& request)
+    {
+        bool includeDocs = request.query.count("include_docs") && request.query.at("include_docs") == "true";
+
+        MetaData keys;
+        if(request.method == "POST")
+        {
+            MetaData body;
+            if(!parse(request.body, body))
+                return error(400, "bad_request", "invalid UTF-8 JSON");
+            keys = body["keys"];
+            if(body.isMember("include_docs"))
+                includeDocs = body["include_docs"].asBool();
+        }
+
+        MetaData result;
+        result["total_rows"] = (Json::UInt64)db.docs.size();
+        result["offset"] = 0;
+        result["rows"] = MetaData(Json::arrayValue);
+
+        auto row = [&](const std::string& id, const Document& doc) {
+            MetaData entry;
+            entry["id"] = id;
+            entry["key"] = id;
+            entry["value"]["rev"] = doc.rev;
+            if(includeDocs)
+                entry["doc"] = documentJson(id, doc, false);
+            return entry;
+        };
+
+        if(keys.isArray())
+        {
+            for(const MetaData& key : keys)
+            {
+                auto doc = db.docs.find(key.asString());
+                if(doc == db.docs.end())
+                {
+                    MetaData missing;
+                    missing["key"] = key;
+                    missing["error"] = "not_found";
+                    result["rows"].append(missing);
+                }
+                else
+                    result["rows"].append(row(doc->first, doc->second));
+            }
+        }
+        else
+        {
+            int limit = request.query.count("limit") ? std::atoi(request.query.at("limit").c_str()) : -1;
+            for(const auto& doc : db.docs)
+            {
+                if(limit >= 0 && (int)result["rows"].size() >= limit)
+                    break;
+                result["rows"].append(row(doc.first, doc.second));
+            }
+        }
+
+        return json(200, result);
+    }
+
+    CouchDBStub::Response CouchDBStub::find(Database& db, const Request& request)
+    {
+        MetaData query;
+        if(!parse(request.body, query) || !query["selector"].isObject())
+            return error(400, "bad_request", "invalid selector");
+
+        int limit = query.isMember("limit") ? query["limit"].asInt() : 25;
+        const MetaData& fields = query["fields"];
+
+        MetaData result;
+        result["docs"] = MetaData(Json::arrayValue);
+        for(const auto& doc : db.docs)
+        {
+            if((int)result["docs"].size() >= limit)
+                break;
+
+            MetaData full = documentJson(doc.first, doc.second, false);
+            if(!matches(full, query["selector"]))
+                continue;
+
+            if(fields.isArray() && fields.size())
+            {
+                MetaData projected(Json::objectValue);
+                for(const MetaData& field : fields)
+                {
+                    const MetaData* value = resolve(full, field.asString());
+                    if(value)
+                        projected[field.asString()] = *value;
+                }
+                result["docs"].append(projected);
+            }
+            else
+                result["docs"].append(full);
+        }
+
+        if(!selectIndex(db, query))
+            result["warning"] = "No matching index found, create an index to optimize query time.";
+
+        return json(200, result);
+    }
+
+    CouchDBStub::Response CouchDBStub::createIndex(Database& db, const Request& request)
+    {
+        MetaData body;
+        if(!parse(request.body, body) || !body["index"]["fields"].isArray())
+            return error(400, "bad_request", "index requires fields");
+
+        Index index;
+        index.ddoc = body.isMember("ddoc") ? body["ddoc"].asString() : Util::uuid();
+        index.name = body.isMember("name") ? body["name"].asString() : Util::uuid();
+        index.fields = body["index"]["fields"];
+
+        MetaData result;
+        result["id"] = "_design/" + index.ddoc;
+        result["name"] = index.name;
+        result["result"] = "exists";
+
+        auto existing = std::find_if(db.indexes.begin(), db.indexes.end(), [&index](const Index& other){
+            return other.ddoc == index.ddoc && other.name == index.name;
+        });
+        if(existing == db.indexes.end())
+        {
+            db.indexes.push_back(index);
+            result["result"] = "created";
+        }
+        return json(200, result);
+    }
+
+    CouchDBStub::Response CouchDBStub::explain(Database& db, const Request& request)
+    {
+        MetaData query;
+        if(!parse(request.body, query))
+            return error(400, "bad_request", "invalid UTF-8 JSON");
+
+        MetaData result;
+        result["dbname"] = request.path[0];
+        result["selector"] = query["selector"];
+        result["limit"] = query.isMember("limit") ? query["limit"].asInt() : 25;
+
+        const Index* index = selectIndex(db, query);
+        if(index)
+        {
+            result["index"]["ddoc"] = "_design/" + index->ddoc;
+            result["index"]["name"] = index->name;
+            result["index"]["type"] = "json";
+            result["index"]["def"]["fields"] = index->fields;
+        }
+        else
+        {
+            result["index"]["ddoc"] = MetaData();
+            result["index"]["name"] = "_all_docs";
+            result["index"]["type"] = "special";
+        }
+        return json(200, result);
+    }
+
+    CouchDBStub::Response CouchDBStub::bulkDocs(Database& db, const Request& request)
+    {
+        MetaData body;
+        if(!parse(request.body, body) || !body["docs"].isArray())
+            return error(400, "bad_request", "POST body must include `docs` parameter.");
+
+        MetaData result(Json::arrayValue);
+        for(const MetaData& doc : body["docs"])
+        {
+            int status;
+            result.append(storeDocument(db, doc, status));
+        }
+        return json(201, result);
+    }
+
+    CouchDBStub::Response CouchDBStub::changes(Database& db, const Request& request)
+    {
+        long since = request.query.count("since") ? std::atol(request.query.at("since").c_str()) : 0;
+        int limit = request.query.count("limit") ? std::atoi(request.query.at("limit").c_str()) : -1;
+        bool includeDocs = request.query.count("include_docs") && request.query.at("include_docs") == "true";
+
+        std::vector<std::pair<long, std::string>> changed;
+        for(const auto& doc : db.docs)
+        {
+            if(doc.second.seq > since)
+                changed.push_back(std::make_pair(doc.second.seq, doc.first));
+        }
+        std::sort(changed.begin(), changed.end());
+        if(limit >= 0 && (int)changed.size() > limit)
+            changed.resize(limit);
+
+        MetaData result;
+        result["results"] = MetaData(Json::arrayValue);
+        long lastSeq = since;
+        for(const auto& change : changed)
+        {
+            const Document& doc = db.docs[change.second];
+            MetaData entry;
+            entry["seq"] = (Json::Int64)change.first;
+            entry["id"] = change.second;
+            MetaData rev;
+            rev["rev"] = doc.rev;
+            entry["changes"].append(rev);
+            if(includeDocs)
+                entry["doc"] = documentJson(change.second, doc, false);
+            result["results"].append(entry);
+            lastSeq = change.first;
+        }
+        result["last_seq"] = (Json::Int64)(changed.empty() ? db.seq : lastSeq);
+        result["pending"] = (Json::Int64)(db.seq - lastSeq);
+        return json(200, result);
+    }
+
+    CouchDBStub::Response CouchDBStub::getDocument(Database& db, const std::string& id, const Request& request)
+    {
+        auto doc = db.docs.find(id);
+        if(doc == db.docs.end())
+            return error(404, "not_found", "missing");
+
+        //only the latest revision is stored
+        if(request.query.count("rev") && request.query.at("rev") != doc->second.rev)
+            return error(404, "not_found", "missing");
+
+        bool withAttachments = request.query.count("attachments") && request.query.at("attachments") == "true";
+        return json(200, documentJson(id, doc->second, withAttachments));
+    }
+
+    CouchDBStub::Response CouchDBStub::getAttachment(Database& db, const std::string& id, const std::string& name, const Request& request)
+    {
+        auto doc = db.docs.find(id);
+        if(doc == db.docs.end())
+            return error(404, "not_found", "Document is missing attachment");
+        if(request.query.count("rev") && request.query.at("rev") != doc->second.rev)
+            return error(404, "not_found", "missing");
+
+        auto attachment = doc->second.attachments.find(name);
+        if(attachment == doc->second.attachments.end())
+            return error(404, "not_found", "Document is missing attachment");
+
+        Response response;
+        response.contentType = attachment->second.contentType;
+        response.body.assign(attachment->second.data.begin(), attachment->second.data.end());
+        return response;
+    }
+
+    CouchDBStub::Response CouchDBStub::putAttachment(Database& db, const std::string& id, const std::string& name, const Request& request)
+    {
+        std::string rev = request.query.count("rev") ? request.query.at("rev") : "";
+        auto doc = db.docs.find(id);
+        if(doc == db.docs.end())
+        {
+            if(!rev.empty())
+                return error(409, "conflict", "Document update conflict.");
+            doc = db.docs.insert(std::make_pair(id, Document())).first;
+            doc->second.body["_id"] = id;
+        }
+        else if(rev != doc->second.rev || injectConflict())
+            return error(409, "conflict", "Document update conflict.");
+
+        Attachment& attachment = doc->second.attachments[name];
+        attachment.contentType = request.headers.count("content-type") ? request.headers.at("content-type") : "application/octet-stream";
+        attachment.data.assign(request.body.begin(), request.body.end());
+        attachment.revpos = doc->second.revision+1;
+        newRevision(db, doc->second);
+
+        MetaData result;
+        result["ok"] = true;
+        result["id"] = id;
+        result["rev"] = doc->second.rev;
+        return json(201, result);
+    }
+
+    MetaData CouchDBStub::storeDocument(Database& db, MetaData body, int& status)
+    {
+        std::string id = body["_id"].asString();
+        if(id.empty())
+            id = Util::uuid();
+        std::string rev = body["_rev"].asString();
+
+        MetaData result;
+        result["id"] = id;
+
+        auto existing = db.docs.find(id);
+        bool conflict = (existing == db.docs.end()) ? !rev.empty() : (rev != existing->second.rev || injectConflict());
+        if(conflict)
+        {
+            status = 409;
+            result["error"] = "conflict";
+            result["reason"] = "Document update conflict.";
+            return result;
+        }
+
+        if(body.isMember("_deleted") && body["_deleted"].asBool())
+        {
+            if(existing != db.docs.end())
+                db.docs.erase(existing);
+            ++db.seq;
+            status = 201;
+            result["ok"] = true;
+            result["rev"] = rev;
+            return result;
+        }
+
+        Document& doc = db.docs[id];
+
+        //attachment stubs keep the stored attachment, inline attachments replace it, missing ones are deleted
+        std::map<std::string, Attachment> attachments;
+        const MetaData& inlined = body["_attachments"];
+        for(const std::string& name : inlined.getMemberNames())
+        {
+            const MetaData& entry = inlined[name];
+            if(entry.isMember("data"))
+            {
+                std::string data = base64_decode(entry["data"].asString());
+                Attachment& attachment = attachments[name];
+                attachment.contentType = entry["content_type"].asString();
+                attachment.data.assign(data.begin(), data.end());
+                attachment.revpos = doc.revision+1;
+            }
+            else if(doc.attachments.count(name))
+                attachments[name] = doc.attachments[name];
+        }
+        doc.attachments.swap(attachments);
+
+        body.removeMember("_attachments");
+        body.removeMember("_rev");
+        body["_id"] = id;
+        doc.body = body;
+        newRevision(db, doc);
+
+        status = 201;
+        result["ok"] = true;
+        result["rev"] = doc.rev;
+        return result;
+    }
+
+    MetaData CouchDBStub::documentJson(const std::string& id, const Document& doc, bool withAttachments) const
+    {
+        MetaData json = doc.body;
+        json["_id"] = id;
+        json["_rev"] = doc.rev;
+        for(const auto& attachment : doc.attachments)
+        {
+            MetaData& entry = json["_attachments"][attachment.first];
+            entry["content_type"] = attachment.second.contentType;
+            entry["revpos"] = attachment.second.revpos;
+            entry["length"] = (Json::UInt64)attachment.second.data.size();
+            if(withAttachments)
+                entry["data"] = base64_encode(attachment.second.data.data(), attachment.second.data.size());
+            else
+                entry["stub"] = true;
+        }
+        return json;
+    }
+
+    const CouchDBStub::Index* CouchDBStub::selectIndex(const Database& db, const MetaData& query) const
+    {
+        const MetaData& useIndex = query["use_index"];
+        if(useIndex.isArray() && useIndex.size() == 2)
+        {
+            for(const Index& index : db.indexes)
+            {
+                if(index.ddoc == useIndex[0].asString() && index.name == useIndex[1].asString())
+                    return &index;
+            }
+            return nullptr;
+        }
+
+        //without a hint, use the first index whose leading field appears in the selector
+        for(const Index& index : db.indexes)
+        {
+            if(index.fields.size() && query["selector"].isMember(index.fields[0].asString()))
+                return &index;
+        }
+        return nullptr;
+    }
+
+    void CouchDBStub::newRevision(Database& db, Document& doc)
+    {
+        std::stringstream rev;
+        rev << ++doc.revision << "-" << std::hex << m_random() << m_random();
+        doc.rev = rev.str();
+        doc.seq = ++db.seq;
+    }
+
+    bool CouchDBStub::injectConflict()
+    {
+        if(m_conflictRate <= 0)
+            return false;
+        return std::uniform_real_distribution<double>(0, 1)(m_random) < m_conflictRate;
+    }
+
+    bool CouchDBStub::matches(const MetaData& doc, const MetaData& selector)
+    {
+        if(!selector.isObject())
+            return false;
+
+        for(const std::string& key : selector.getMemberNames())
+        {
+            const MetaData& argument = selector[key];
+            if(key == "$and")
+            {
+                for(const MetaData& sub : argument)
+                    if(!matches(doc, sub))
+                        return false;
+            }
+            else if(key == "$or")
+            {
+                bool any = false;
+                for(const MetaData& sub : argument)
+                    any = any || matches(doc, sub);
+                if(!any)
+                    return false;
+            }
+            else if(key == "$nor")
+            {
+                for(const MetaData& sub : argument)
+                    if(matches(doc, sub))
+                        return false;
+            }
+            else if(key == "$not")
+            {
+                if(matches(doc, argument))
+                    return false;
+            }
+            else
+            {
+                const MetaData* value = resolve(doc, key);
+                if(!matchesCondition(value ? *value : MetaData(), value != nullptr, argument))
+                    return false;
+            }
+        }
+        return true;
+    }
+
+    bool CouchDBStub::matchesCondition(const MetaData& value, bool exists, const MetaData& condition)
+    {
+        bool isOperator = condition.isObject() && condition.size() && condition.getMemberNames()[0][0] == '$';
+        if(!isOperator)
+            return exists && value == condition;
+
+        for(const std::string& op : condition.getMemberNames())
+        {
+            const MetaData& argument = condition[op];
+            bool result;
+            if(op == "$and")
+            {
+                result = true;
+                for(const MetaData& sub : argument)
+                    result = result && matchesCondition(value, exists, sub);
+            }
+            else if(op == "$or")
+            {
+                result = false;
+                for(const MetaData& sub : argument)
+                    result = result || matchesCondition(value, exists, sub);
+            }
+            else if(op == "$not")
+                result = !matchesCondition(value, exists, argument);
+            else if(op == "$exists")
+                result = (exists == argument.asBool());
+            else if(op == "$eq")
+                result = exists && compare(value, argument) == 0 && sameType(value, argument);
+            else if(op == "$ne")
+                result = exists && !(compare(value, argument) == 0 && sameType(value, argument));
+            else if(op == "$lt")
+                result = exists && sameType(value, argument) && compare(value, argument) < 0;
+            else if(op == "$lte")
+                result = exists && sameType(value, argument) && compare(value, argument) <= 0;
+            else if(op == "$gt")
+                result = exists && sameType(value, argument) && compare(value, argument) > 0;
+            else if(op == "$gte")
+                result = exists && sameType(value, argument) && compare(value, argument) >= 0;
+            else if(op == "$in" || op == "$nin")
+            {
+                bool found = false;
+                for(const MetaData& candidate : argument)
+                    found = found || (exists && sameType(value, candidate) && compare(value, candidate) == 0);
+                result = exists && ((op == "$in") == found);
+            }
+            else
+            {
+                LOG(WARNING) << "unsupported selector operator " << op;
+                result = false;
+            }
+
+            if(!result)
+                return false;
+        }
+        return true;
+    }
+
+    CouchDBStub::Response CouchDBStub::json(int status, const MetaData& body)
+    {
+        Response response;
+        response.status = status;
+        response.body = serialize(body);
+        return response;
+    }
+
+    CouchDBStub::Response CouchDBStub::error(int status, const std::string& error, const std::string& reason)
+    {
+        MetaData body;
+        body["error"] = error;
+        body["reason"] = reason;
+        return json(status, body);
+    }
+}
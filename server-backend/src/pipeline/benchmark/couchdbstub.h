@@ -0,0 +1,233 @@
+/**
+ * This file is part of Poster Safari.
+ *
+ *  Poster Safari is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Poster Safari is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with Poster Safari.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ *  Copyright 2017 Moritz Dannehl, Rebecca Lühmann, Nicolas Marin, Michael Nieß, Julian Wolff
+ *
+ */
+
+#ifndef COUCHDB_STUB_H
+#define COUCHDB_STUB_H
+
+#include "metadata.h"
+
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <random>
+#include <condition_variable>
+
+namespace Postr
+{
+    /**
+     * @brief Minimal in-memory stand-in for a CouchDB server.
+     * Implements the subset of the CouchDB HTTP API used by the CouchDB class
+     * (_find, _all_docs, _index, _explain, _bulk_docs, _changes, documents and attachments)
+     * to measure the throughput of the database client without a real database.
+     * Latency and update conflicts can be injected to simulate a remote or busy database.
+     */
+    class CouchDBStub
+    {
+    public:
+        /**
+         * @brief Request statistics of a single endpoint
+         */
+        struct EndpointStats
+        {
+            int requests = 0;
+            int conflicts = 0;
+            double totalMs = 0;
+            double maxMs = 0;
+            size_t bytesIn = 0;
+            size_t bytesOut = 0;
+        };
+
+        /**
+         * @brief Create a server. The server does not accept connections before start() is called.
+         * @param threads Number of connections handled concurrently
+         */
+        explicit CouchDBStub(int threads = 16);
+        ~CouchDBStub();
+
+        /**
+         * @brief Listen on the loopback interface
+         * @param port Port to listen on. A free port is chosen if the port is 0.
+         * @return the port the server listens on or -1 on error
+         */
+        int start(int port = 0);
+
+        /**
+         * @brief Close all connections and stop the server
+         */
+        void stop();
+
+        /**
+         * @brief Port the server listens on or -1 if the server is not running
+         */
+        int port() const;
+
+        /**
+         * @brief Delay every response
+         * @param ms Time in milliseconds added to every request
+         * @param jitter Maximum random time in milliseconds added on top of ms
+         */
+        void setLatency(int ms, int jitter = 0);
+
+        /**
+         * @brief Let updates of existing documents fail with a conflict
+         * @param rate Probability in range [0,1] of an update failing
+         */
+        void setConflictRate(double rate);
+
+        /**
+         * @brief Gzip JSON responses to clients accepting them.
+         * CouchDB itself never compresses responses, this simulates a compressing reverse proxy in front of it. Disabled by default.
+         */
+        void setResponseCompression(bool enabled);
+
+        /**
+         * @brief Add a poster document with an image attachment named userimage
+         * @param image The encoded image
+         * @param contentType MIME type of the image
+         * @param db Database to add the document to
+         * @return the ID of the new document
+         */
+        std::string addPoster(const std::vector<unsigned char>& image, const std::string& contentType = "image/jpeg", const std::string& db = "poster");
+
+        /**
+         * @brief Number of documents in a database matching a Mango selector
+         */
+        int countDocuments(const std::string& db, const MetaData& selector) const;
+
+        /**
+         * @brief Request statistics per endpoint since the server started or resetStatistics() has been called
+         */
+        std::map<std::string, EndpointStats> statistics() const;
+
+        void resetStatistics();
+
+        /**
+         * @brief Check whether a document matches a Mango selector
+         * Supports $and, $or, $nor, $not, $exists, $eq, $ne, $lt, $lte, $gt, $gte, $in and $nin.
+         */
+        static bool matches(const MetaData& doc, const MetaData& selector);
+
+    private:
+        struct Attachment
+        {
+            std::string contentType;
+            std::vector<unsigned char> data;
+            int revpos = 1;
+        };
+
+        struct Document
+        {
+            MetaData body;
+            int revision = 0;
+            std::string rev;
+            long seq = 0;
+            std::map<std::string, Attachment> attachments;
+        };
+
+        struct Index
+        {
+            std::string ddoc;
+            std::string name;
+            MetaData fields;
+        };
+
+        struct Database
+        {
+            std::map<std::string, Document> docs;
+            std::vector<Index> indexes;
+            long seq = 0;
+        };
+
+        struct Request
+        {
+            std::string method;
+            std::vector<std::string> path;
+            std::map<std::string, std::string> query;
+            std::map<std::string, std::string> headers;
+            std::string body;
+        };
+
+        struct Response
+        {
+            int status = 200;
+            std::string contentType = "application/json";
+            std::string contentEncoding;
+            std::string body;
+        };
+
+        void listen();
+        void work();
+        void handleConnection(int socket);
+        bool readRequest(int socket, std::string& buffer, Request& request);
+        bool writeResponse(int socket, const Response& response, bool keepAlive);
+
+        Response dispatch(const Request& request, std::string& endpoint);
+        Response allDocs(Database& db, const Request& request);
+        Response find(Database& db, const Request& request);
+        Response createIndex(Database& db, const Request& request);
+        Response explain(Database& db, const Request& request);
+        Response bulkDocs(Database& db, const Request& request);
+        Response changes(Database& db, const Request& request);
+        Response getDocument(Database& db, const std::string& id, const Request& request);
+        Response getAttachment(Database& db, const std::string& id, const std::string& name, const Request& request);
+        Response putAttachment(Database& db, const std::string& id, const std::string& name, const Request& request);
+
+        MetaData storeDocument(Database& db, MetaData body, int& status);
+        MetaData documentJson(const std::string& id, const Document& doc, bool withAttachments) const;
+        const Index* selectIndex(const Database& db, const MetaData& query) const;
+        void newRevision(Database& db, Document& doc);
+        bool injectConflict();
+
+        static bool matchesCondition(const MetaData& value, bool exists, const MetaData& condition);
+        static Response json(int status, const MetaData& body);
+        static Response error(int status, const std::string& error, const std::string& reason);
+
+        std::map<std::string, Database> m_databases;
+        mutable std::mutex m_dbmutex;
+
+        std::map<std::string, EndpointStats> m_stats;
+        mutable std::mutex m_statsmutex;
+
+        std::atomic_int m_latency;
+        std::atomic_int m_jitter;
+        double m_conflictRate;
+        std::atomic_bool m_compressResponses;
+        std::mt19937 m_random;
+
+        int m_threadCount;
+        int m_socket;
+        int m_port;
+        std::atomic_bool m_running;
+        std::thread m_listenthread;
+        std::vector<std::thread> m_workers;
+        std::deque<int> m_connections;
+        std::set<int> m_open;
+        std::mutex m_connectionmutex;
+        std::condition_variable m_connectioncondition;
+    };
+}
+
+#endif //COUCHDB_STUB_H
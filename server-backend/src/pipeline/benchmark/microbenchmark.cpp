@@ -0,0 +1,288 @@
+/**
+ * This file is part of Poster Safari.
+ *
+ *  Poster Safari is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Poster Safari is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with Poster Safari.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ * 
+ *  Copyright 2017 Moritz Dannehl, Rebecca Lühmann, Nicolas Marin, Michael Nieß, Julian Wolff
+ * 
+ */
+
+#include "microbenchmark.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <regex>
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <algorithm>
+#include <sstream>
+
+#include <json/json.h>
+
+namespace
+{
+    std::atomic<uint64_t> allocationCount(0);
+    std::atomic<uint64_t> allocationBytes(0);
+    
+    struct Entry
+    {
+        std::string name;
+        Postr::Benchmark::Function function;
+    };
+    
+    std::vector<Entry>& registry()
+    {
+        static std::vector<Entry> entries;
+        return entries;
+    }
+}
+
+//count every allocation made by operator new, including those of the workers' threads
+void* operator new(std::size_t size)
+{
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+    allocationBytes.fetch_add(size, std::memory_order_relaxed);
+    if(void* p = std::malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size)
+{
+    return ::operator new(size);
+}
+
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+void operator delete[](void* p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+namespace Postr
+{
+    namespace Benchmark
+    {
+        uint64_t allocations()
+        {
+            return allocationCount.load(std::memory_order_relaxed);
+        }
+        
+        uint64_t allocatedBytes()
+        {
+            return allocationBytes.load(std::memory_order_relaxed);
+        }
+        
+        State::State(size_t iterations)
+            : m_iterations(iterations)
+            , m_remaining(iterations)
+            , m_started(false)
+            , m_paused(false)
+            , m_seconds(0)
+            , m_allocationsBegin(0)
+            , m_allocatedBytesBegin(0)
+            , m_allocations(0)
+            , m_allocatedBytes(0)
+            , m_items(0)
+            , m_bytes(0)
+        {
+        }
+        
+        bool State::running()
+        {
+            if(skipped())
+                return false;
+            if(!m_started)
+            {
+                m_started = true;
+                start();
+            }
+            if(m_remaining == 0)
+            {
+                stop();
+                return false;
+            }
+            --m_remaining;
+            return true;
+        }
+        
+        void State::start()
+        {
+            m_allocationsBegin = allocations();
+            m_allocatedBytesBegin = allocatedBytes();
+            m_begin = std::chrono::steady_clock::now();
+        }
+        
+        void State::stop()
+        {
+            m_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - m_begin).count();
+            m_allocations += allocations() - m_allocationsBegin;
+            m_allocatedBytes += allocatedBytes() - m_allocatedBytesBegin;
+        }
+        
+        void State::pauseTiming()
+        {
+            if(!m_paused)
+                stop();
+            m_paused = true;
+        }
+        
+        void State::resumeTiming()
+        {
+            if(m_paused)
+                start();
+            m_paused = false;
+        }
+        
+        void State::setItemsProcessed(size_t items)
+        {
+            m_items = items;
+        }
+        
+        void State::setBytesProcessed(size_t bytes)
+        {
+            m_bytes = bytes;
+        }
+        
+        void State::skip(const std::string& reason)
+        {
+            m_skipReason = reason.empty() ? "skipped" : reason;
+        }
+        
+        bool add(const std::string& name, Function function)
+        {
+            registry().push_back({name, function});
+            return true;
+        }
+        
+        static std::string humanReadable(double value, const char* unit)
+        {
+            const char* prefixes[] = {"", "k", "M", "G"};
+            int i = 0;
+            while(value >= 1000 && i < 3)
+            {
+                value /= 1000;
+                ++i;
+            }
+            std::ostringstream ss;
+            ss << std::fixed << std::setprecision(value < 10 ? 2 : 1) << value << prefixes[i] << unit;
+            return ss.str();
+        }
+        
+        static std::string duration(double seconds)
+        {
+            const char* units[] = {"s", "ms", "us", "ns"};
+            int i = 0;
+            while(seconds < 1 && i < 3)
+            {
+                seconds *= 1000;
+                ++i;
+            }
+            std::ostringstream ss;
+            ss << std::fixed << std::setprecision(seconds < 10 ? 2 : 1) << seconds << units[i];
+            return ss.str();
+        }
+        
+        int run(const std::string& filter, double minSeconds, const std::string& jsonFile)
+        {
+            std::regex pattern(filter);
+            Json::Value results(Json::arrayValue);
+            int count = 0;
+            
+            std::cout << std::left << std::setw(36) << "benchmark" << std::right
+                      << std::setw(12) << "iterations" << std::setw(14) << "time/iter"
+                      << std::setw(14) << "allocs/iter" << std::setw(14) << "bytes/iter"
+                      << std::setw(16) << "throughput" << std::endl;
+            
+            for(const Entry& entry : registry())
+            {
+                if(!std::regex_search(entry.name, pattern))
+                    continue;
+                ++count;
+                
+                //increase the number of iterations until the measured code runs long enough
+                size_t iterations = 1;
+                State state(iterations);
+                while(true)
+                {
+                    state = State(iterations);
+                    entry.function(state);
+                    if(state.skipped() || state.seconds() >= minSeconds || iterations >= 1000000000)
+                        break;
+                    double factor = (state.seconds() > 0) ? 1.4*minSeconds/state.seconds() : 10;
+                    iterations = std::max(iterations+1, (size_t)(iterations*std::min(10., std::max(2., factor))));
+                }
+                
+                std::cout << std::left << std::setw(36) << entry.name << std::right;
+                if(state.skipped())
+                {
+                    std::cout << "  skipped: " << state.skipReason() << std::endl;
+                    continue;
+                }
+                
+                double n = state.iterations();
+                double perIteration = state.seconds()/n;
+                std::string throughput;
+                if(state.bytes() > 0)
+                    throughput = humanReadable(state.bytes()*n/state.seconds(), "B/s");
+                else if(state.items() > 0)
+                    throughput = humanReadable(state.items()*n/state.seconds(), " items/s");
+                
+                std::cout << std::setw(12) << state.iterations()
+                          << std::setw(14) << duration(perIteration)
+                          << std::setw(14) << std::fixed << std::setprecision(1) << state.allocations()/n
+                          << std::setw(14) << humanReadable(state.allocatedBytes()/n, "B")
+                          << std::setw(16) << throughput << std::endl;
+                
+                Json::Value result;
+                result["name"] = entry.name;
+                result["iterations"] = (Json::UInt64)state.iterations();
+                result["secondsPerIteration"] = perIteration;
+                result["allocationsPerIteration"] = state.allocations()/n;
+                result["allocatedBytesPerIteration"] = state.allocatedBytes()/n;
+                if(state.bytes() > 0)
+                    result["bytesPerSecond"] = state.bytes()*n/state.seconds();
+                if(state.items() > 0)
+                    result["itemsPerSecond"] = state.items()*n/state.seconds();
+                results.append(result);
+            }
+            
+            if(!jsonFile.empty())
+            {
+                std::ofstream file(jsonFile);
+                file << results;
+                if(!file)
+                    std::cerr << "could not write " << jsonFile << std::endl;
+            }
+            
+            return count;
+        }
+    }
+}
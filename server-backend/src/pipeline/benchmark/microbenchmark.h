@@ -0,0 +1,143 @@
+/**
+ * This file is part of Poster Safari.
+ *
+ *  Poster Safari is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Poster Safari is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with Poster Safari.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ * 
+ *  Copyright 2017 Moritz Dannehl, Rebecca Lühmann, Nicolas Marin, Michael Nieß, Julian Wolff
+ * 
+ */
+
+#ifndef MICROBENCHMARK_H
+#define MICROBENCHMARK_H
+
+#include <string>
+#include <vector>
+#include <chrono>
+#include <functional>
+#include <cstdint>
+
+/**
+ * @brief Define a benchmark. The body sets up its fixture and then runs the measured code while state.running() is true:
+ * @code
+ * POSTR_BENCHMARK(Base64Encode)
+ * {
+ *     std::vector<unsigned char> input(1 << 20);
+ *     while(state.running())
+ *         base64_encode(input.data(), input.size());
+ *     state.setBytesProcessed(input.size());
+ * }
+ * @endcode
+ */
+#define POSTR_BENCHMARK(NAME) \
+    static void NAME(Postr::Benchmark::State& state); \
+    static const bool NAME##_registered = Postr::Benchmark::add(#NAME, NAME); \
+    static void NAME(Postr::Benchmark::State& state)
+
+namespace Postr
+{
+    namespace Benchmark
+    {
+        /**
+         * @brief Controls a single run of a benchmark and collects its measurements
+         */
+        class State
+        {
+        public:
+            explicit State(size_t iterations);
+            
+            /**
+             * @brief Check whether another iteration should be run. The first call starts the measurement, the last call stops it.
+             */
+            bool running();
+            
+            /**
+             * @brief Exclude the following code from the measurement until resumeTiming() is called, e.g. to copy the input of an iteration
+             */
+            void pauseTiming();
+            void resumeTiming();
+            
+            /**
+             * @brief Set the number of items, e.g. documents or words, processed by a single iteration
+             */
+            void setItemsProcessed(size_t items);
+            
+            /**
+             * @brief Set the number of bytes processed by a single iteration
+             */
+            void setBytesProcessed(size_t bytes);
+            
+            /**
+             * @brief Skip this benchmark, e.g. because data files are missing
+             */
+            void skip(const std::string& reason);
+            
+            size_t iterations() const { return m_iterations; }
+            double seconds() const { return m_seconds; }
+            uint64_t allocations() const { return m_allocations; }
+            uint64_t allocatedBytes() const { return m_allocatedBytes; }
+            size_t items() const { return m_items; }
+            size_t bytes() const { return m_bytes; }
+            bool skipped() const { return !m_skipReason.empty(); }
+            const std::string& skipReason() const { return m_skipReason; }
+            
+        private:
+            void start();
+            void stop();
+            
+            size_t m_iterations;
+            size_t m_remaining;
+            bool m_started;
+            bool m_paused;
+            std::chrono::steady_clock::time_point m_begin;
+            double m_seconds;
+            uint64_t m_allocationsBegin;
+            uint64_t m_allocatedBytesBegin;
+            uint64_t m_allocations;
+            uint64_t m_allocatedBytes;
+            size_t m_items;
+            size_t m_bytes;
+            std::string m_skipReason;
+        };
+        
+        typedef std::function<void(State&)> Function;
+        
+        /**
+         * @brief Register a benchmark. Use POSTR_BENCHMARK instead of calling this directly.
+         * @return true
+         */
+        bool add(const std::string& name, Function function);
+        
+        /**
+         * @brief Run all benchmarks whose name matches a regular expression and print a table of the results
+         * @param filter regular expression matched against the names of the benchmarks
+         * @param minSeconds minimum time the measured code of each benchmark runs for
+         * @param jsonFile file to write the results to as JSON. Nothing is written if empty.
+         * @return the number of benchmarks that have been run
+         */
+        int run(const std::string& filter, double minSeconds, const std::string& jsonFile);
+        
+        /**
+         * @brief Number of heap allocations made by operator new in all threads since the program started
+         */
+        uint64_t allocations();
+        
+        /**
+         * @brief Number of bytes allocated by operator new in all threads since the program started
+         */
+        uint64_t allocatedBytes();
+    }
+}
+
+#endif //MICROBENCHMARK_H
@@ -0,0 +1,353 @@
+/**
+ * This file is part of Poster Safari.
+ *
+ *  Poster Safari is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Poster Safari is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with Poster Safari.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ * 
+ *  Copyright 2017 Moritz Dannehl, Rebecca Lühmann, Nicolas Marin, Michael Nieß, Julian Wolff
+ * 
+ */
+
+#include "pipeline.h"
+#include "metrics.h"
+#include "memorytracker.h"
+#include "tracer.h"
+
+#include <opencv2/imgcodecs.hpp>
+
+#include <sys/resource.h>
+
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <algorithm>
+#include <thread>
+#include <chrono>
+#include <atomic>
+#include <mutex>
+#include <cmath>
+#include <numeric>
+
+#include "argagg.hpp"
+
+#include "util.h"
+
+/**
+ * @brief Counters of a stage at the beginning of the measurement
+ */
+struct StageSnapshot
+{
+    uint64_t documents;
+    uint64_t errors;
+    uint64_t processed;
+    double processing;
+    uint64_t waited;
+    double wait;
+    uint64_t cpu;
+    uint64_t blocked;
+    uint64_t switches;
+    
+    explicit StageSnapshot(const Postr::StageMetrics& stage)
+        : documents(stage.documents)
+        , errors(stage.errors)
+        , processed(stage.processing.count())
+        , processing(stage.processing.sum())
+        , waited(stage.queueWait.count())
+        , wait(stage.queueWait.sum())
+        , cpu(stage.cpuMicroseconds)
+        , blocked(stage.blockedMicroseconds)
+        , switches(stage.voluntarySwitches + stage.involuntarySwitches)
+    {
+    }
+};
+
+static double cpuSeconds(int who)
+{
+    rusage usage;
+    getrusage(who, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec)/1e6;
+}
+
+static long peakResidentKiB(int who)
+{
+    rusage usage;
+    getrusage(who, &usage);
+    return usage.ru_maxrss;
+}
+
+static double percentile(const std::vector<double>& sorted, double p)
+{
+    if(sorted.empty())
+        return 0;
+    size_t index = std::ceil(p*sorted.size());
+    return sorted[std::min(sorted.size(), std::max<size_t>(index, 1)) - 1];
+}
+
+static bool isImage(const std::string& file)
+{
+    std::string extension = file.substr(file.find_last_of('.')+1);
+    std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+    for(const char* known : {"jpg", "jpeg", "png", "bmp", "tif", "tiff", "webp"})
+        if(extension == known)
+            return true;
+    return false;
+}
+
+/**
+ * Feeds a corpus of poster images through the production chain without a database
+ * and reports the throughput, the end-to-end latency and the time spent in each stage.
+ */
+int main(int argc, char** argv)
+{
+    argagg::parser argparser {{
+        { "help", {"-h", "--help"},
+        "shows this help message", 0},
+        { "concurrency", {"-c", "--concurrency"},
+        "number of documents processed concurrently (default 1)", 1},
+        { "repeat", {"-r", "--repeat"},
+        "number of times every image is processed (default 1)", 1},
+        { "warmup", {"-w", "--warmup"},
+        "number of documents processed before the measurement starts (default 1)", 1},
+        { "limit", {"-n", "--limit"},
+        "use at most this number of images of the corpus", 1},
+        { "isolate", {"-I", "--isolate"},
+        "comma separated list of workers to run in separate processes, optionally followed by the number of processes, e.g. \"OCR:2,Background Segmentation\" (requires shared worker libraries)", 1},
+        { "json", {"-j", "--json"},
+        "write the results to this file as JSON", 1},
+        { "trace", {"--trace"},
+        "record the processing of documents as Chrome trace events and write them to this file", 1},
+        { "verbose", {"-v", "--verbose"},
+        "log to stdout (set to a value in range 1 (FATAL) to 6 (DEBUG) to specify the log level)", 1},
+    }};
+    
+    argagg::parser_results args;
+    try {
+        args = argparser.parse(argc, argv);
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    
+    if (args["help"] || args.pos.empty())
+    {
+        std::cout << "Usage: postersafari-bench [options] directories or images..." << std::endl << argparser;
+        return args["help"] ? 0 : 1;
+    }
+    
+    int concurrency = std::max(1, args["concurrency"].as<int>(1));
+    int repeat = std::max(1, args["repeat"].as<int>(1));
+    int warmup = std::max(0, args["warmup"].as<int>(1));
+    std::map<std::string,int> isolate;
+    if(args["isolate"])
+        isolate = Postr::Pipeline::parseIsolate(args["isolate"].as<std::string>());
+    
+    Postr::Worker::initializeLog(args["verbose"].as<int>(2));
+    Postr::MemoryTracker::install();
+    Postr::Worker::interactive = false;
+    Postr::Worker::debug = false;
+    
+    std::vector<std::string> files;
+    for(int i=0; i < args.pos.size(); ++i)
+    {
+        std::string path = args.as<std::string>(i);
+        if(Postr::File::isDirectory(path))
+        {
+            std::vector<std::string> found = Postr::File::locateAll(".*", {path});
+            std::sort(found.begin(), found.end());
+            for(const std::string& file : found)
+                if(isImage(file))
+                    files.push_back(file);
+        }
+        else if(Postr::File::exists(path))
+            files.push_back(path);
+        else
+            std::cerr << path << " not found" << std::endl;
+    }
+    if(args["limit"] && files.size() > args["limit"].as<size_t>())
+        files.resize(args["limit"].as<size_t>());
+    if(files.empty())
+    {
+        std::cerr << "no images found" << std::endl;
+        return 1;
+    }
+    
+    //read the corpus up front, decoding is part of the measurement like in the database stream
+    std::vector<std::vector<uchar>> corpus;
+    size_t corpusBytes = 0;
+    for(const std::string& file : files)
+    {
+        std::ifstream stream(file, std::ios::binary);
+        corpus.emplace_back(std::istreambuf_iterator<char>(stream), std::istreambuf_iterator<char>());
+        corpusBytes += corpus.back().size();
+    }
+    std::cout << "corpus: " << files.size() << " images, " << corpusBytes/1024/1024 << " MiB" << std::endl;
+    
+    if(args["trace"])
+        Postr::Tracer::start(args["trace"].as<std::string>());
+    
+    std::vector<double> latencies;
+    std::atomic_int failed(0);
+    double seconds = 0;
+    double cpu = 0;
+    std::map<std::string, StageSnapshot> before;
+    {
+        Postr::Pipeline pipeline(isolate);
+        Postr::Worker::WorkerChain chain = pipeline.chain();
+        
+        //process count documents with concurrency threads, each keeping one document in the chain
+        auto drive = [&](size_t count, bool record) {
+            std::atomic<size_t> next(0);
+            std::mutex mutex;
+            std::vector<std::thread> threads;
+            for(int t=0; t < concurrency; ++t)
+            {
+                threads.push_back(std::thread([&]{
+                    for(size_t i = next++; i < count && !Postr::Worker::aborted(); i = next++)
+                    {
+                        auto begin = std::chrono::steady_clock::now();
+                        
+                        Postr::DataPtr data(new Postr::Data);
+                        Postr::ImageData image = cv::imdecode(corpus[i % corpus.size()], cv::IMREAD_COLOR);
+                        if(image.empty())
+                        {
+                            LOG(ERROR) << "could not decode " << files[i % corpus.size()];
+                            ++failed;
+                            continue;
+                        }
+                        data->meta["filename"] = files[i % corpus.size()];
+                        data->images.push_back(image);
+                        data->meta["images"]["original"] = (int)data->images.size()-1;
+                        
+                        Postr::Worker::ChainValue c = chain << data;
+                        //documents a stage failed on finish early, their latency would skew the percentiles
+                        if(!Postr::Worker::waitForFinished(c) || data->meta["result"].isMember("errors"))
+                        {
+                            ++failed;
+                            continue;
+                        }
+                        
+                        double latency = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+                        if(record)
+                        {
+                            std::lock_guard<std::mutex> lock(mutex);
+                            latencies.push_back(latency);
+                        }
+                    }
+                }));
+            }
+            for(std::thread& thread : threads)
+                thread.join();
+        };
+        
+        drive(warmup, false);
+        failed = 0;
+        
+        for(const Postr::Worker* worker : chain.workers())
+            before.emplace(worker->name(), StageSnapshot(worker->metrics()));
+        
+        double cpuBegin = cpuSeconds(RUSAGE_SELF);
+        auto begin = std::chrono::steady_clock::now();
+        drive(corpus.size()*repeat, true);
+        seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+        cpu = cpuSeconds(RUSAGE_SELF) - cpuBegin;
+    }
+    //isolated workers have exited now and their resource usage is available
+    double childCpu = cpuSeconds(RUSAGE_CHILDREN);
+    
+    Postr::Tracer::stop();
+    
+    std::sort(latencies.begin(), latencies.end());
+    size_t documents = latencies.size();
+    unsigned int cores = std::max(1u, std::thread::hardware_concurrency());
+    
+    Postr::MetaData result;
+    result["images"] = (Json::UInt64)files.size();
+    result["concurrency"] = concurrency;
+    result["isolate"] = args["isolate"].as<std::string>("");
+    result["documents"] = (Json::UInt64)documents;
+    result["failed"] = failed.load();
+    result["seconds"] = seconds;
+    result["documentsPerSecond"] = documents/std::max(seconds, 1e-9);
+    result["latency"]["mean"] = documents ? std::accumulate(latencies.begin(), latencies.end(), 0.)/documents : 0.;
+    result["latency"]["p50"] = percentile(latencies, 0.5);
+    result["latency"]["p95"] = percentile(latencies, 0.95);
+    result["latency"]["p99"] = percentile(latencies, 0.99);
+    result["latency"]["max"] = latencies.empty() ? 0. : latencies.back();
+    result["cpu"]["seconds"] = cpu;
+    result["cpu"]["isolatedSeconds"] = childCpu;
+    result["cpu"]["utilization"] = cpu/std::max(seconds, 1e-9)/cores;
+    result["cpu"]["cores"] = cores;
+    result["memory"]["peakResidentBytes"] = (Json::Int64)peakResidentKiB(RUSAGE_SELF)*1024;
+    result["memory"]["peakIsolatedResidentBytes"] = (Json::Int64)peakResidentKiB(RUSAGE_CHILDREN)*1024;
+    result["memory"]["peakImageBytes"] = (Json::Int64)Postr::MemoryTracker::peakAllocatedBytes();
+    
+    double totalProcessing = 0;
+    for(const auto& stage : before)
+        totalProcessing += Postr::Metrics::stage(stage.first).processing.sum() - stage.second.processing;
+    for(const auto& stage : before)
+    {
+        StageSnapshot after(Postr::Metrics::stage(stage.first));
+        Postr::MetaData& entry = result["stages"][stage.first];
+        uint64_t processed = after.processed - stage.second.processed;
+        uint64_t waited = after.waited - stage.second.waited;
+        double processing = after.processing - stage.second.processing;
+        entry["documents"] = (Json::UInt64)(after.documents - stage.second.documents);
+        entry["errors"] = (Json::UInt64)(after.errors - stage.second.errors);
+        entry["processing"] = processed ? processing/processed : 0.;
+        entry["wait"] = waited ? (after.wait - stage.second.wait)/waited : 0.;
+        entry["share"] = totalProcessing > 0 ? processing/totalProcessing : 0.;
+        entry["cpu"] = processed ? (after.cpu - stage.second.cpu)/1e6/processed : 0.;
+        entry["blocked"] = processed ? (after.blocked - stage.second.blocked)/1e6/processed : 0.;
+        entry["contextSwitches"] = processed ? double(after.switches - stage.second.switches)/processed : 0.;
+        entry["peakImageBytes"] = (Json::Int64)Postr::Metrics::stage(stage.first).peakMemory.load();
+    }
+    
+    std::cout << std::fixed << std::setprecision(2);
+    std::cout << "processed " << documents << " documents (" << result["failed"].asInt() << " failed) in " << seconds << "s with concurrency " << concurrency << std::endl;
+    std::cout << "throughput: " << result["documentsPerSecond"].asDouble() << " docs/s" << std::endl;
+    std::cout << "latency:    p50 " << result["latency"]["p50"].asDouble() << "s, p95 " << result["latency"]["p95"].asDouble() 
+              << "s, p99 " << result["latency"]["p99"].asDouble() << "s, max " << result["latency"]["max"].asDouble() << "s" << std::endl;
+    std::cout << "cpu:        " << cpu << "s (" << 100*result["cpu"]["utilization"].asDouble() << "% of " << cores << " cores)";
+    if(childCpu > 0)
+        std::cout << ", isolated workers " << childCpu << "s";
+    std::cout << std::endl;
+    std::cout << "peak rss:   " << peakResidentKiB(RUSAGE_SELF)/1024 << " MiB, images " << Postr::MemoryTracker::peakAllocatedBytes()/1024/1024 << " MiB" << std::endl;
+    std::cout << std::endl;
+    
+    std::cout << std::left << std::setw(28) << "stage" << std::right
+              << std::setw(10) << "docs" << std::setw(8) << "errors"
+              << std::setw(12) << "avg ms" << std::setw(12) << "cpu ms" << std::setw(12) << "blocked ms" 
+              << std::setw(12) << "wait ms" << std::setw(10) << "switches" << std::setw(8) << "share" 
+              << std::setw(14) << "peak MiB" << std::endl;
+    for(const std::string& name : result["stages"].getMemberNames())
+    {
+        const Postr::MetaData& stage = result["stages"][name];
+        std::cout << std::left << std::setw(28) << name << std::right
+                  << std::setw(10) << stage["documents"].asUInt64() << std::setw(8) << stage["errors"].asUInt64()
+                  << std::setw(12) << 1000*stage["processing"].asDouble() << std::setw(12) << 1000*stage["cpu"].asDouble()
+                  << std::setw(12) << 1000*stage["blocked"].asDouble() << std::setw(12) << 1000*stage["wait"].asDouble()
+                  << std::setw(10) << stage["contextSwitches"].asDouble()
+                  << std::setw(7) << 100*stage["share"].asDouble() << "%"
+                  << std::setw(14) << stage["peakImageBytes"].asInt64()/1024./1024. << std::endl;
+    }
+    
+    if(args["json"])
+    {
+        std::ofstream out(args["json"].as<std::string>());
+        Json::StyledWriter writer;
+        out << writer.write(result);
+    }
+    
+    return failed > 0 ? 1 : 0;
+}
@@ -0,0 +1,401 @@
+/**
+ * This file is part of Poster Safari.
+ *
+ *  Poster Safari is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Poster Safari is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with Poster Safari.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ * 
+ *  Copyright 2017 Moritz Dannehl, Rebecca Lühmann, Nicolas Marin, Michael Nieß, Julian Wolff
+ * 
+ */
+
+#include "microbenchmark.h"
+
+#include "bgsegmentworker.h"
+#include "ocrworker.h"
+#include "textgroupcollateworker.h"
+#include "regexworker.h"
+#include "wordsplitworker.h"
+#include "spellcorrectworker.h"
+#include "spellcorrect.h"
+#include "votingtextmergeworker.h"
+#include "base64.h"
+
+#include <opencv2/imgproc.hpp>
+
+#include <iostream>
+#include <cstring>
+
+#include "argagg.hpp"
+
+#include "util.h"
+
+#ifndef POSTR_SOURCE_DIR
+#define POSTR_SOURCE_DIR "."
+#endif
+
+namespace Postr
+{
+    /**
+     * @brief Access to the internals of Workers measured by the microbenchmarks
+     */
+    struct MicroBenchmark
+    {
+        typedef SpellCorrectWorker::SpellCorrect SpellCorrect;
+        
+        static std::vector<std::string> edits(VotingTextMergeWorker& worker, const std::string& a, const std::string& b)
+        {
+            return worker.edits(a, b);
+        }
+    };
+}
+
+using namespace Postr;
+
+static std::string g_source = POSTR_SOURCE_DIR;
+
+static const char* Words[] = {
+    "Konzert", "Aachen", "Samstag", "Eintritt", "20:00 Uhr", "Theater", "Ausstellung", "Sonntag",
+    "Kulturzentrum", "Vorverkauf", "Abendkasse", "Jazz", "Festival", "Lesung", "Düsseldorf", "Köln",
+    "Musik", "Freitag", "Open Air", "12.05.2018", "www.example.org", "12,50 €", "Einlass 19 Uhr", "Berlin"
+};
+static const int WordCount = sizeof(Words)/sizeof(Words[0]);
+
+/**
+ * @brief Introduce the kind of errors an OCR engine makes
+ */
+static std::string corrupt(std::string word, cv::RNG& rng)
+{
+    static const char* Confusions[][2] = {{"l","1"}, {"o","0"}, {"e","c"}, {"m","rn"}, {"i","l"}, {"S","5"}, {"B","8"}, {"a","o"}, {"n","h"}};
+    for(int i=0; i < 2; ++i)
+    {
+        if(rng.uniform(0., 1.) > 0.4)
+            continue;
+        const char* const* confusion = Confusions[rng.uniform(0, 9)];
+        size_t pos = word.find(confusion[0]);
+        if(pos != std::string::npos)
+            word.replace(pos, strlen(confusion[0]), confusion[1]);
+    }
+    return word;
+}
+
+/**
+ * @brief A synthetic photo of a poster: a light sheet with lines of text on a noisy wall
+ */
+static Data makePoster()
+{
+    cv::Mat image(1754, 1240, CV_8UC3);
+    cv::theRNG().state = 42;
+    cv::randu(image, cv::Scalar::all(0), cv::Scalar::all(48));
+    image += cv::Scalar(70, 90, 80);
+    
+    cv::Rect sheet(140, 160, 960, 1380);
+    image(sheet).setTo(cv::Scalar(232, 238, 242));
+    cv::rectangle(image, sheet, cv::Scalar(40, 40, 40), 2);
+    
+    cv::RNG rng(42);
+    int y = sheet.y + 140;
+    for(int i=0; y < sheet.br().y - 60; ++i)
+    {
+        double scale = (i == 0) ? 3.5 : rng.uniform(1.2, 2.2);
+        std::string line = std::string(Words[rng.uniform(0, WordCount)]) + " " + Words[rng.uniform(0, WordCount)];
+        cv::putText(image, line, cv::Point(sheet.x + 60, y), cv::FONT_HERSHEY_DUPLEX, scale, cv::Scalar(30, 20, 140 - 10*i), scale > 3 ? 6 : 3, cv::LINE_AA);
+        y += scale*40 + 40;
+    }
+    
+    Data data;
+    data.images.push_back(ImageData(image));
+    data.meta["filename"] = "synthetic poster";
+    data.meta["images"]["original"] = 0;
+    return data;
+}
+
+static const Data& poster()
+{
+    static const Data data = makePoster();
+    return data;
+}
+
+/**
+ * @brief Text as detected by several OCR passes: every line is reported three times with jittered boxes and different errors
+ */
+static Data makeText(int lines)
+{
+    Data data;
+    cv::RNG rng(42);
+    for(int i=0; i < lines; ++i)
+    {
+        cv::Rect box((i%6)*190, (i/6)*60, 170, 40);
+        std::string text = std::string(Words[rng.uniform(0, WordCount)]) + " " + Words[rng.uniform(0, WordCount)];
+        for(int pass=0; pass < 3; ++pass)
+        {
+            MetaData entry;
+            entry["x"] = box.x + rng.uniform(-3, 4);
+            entry["y"] = box.y + rng.uniform(-3, 4);
+            entry["width"] = box.width + rng.uniform(-3, 4);
+            entry["height"] = box.height + rng.uniform(-3, 4);
+            entry["confidence"] = rng.uniform(40., 95.);
+            entry["text"] = corrupt(text, rng);
+            data.meta["text"].append(entry);
+        }
+    }
+    data.meta["filename"] = "synthetic text";
+    return data;
+}
+
+static const Data& text()
+{
+    static const Data data = makeText(120);
+    return data;
+}
+
+/**
+ * @brief Process data in a chain consisting of a single Worker and wait for the result
+ */
+static int process(Worker& worker, DataPtr data)
+{
+    Worker::ChainValue c = worker << data;
+    if(!Worker::waitForFinished(c))
+        return -1;
+    return worker.status();
+}
+
+/**
+ * @brief Measure a Worker processing a document. The input is copied outside of the measurement.
+ */
+static void benchmarkWorker(Benchmark::State& state, Worker& worker, const Data& input, size_t items)
+{
+    DataPtr data = std::make_shared<Data>(input);
+    if(process(worker, data) != 0)
+        return state.skip(worker.name() + " failed, are its data files installed?");
+    
+    while(state.running())
+    {
+        state.pauseTiming();
+        data = std::make_shared<Data>(input);
+        state.resumeTiming();
+        process(worker, data);
+    }
+    state.setItemsProcessed(items);
+}
+
+static const Data& collated()
+{
+    static Data data;
+    if(data.meta.isNull())
+    {
+        static TextGroupCollateWorker worker;
+        DataPtr result = std::make_shared<Data>(text());
+        process(worker, result);
+        data = *result;
+    }
+    return data;
+}
+
+POSTR_BENCHMARK(Base64Encode)
+{
+    std::vector<unsigned char> input(1 << 20);
+    cv::RNG rng(42);
+    rng.fill(input, cv::RNG::UNIFORM, 0, 256);
+    while(state.running())
+        base64_encode(input.data(), input.size());
+    state.setBytesProcessed(input.size());
+}
+
+POSTR_BENCHMARK(Base64Decode)
+{
+    std::vector<unsigned char> input(1 << 20);
+    cv::RNG rng(42);
+    rng.fill(input, cv::RNG::UNIFORM, 0, 256);
+    std::string encoded = base64_encode(input.data(), input.size());
+    while(state.running())
+        base64_decode(encoded);
+    state.setBytesProcessed(encoded.size());
+}
+
+POSTR_BENCHMARK(DataSerialize)
+{
+    const Data& input = poster();
+    size_t size = input.serialize(true).size();
+    while(state.running())
+        input.serialize(true);
+    state.setBytesProcessed(size);
+}
+
+POSTR_BENCHMARK(DataAssign)
+{
+    std::string serialized = poster().serialize(true);
+    while(state.running())
+    {
+        Data data;
+        data.assign(serialized);
+    }
+    state.setBytesProcessed(serialized.size());
+}
+
+POSTR_BENCHMARK(DataSerializeMeta)
+{
+    const Data& input = text();
+    size_t size = input.serialize(false).size();
+    while(state.running())
+        input.serialize(false);
+    state.setBytesProcessed(size);
+}
+
+POSTR_BENCHMARK(BgSegmentWorker)
+{
+    static BgSegmentWorker* worker = new BgSegmentWorker;
+    benchmarkWorker(state, *worker, poster(), 1);
+}
+
+POSTR_BENCHMARK(OCRWorker)
+{
+    static OCRWorker* worker = new OCRWorker;
+    benchmarkWorker(state, *worker, poster(), 1);
+}
+
+POSTR_BENCHMARK(TextGroupCollateWorker)
+{
+    static TextGroupCollateWorker* worker = new TextGroupCollateWorker;
+    benchmarkWorker(state, *worker, text(), text().meta["text"].size());
+}
+
+POSTR_BENCHMARK(VotingTextMergeWorker)
+{
+    static VotingTextMergeWorker* worker = new VotingTextMergeWorker;
+    benchmarkWorker(state, *worker, collated(), collated().meta["text"].size());
+}
+
+POSTR_BENCHMARK(VotingTextMergeEdits)
+{
+    static VotingTextMergeWorker* worker = new VotingTextMergeWorker;
+    std::vector<std::pair<std::string, std::string>> pairs;
+    cv::RNG rng(42);
+    for(int i=0; i < 200; ++i)
+    {
+        std::string word = Words[rng.uniform(0, WordCount)];
+        pairs.emplace_back(corrupt(word, rng), corrupt(word, rng));
+    }
+    while(state.running())
+        for(const auto& pair : pairs)
+            MicroBenchmark::edits(*worker, pair.first, pair.second);
+    state.setItemsProcessed(pairs.size());
+}
+
+POSTR_BENCHMARK(RegexWorker)
+{
+    static RegexWorker* worker = new RegexWorker;
+    benchmarkWorker(state, *worker, text(), text().meta["text"].size());
+}
+
+POSTR_BENCHMARK(WordSplitWorker)
+{
+    static WordSplitWorker* worker = new WordSplitWorker;
+    benchmarkWorker(state, *worker, text(), text().meta["text"].size());
+}
+
+POSTR_BENCHMARK(SpellCorrectWorker)
+{
+    static SpellCorrectWorker* worker = new SpellCorrectWorker;
+    benchmarkWorker(state, *worker, text(), text().meta["text"].size());
+}
+
+POSTR_BENCHMARK(SpellCorrectLookup)
+{
+    std::string dictfile = g_source + "/workers/spellcorrect/cities.txt";
+    std::string costfile = g_source + "/workers/spellcorrect/substitutioncosts.txt";
+    if(!File::exists(dictfile) || !File::exists(costfile))
+        return state.skip(dictfile + " not found, set --source");
+    
+    static MicroBenchmark::SpellCorrect* spell = nullptr;
+    if(!spell)
+    {
+        spell = new MicroBenchmark::SpellCorrect;
+        spell->editDistanceMax = 2;
+        spell->verbose = 1;
+        spell->distalg = MicroBenchmark::SpellCorrect::OCR_OPTIMIZED;
+        spell->LoadCostFile(costfile, '|');
+        spell->CreateDictionary(dictfile);
+    }
+    
+    std::vector<std::string> words;
+    cv::RNG rng(42);
+    for(const char* city : {"Aachen", "Düsseldorf", "Köln", "Berlin", "München", "Hamburg", "Bielefeld", "Stuttgart"})
+        for(int i=0; i < 8; ++i)
+            words.push_back(corrupt(city, rng));
+    
+    while(state.running())
+        for(const std::string& word : words)
+            spell->Correct(word);
+    state.setItemsProcessed(words.size());
+}
+
+POSTR_BENCHMARK(SpellCorrectOcrDistance)
+{
+    std::vector<std::pair<std::string, std::string>> pairs;
+    cv::RNG rng(42);
+    for(int i=0; i < 200; ++i)
+    {
+        std::string word = Words[rng.uniform(0, WordCount)];
+        pairs.emplace_back(word, corrupt(word, rng));
+    }
+    while(state.running())
+        for(const auto& pair : pairs)
+            MicroBenchmark::SpellCorrect::ocr_distance(pair.first, pair.second);
+    state.setItemsProcessed(pairs.size());
+}
+
+/**
+ * Runs the microbenchmarks of the workers and prints the time, the number of allocations
+ * and the throughput of each benchmark.
+ */
+int main(int argc, char** argv)
+{
+    argagg::parser argparser {{
+        { "help", {"-h", "--help"},
+        "shows this help message", 0},
+        { "filter", {"-f", "--filter"},
+        "only run benchmarks whose name matches this regular expression (default .*)", 1},
+        { "min-time", {"-t", "--min-time"},
+        "minimum measured time of each benchmark in seconds (default 0.5)", 1},
+        { "json", {"-j", "--json"},
+        "write the results to this file as JSON", 1},
+        { "source", {"-s", "--source"},
+        "source directory of the pipeline, used to find the dictionaries (default: the directory the benchmarks were built from)", 1},
+        { "verbose", {"-v", "--verbose"},
+        "log to stdout (set to a value in range 1 (FATAL) to 6 (DEBUG) to specify the log level)", 1},
+    }};
+    
+    argagg::parser_results args;
+    try {
+        args = argparser.parse(argc, argv);
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    
+    if (args["help"])
+    {
+        std::cout << "Usage: postr-microbenchmark [options]" << std::endl << argparser;
+        return 0;
+    }
+    
+    g_source = args["source"].as<std::string>(g_source);
+    
+    Worker::initializeLog(args["verbose"].as<int>(2));
+    Worker::interactive = false;
+    Worker::debug = false;
+    
+    int count = Benchmark::run(args["filter"].as<std::string>(".*"), args["min-time"].as<double>(0.5), args["json"].as<std::string>(""));
+    return count > 0 ? 0 : 1;
+}
@@ -21,19 +21,29 @@
 
 #include "couchdbstream.h"
 
-#include "base64.h"
 #include "util.h"
 
 #include <opencv2/highgui.hpp>
 
+#include <thread>
+#include <chrono>
+#include <algorithm>
+
 #undef LOG
 #define LOG(LEVEL) (CLOG(LEVEL, ELPP_CURR_FILE_LOGGER_ID) << "[Couch DB Stream] ")
 
 namespace Postr 
 {
     
-    CouchDBStream::CouchDBStream(const std::string& url, const long port, const std::string& user, const std::string& pass, bool debug, bool dryrun)
+    CouchDBStream::CouchDBStream(const std::string& url, const long port, const std::string& user, const std::string& pass, bool debug, bool dryrun, int batchSize, int prefetchCount, size_t prefetchBudget, int leaseDuration)
         : m_engine(url, port, user, pass, debug)
+        , m_stopHeartbeat(false)
+        , m_writer(m_engine)
+        , m_batchSize(std::max(1, batchSize))
+        , m_prefetchCount(prefetchCount)
+        , m_prefetchBudget(prefetchBudget)
+        , m_prefetchedBytes(0)
+        , m_stopPrefetch(false)
         , m_good(true)
         , m_open(true)
         , m_dryrun(dryrun)
@@ -41,10 +51,49 @@ namespace Postr
         LOG(INFO) << "------------------------------------------------------------";
         LOG(INFO) << "Engine ID: " << m_engine.id();
         LOG(INFO) << "start fetching data from DB.";
+        
+        m_engine.setLeaseDuration(std::max(10, leaseDuration));
+        m_writer.setCommitCallback([this](const std::string& id) {
+            std::lock_guard<std::mutex> lk(m_leasemutex);
+            m_leases.erase(id);
+        });
+        
+        if(m_prefetchCount > 0)
+            m_prefetchthread = std::thread(&CouchDBStream::prefetch, this);
+        
+        if(!m_dryrun)
+            m_heartbeatthread = std::thread(&CouchDBStream::heartbeat, this);
     }
     
     CouchDBStream::~CouchDBStream()
     {
+        //results of running chains are pushed to the writer, it must outlive them
+        waitForTasks();
+        
+        {
+            std::lock_guard<std::mutex> lk(m_queuemutex);
+            m_stopPrefetch = true;
+        }
+        m_queuecondition.notify_all();
+        if(m_prefetchthread.joinable())
+            m_prefetchthread.join();
+        
+        releaseQueue();
+        LOG(INFO) << "waiting for " << m_writer.backlog() << " results to be written";
+        m_writer.flush();
+        
+        {
+            std::lock_guard<std::mutex> lk(m_leasemutex);
+            m_stopHeartbeat = true;
+        }
+        m_heartbeatcondition.notify_all();
+        if(m_heartbeatthread.joinable())
+            m_heartbeatthread.join();
+        
+        CouchDB::TransferStats stats = m_engine.transferStats();
+        LOG(INFO) << "sent " << stats.bytesSent/1024 << " KiB (" << stats.uncompressedBytesSent/1024 << " KiB uncompressed), received " 
+                  << stats.bytesReceived/1024 << " KiB (" << stats.uncompressedBytesReceived/1024 << " KiB uncompressed) in " 
+                  << stats.requests << " requests. Compression saved approximately " << stats.secondsSaved() << "s";
         LOG(INFO) << "closed engine " << m_engine.id();
         LOG(INFO) << "------------------------------------------------------------";
     }
@@ -60,52 +109,185 @@ namespace Postr
     {
         while(good() && is_open())
         {
-            //get id of the first entry available
-            std::string id = "";
-            std::string rev = "";
+            std::unique_lock<std::mutex> lk(m_queuemutex);
             
-            while(good() && is_open() && !m_engine.getNextDocument(id, rev));
-            
-            if(good() && is_open())
+            if(m_queue.empty())
             {
-
-                Data resp;
-                m_engine.fetchDocument(id, rev, resp, false, false);
-                
-                if(!good() || !is_open())
-                    return *this;
-                
-                resp.meta["processedBy"] = m_engine.id();
-                
-                if(!m_dryrun && !m_engine.updateDocument(id, resp))
+                //claim a batch of documents with a single request, the prefetcher keeps working meanwhile
+                lk.unlock();
+                ensureIndexes();
+                std::vector<Data> claimed;
+                m_engine.claimDocuments(m_batchSize, claimed, m_dryrun);
+                if(claimed.empty())
                 {
-                    //another engine is processing this document
+                    //no documents available, try again later
+                    std::this_thread::sleep_for(std::chrono::seconds(1));
                     continue;
                 }
                 
-                data = resp;
+                if(!m_dryrun)
+                {
+                    std::lock_guard<std::mutex> leaselk(m_leasemutex);
+                    for(const Data& doc : claimed)
+                        m_leases[doc.meta["_id"].asString()] = doc.meta;
+                }
                 
-                std::string image = m_engine.fetchAttachment(resp.meta["_id"].asString(), resp.meta["_rev"].asString(), "userimage", Worker::interactive);
+                lk.lock();
+                for(Data& doc : claimed)
+                {
+                    m_queue.push_back(Data());
+                    m_queue.back().swap(doc);
+                }
+                m_queuecondition.notify_all();
                 
-                image = image.substr(image.find_first_of(':')+1);
-                //std::string type = image.substr(0,image.find_first_of(';'));
-                image = image.substr(image.find_first_of(',')+1);
+                if(!is_open())
+                {
+                    //the stream was closed while claiming, don't keep the new documents
+                    lk.unlock();
+                    releaseQueue();
+                    continue;
+                }
+            }
+            
+            //don't download the image twice if the prefetcher is currently fetching it
+            std::string id = m_queue.front().meta["_id"].asString();
+            m_queuecondition.wait(lk, [this,&id]{
+                return m_prefetching != id;
+            });
+            
+            //the queue may have been released or the document taken by another reader while waiting
+            if(m_queue.empty() || m_queue.front().meta["_id"].asString() != id)
+                continue;
             
-                std::string decoded = base64_decode(image);
+            data.swap(m_queue.front());
+            m_queue.pop_front();
+            
+            if(data.originalImage() >= 0)
+            {
+                const ImageData& image = data.images[data.originalImage()];
+                m_prefetchedBytes -= std::min(m_prefetchedBytes, image.total()*image.elemSize());
+            }
+            
+            lk.unlock();
+            m_queuecondition.notify_all();
+            
+            if(data.originalImage() < 0)
+            {
+                LOG(INFO) << "fetching document with id " << id;
                 
-                std::vector<uchar> imdata(decoded.begin(), decoded.end());
-
-                data.images.push_back(cv::imdecode(cv::Mat(imdata),cv::IMREAD_ANYCOLOR));
+                data.images.push_back(fetchImage(id));
                 
                 data.meta["images"]["original"] = (int)(data.images.size()-1);
-            
             }
+            else
+                LOG(INFO) << "using prefetched document with id " << id;
             
             return *this;
         }
         LOG(ERROR) << "connection lost while waiting for next document";
         return *this;
     }
+    
+    void CouchDBStream::ensureIndexes()
+    {
+        //the stream may never be read, e.g. when only local files are processed
+        std::call_once(m_indexesCreated, [this]{
+            if(!m_engine.ensureIndexes(!m_dryrun))
+                LOG(WARNING) << "some queries are not backed by an index. Fetching documents may be slow.";
+        });
+    }
+    
+    ImageData CouchDBStream::fetchImage(const std::string& id)
+    {
+        //fetch the latest revision, as renewing leases changes the revision of claimed documents
+        std::vector<uchar> imdata;
+        m_engine.fetchAttachment(id, "", "userimage", imdata, Worker::interactive);
+        
+        if(imdata.empty())
+            return ImageData();
+        
+        return cv::imdecode(imdata,cv::IMREAD_ANYCOLOR);
+    }
+    
+    void CouchDBStream::prefetch()
+    {
+        std::unique_lock<std::mutex> lk(m_queuemutex);
+        while(!m_stopPrefetch)
+        {
+            //find the next document in the queue without an image
+            Data *next = nullptr;
+            for(int i=0; i < m_queue.size() && i < m_prefetchCount; ++i)
+            {
+                if(m_queue[i].originalImage() < 0)
+                {
+                    next = &m_queue[i];
+                    break;
+                }
+            }
+            
+            if(!next || m_prefetchedBytes >= m_prefetchBudget || !is_open())
+            {
+                m_queuecondition.wait(lk);
+                continue;
+            }
+            
+            std::string id = next->meta["_id"].asString();
+            m_prefetching = id;
+            lk.unlock();
+            
+            LOG(DEBUG) << "prefetching document with id " << id;
+            ImageData image = fetchImage(id);
+            
+            lk.lock();
+            m_prefetching.clear();
+            
+            //the document may have been extracted from the queue in the meantime
+            for(Data& doc : m_queue)
+            {
+                if(doc.meta["_id"].asString() == id && doc.originalImage() < 0)
+                {
+                    doc.images.push_back(image);
+                    doc.meta["images"]["original"] = (int)(doc.images.size()-1);
+                    m_prefetchedBytes += image.total()*image.elemSize();
+                    break;
+                }
+            }
+            m_queuecondition.notify_all();
+        }
+    }
+    
+    void CouchDBStream::releaseQueue()
+    {
+        std::deque<Data> queue;
+        {
+            std::lock_guard<std::mutex> lk(m_queuemutex);
+            queue.swap(m_queue);
+            m_prefetchedBytes = 0;
+        }
+        m_queuecondition.notify_all();
+        
+        if(queue.empty() || m_dryrun)
+            return;
+        
+        //release the latest revisions known from renewing the leases
+        std::vector<Data> docs;
+        {
+            std::lock_guard<std::mutex> leaselk(m_leasemutex);
+            for(const Data& queued : queue)
+            {
+                auto lease = m_leases.find(queued.meta["_id"].asString());
+                if(lease == m_leases.end())
+                    continue;
+                docs.push_back(Data());
+                docs.back().meta = lease->second;
+                m_leases.erase(lease);
+            }
+        }
+        
+        //readers and the prefetcher go on while the documents are released
+        int released = m_engine.releaseDocuments(docs);
+        LOG(INFO) << "released " << released << " of " << docs.size() << " unprocessed documents";
+    }
             
     bool CouchDBStream::good() const
     {
@@ -119,43 +301,12 @@ namespace Postr
         return m_open;
     }
     
-    bool CouchDBStream::attachImage(const std::string& name, const Data& from, Data& to)
-    {
-        if(!from.meta["images"].isMember(name))
-            return false;
-        
-        std::vector<uchar> encoded;
-        cv::imencode(".jpg", from.image(name), encoded);
-        
-        std::string imdata = base64_encode(encoded.data(), encoded.size());
-        
-        to.meta["_attachments"][name]["content_type"] = "image/jpeg";
-        to.meta["_attachments"][name]["data"] = imdata;
-        
-        return true;
-    }
-            
     void CouchDBStream::handleResult(const Data& data)
     {
         if(m_dryrun)
             return;
         
-        Data result = data;
-        std::string id = result.meta["_id"].asString();
-        std::string rev = result.meta["_rev"].asString();
-        result.meta = result.meta["result"];
-        if(result.meta["title"].asString().empty())
-            result.meta["title"] = "Unbekannt";
-        attachImage("best", data, result);
-        if(data.meta.isMember("event") && !data.meta["event"].asString().empty())
-            result.meta["_id"] = data.meta["event"];
-        std::string eventId = m_engine.updateEvent(result);
-        m_engine.fetchDocument(id, rev, result, false);
-        result.meta["event"] = eventId;
-        if(m_engine.updateDocument(id, result))
-            LOG(INFO) << "finished processing " << id;
-        else
-            LOG(ERROR) << "failed uploading results for " << id;
+        m_writer.push(data);
     }
     
     void CouchDBStream::handleError(const Data& data)
@@ -163,25 +314,84 @@ namespace Postr
         if(m_dryrun)
             return;
         
-        Data result = data;
-        std::string id = result.meta["_id"].asString();
+        std::string id = data.meta["_id"].asString();
         if(!id.empty())
         {
-            LOG(INFO) << "trying to signal other engines that an error occured with " << id;
-            result.meta.removeMember("images");
-            result.meta.removeMember("processedBy");
-            if(m_engine.updateDocument(id, result))
-                LOG(INFO) << "signalled another engine to process " << id;
-            else
-                LOG(ERROR) << "failed to signal other engines that an error occured with " << id;
+            std::lock_guard<std::mutex> lk(m_leasemutex);
+            m_leases.erase(id);
+            LOG(INFO) << "an error occured with " << id << ". Other engines will process it once its lease expired.";
         }
         m_good = false;
     }
     
+    void CouchDBStream::heartbeat()
+    {
+        std::unique_lock<std::mutex> lk(m_leasemutex);
+        while(!m_stopHeartbeat)
+        {
+            //renew leases well before they expire
+            m_heartbeatcondition.wait_for(lk, std::chrono::seconds(m_engine.leaseDuration()/3));
+            
+            if(m_stopHeartbeat || m_leases.empty())
+                continue;
+            
+            std::vector<Data> docs;
+            for(const auto& lease : m_leases)
+            {
+                docs.push_back(Data());
+                docs.back().meta = lease.second;
+            }
+            lk.unlock();
+            
+            const MetaData status = m_engine.renewLeases(docs);
+            
+            lk.lock();
+            if(!status.isArray() || status.size() != docs.size())
+            {
+                //the request failed, the leases are still held and renewed with the next heartbeat
+                LOG(WARNING) << "could not renew " << docs.size() << " leases, retrying later";
+                continue;
+            }
+            
+            int renewed = 0;
+            for(int i=0; i < docs.size(); ++i)
+            {
+                std::string id = docs[i].meta["_id"].asString();
+                auto lease = m_leases.find(id);
+                if(lease == m_leases.end())
+                    continue; //finished in the meantime
+                
+                if(!status[i]["error"].asString().empty())
+                {
+                    LOG(WARNING) << "lost lease on " << id << ": " << status[i]["error"].asString();
+                    m_leases.erase(lease);
+                }
+                else if(!status[i]["id"].asString().empty())
+                {
+                    lease->second = docs[i].meta;
+                    ++renewed;
+                }
+            }
+            LOG(DEBUG) << "renewed " << renewed << " of " << docs.size() << " leases";
+        }
+    }
+    
+    void CouchDBStream::setCompression(bool responses, bool requests)
+    {
+        m_engine.setCompression(responses, requests);
+    }
+    
+    void CouchDBStream::setImageEncoding(const CouchDBWriter::ImageEncoding& encoding)
+    {
+        m_writer.setImageEncoding(encoding);
+    }
+    
     void CouchDBStream::close()
     {
         LOG(INFO) << "closing engine " << m_engine.id();
         m_open = false;
+        m_queuecondition.notify_all();
+        releaseQueue();
     }
     
     Postr::Data Postr::CouchDBStream::get(std::string id)
@@ -192,19 +402,9 @@ namespace Postr
         if(!good() || !is_open())
             return resp;
         
-        std::string image = m_engine.fetchAttachment(resp.meta["_id"].asString(), resp.meta["_rev"].asString(), "userimage", Worker::interactive);
+        resp.images.push_back(fetchImage(resp.meta["_id"].asString()));
         resp.meta.removeMember("_attachments");
         
-        image = image.substr(image.find_first_of(':')+1);
-        //std::string type = image.substr(0,image.find_first_of(';'));
-        image = image.substr(image.find_first_of(',')+1);
-    
-        std::string decoded = base64_decode(image);
-        
-        std::vector<uchar> imdata(decoded.begin(), decoded.end());
-
-        resp.images.push_back(cv::imdecode(cv::Mat(imdata),cv::IMREAD_ANYCOLOR));
-        
         resp.meta["images"]["original"] = (int)(resp.images.size()-1);
         
         return resp;
@@ -24,6 +24,14 @@
 
 #include "stream.h"
 #include "couchdb.h"
+#include "couchdbwriter.h"
+
+#include <deque>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <condition_variable>
 
 namespace Postr 
 {
@@ -33,7 +41,20 @@ namespace Postr
     class CouchDBStream final : public Stream
     {
     public:
-        CouchDBStream(const std::string& url, const long port, const std::string& user, const std::string& pass, bool debug = false, bool dryrun = false);
+        /**
+         * @brief Constructor
+         * @param url URL of the database server
+         * @param port Port of the database server
+         * @param user Username used with the database server
+         * @param pass Password used with the database server
+         * @param debug If true, debug versions of tables will be used
+         * @param dryrun If true, documents will not be claimed and results will not be written to DB
+         * @param batchSize Number of documents claimed with a single request
+         * @param prefetchCount Number of queued documents whose images are downloaded and decoded in the background
+         * @param prefetchBudget Maximum number of bytes held by prefetched images
+         * @param leaseDuration Time in seconds a claim on a document is valid without being renewed
+         */
+        CouchDBStream(const std::string& url, const long port, const std::string& user, const std::string& pass, bool debug = false, bool dryrun = false, int batchSize = 10, int prefetchCount = 2, size_t prefetchBudget = 256*1024*1024, int leaseDuration = 600);
         ~CouchDBStream();
         
         CouchDBStream& get(Data& data) override;
@@ -53,19 +74,92 @@ namespace Postr
         
         void close() override;
         
+        /**
+         * @brief Configure compression of the http traffic with DB
+         * @see CouchDB::setCompression
+         */
+        void setCompression(bool responses, bool requests);
+        
+        /**
+         * @brief Configure how result images are encoded before they are uploaded
+         * @see CouchDBWriter::ImageEncoding
+         */
+        void setImageEncoding(const CouchDBWriter::ImageEncoding& encoding);
+        
+        /**
+         * @brief Queue the results of a processed document to be written to DB.
+         * Results are committed asynchronously, see CouchDBWriter.
+         * @param data a Data object that has been processed in a chain.
+         */
         void handleResult(const Data& data) override;
         
     private:
         
+        /**
+         * @brief Stop renewing the lease of a document that failed to be processed.
+         * Other engines will process the document once its lease expired.
+         * @param data a Data object that has been processed in a chain while an error occured.
+         */
         void handleError(const Data& data) override;
         
         /**
-         * @brief Converts an image in 'from' to an attachment in 'to' and appends it to to.meta
-         * @return true on success, false else
+         * @brief Release all documents that have been claimed but not yet extracted from the stream
+         */
+        void releaseQueue();
+        
+        /**
+         * @brief Download and decode the userimage of a document
+         * @param id ID of the document
+         * @return the decoded image. The image is empty on error.
+         */
+        ImageData fetchImage(const std::string& id);
+        
+        /**
+         * @brief Background thread fetching the images of the next documents in the queue
+         */
+        void prefetch();
+        
+        /**
+         * @brief Background thread renewing the leases of all documents claimed by this engine
          */
-        bool attachImage(const std::string& name, const Data& from, Data& to);
+        void heartbeat();
+        
+        /**
+         * @brief Create the indexes claiming relies on before the first document is claimed
+         */
+        void ensureIndexes();
         
         CouchDB m_engine;
+        std::once_flag m_indexesCreated;
+        
+        /**
+         * @brief Documents claimed by this engine with their current revision, indexed by their ID
+         */
+        std::map<std::string, MetaData> m_leases;
+        std::mutex m_leasemutex;
+        std::condition_variable m_heartbeatcondition;
+        std::atomic_bool m_stopHeartbeat;
+        std::thread m_heartbeatthread;
+        
+        /**
+         * @brief Writes results to DB in the background
+         */
+        CouchDBWriter m_writer;
+        
+        /**
+         * @brief Documents claimed by this engine that have not been extracted from the stream yet
+         */
+        std::deque<Data> m_queue;
+        std::mutex m_queuemutex;
+        std::condition_variable m_queuecondition;
+        int m_batchSize;
+        
+        int m_prefetchCount;
+        size_t m_prefetchBudget;
+        size_t m_prefetchedBytes;
+        std::string m_prefetching;
+        std::atomic_bool m_stopPrefetch;
+        std::thread m_prefetchthread;
         
         bool m_good;
         bool m_open;
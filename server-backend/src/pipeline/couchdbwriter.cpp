@@ -0,0 +1,374 @@
+/**
+ * This file is part of Poster Safari.
+ *
+ *  Poster Safari is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Poster Safari is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with Poster Safari.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ * 
+ *  Copyright 2017 Moritz Dannehl, Rebecca Lühmann, Nicolas Marin, Michael Nieß, Julian Wolff
+ * 
+ */
+
+#include "couchdbwriter.h"
+
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/imgproc.hpp>
+
+#include <map>
+#include <chrono>
+#include <algorithm>
+#include <cmath>
+
+#undef LOG
+#define LOG(LEVEL) (CLOG(LEVEL, ELPP_CURR_FILE_LOGGER_ID) << "[Couch DB Writer] ")
+
+namespace Postr 
+{
+    CouchDBWriter::CouchDBWriter(CouchDB& engine, int interval, int batchSize, int maxAttempts)
+        : m_engine(engine)
+        , m_interval(interval)
+        , m_batchSize(std::max(1, batchSize))
+        , m_maxAttempts(std::max(1, maxAttempts))
+        , m_committing(0)
+        , m_stop(false)
+        , m_commits(0)
+        , m_commitTime(0)
+    {
+        m_thread = std::thread(&CouchDBWriter::run, this);
+    }
+    
+    CouchDBWriter::~CouchDBWriter()
+    {
+        m_stop = true;
+        m_queuecondition.notify_all();
+        if(m_thread.joinable())
+            m_thread.join();
+    }
+    
+    void CouchDBWriter::push(const Data& data)
+    {
+        PendingResult result;
+        result.posterId = data.meta["_id"].asString();
+        if(data.meta.isMember("event") && !data.meta["event"].asString().empty())
+            result.eventId = data.meta["event"].asString();
+        result.event = data.meta["result"];
+        if(result.event["title"].asString().empty())
+            result.event["title"] = "Unbekannt";
+        if(data.meta["images"].isMember("best"))
+            result.best = data.image("best");
+        result.attempts = 0;
+        
+        {
+            std::lock_guard<std::mutex> lk(m_queuemutex);
+            m_queue.push_back(result);
+        }
+        m_queuecondition.notify_all();
+    }
+    
+    void CouchDBWriter::flush()
+    {
+        std::unique_lock<std::mutex> lk(m_queuemutex);
+        m_flushcondition.wait(lk, [this]{
+            return m_queue.empty() && 0 == m_committing;
+        });
+    }
+    
+    void CouchDBWriter::setCommitCallback(std::function<void(const std::string&)> callback)
+    {
+        std::lock_guard<std::mutex> lk(m_queuemutex);
+        m_commitCallback = callback;
+    }
+    
+    void CouchDBWriter::setImageEncoding(const ImageEncoding& encoding)
+    {
+        std::lock_guard<std::mutex> lk(m_queuemutex);
+        m_encoding = encoding;
+    }
+    
+    bool CouchDBWriter::encodeImage(const cv::Mat& image, const ImageEncoding& encoding, std::vector<uchar>& encoded, std::string& contentType)
+    {
+        std::string format = encoding.format;
+        std::transform(format.begin(), format.end(), format.begin(), ::tolower);
+        if(format == "jpeg")
+            format = "jpg";
+        contentType = "image/" + ((format == "jpg") ? std::string("jpeg") : format);
+        bool lossy = (format == "jpg" || format == "webp");
+        
+        cv::Mat scaled = image;
+        int maxdim = std::max(image.cols, image.rows);
+        if(encoding.maxDimension > 0 && maxdim > encoding.maxDimension)
+        {
+            double f = (double)encoding.maxDimension/maxdim;
+            cv::resize(image, scaled, cv::Size(), f, f, cv::INTER_AREA);
+        }
+        
+        int quality = std::min(100, std::max(1, encoding.quality));
+        while(true)
+        {
+            std::vector<int> params;
+            if(format == "jpg")
+            {
+                params = { cv::IMWRITE_JPEG_QUALITY, quality, cv::IMWRITE_JPEG_OPTIMIZE, 1, cv::IMWRITE_JPEG_PROGRESSIVE, encoding.progressive?1:0 };
+            }
+            else if(format == "webp")
+                params = { cv::IMWRITE_WEBP_QUALITY, quality };
+            else if(format == "png")
+                params = { cv::IMWRITE_PNG_COMPRESSION, 9 };
+            
+            if(!cv::imencode("."+format, scaled, encoded, params))
+            {
+                LOG(ERROR) << "failed encoding image as " << format;
+                return false;
+            }
+            
+            if(encoding.maxBytes == 0 || encoded.size() <= encoding.maxBytes)
+                return true;
+            
+            //over budget: reduce the quality first, then the resolution
+            if(lossy && quality > encoding.minQuality)
+                quality = std::max(encoding.minQuality, quality-10);
+            else if(std::max(scaled.cols, scaled.rows) > 256)
+            {
+                //the encoded size roughly scales with the number of pixels
+                double f = std::min(0.9, std::max(0.5, std::sqrt((double)encoding.maxBytes/encoded.size())));
+                cv::resize(scaled, scaled, cv::Size(), f, f, cv::INTER_AREA);
+            }
+            else
+            {
+                LOG(WARNING) << "image exceeds the budget of " << encoding.maxBytes << " bytes with " << encoded.size() << " bytes";
+                return true;
+            }
+        }
+    }
+    
+    int CouchDBWriter::backlog() const
+    {
+        std::lock_guard<std::mutex> lk(m_queuemutex);
+        return m_queue.size() + m_committing;
+    }
+    
+    double CouchDBWriter::commitLatency() const
+    {
+        if(!m_commits)
+            return 0;
+        return (double)m_commitTime/m_commits;
+    }
+    
+    void CouchDBWriter::run()
+    {
+        while(true)
+        {
+            std::vector<PendingResult> batch;
+            {
+                std::unique_lock<std::mutex> lk(m_queuemutex);
+                m_queuecondition.wait_for(lk, std::chrono::milliseconds(m_interval), [this]{
+                    return m_stop || m_queue.size() >= m_batchSize;
+                });
+                
+                if(m_queue.empty())
+                {
+                    if(m_stop)
+                        break;
+                    continue;
+                }
+                
+                while(!m_queue.empty() && batch.size() < m_batchSize)
+                {
+                    batch.push_back(m_queue.front());
+                    m_queue.pop_front();
+                }
+                m_committing = batch.size();
+            }
+            
+            int count = batch.size();
+            auto start = std::chrono::steady_clock::now();
+            
+            commit(batch);
+            
+            auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+            m_commitTime += duration.count();
+            ++m_commits;
+            
+            {
+                std::lock_guard<std::mutex> lk(m_queuemutex);
+                //retry failed results with the next commit
+                for(PendingResult& result : batch)
+                {
+                    if(++result.attempts < m_maxAttempts)
+                        m_queue.push_back(result);
+                    else
+                        LOG(ERROR) << "failed uploading results for " << result.posterId << " after " << result.attempts << " attempts";
+                }
+                m_committing = 0;
+            }
+            m_flushcondition.notify_all();
+            
+            LOG(INFO) << "committed " << count-batch.size() << " of " << count << " results in " << duration.count() << "ms (mean " << commitLatency() << "ms), backlog: " << backlog();
+        }
+        m_flushcondition.notify_all();
+    }
+    
+    void CouchDBWriter::encodeImages(std::vector<PendingResult>& batch)
+    {
+        ImageEncoding encoding;
+        {
+            std::lock_guard<std::mutex> lk(m_queuemutex);
+            encoding = m_encoding;
+        }
+        
+        std::atomic_int next(0);
+        std::atomic_llong bytes(0);
+        auto start = std::chrono::steady_clock::now();
+        auto encode = [&]() {
+            for(int i = next++; i < batch.size(); i = next++)
+            {
+                PendingResult& result = batch[i];
+                if(result.best.empty() || !result.encodedBest.empty())
+                    continue;
+                if(encodeImage(result.best, encoding, result.encodedBest, result.bestContentType))
+                {
+                    bytes += result.encodedBest.size();
+                    //the encoded image is kept for retries, the decoded one is not needed anymore
+                    result.best.release();
+                }
+            }
+        };
+        
+        int threadCount = std::min<int>(batch.size(), std::max(1u, std::thread::hardware_concurrency()));
+        std::vector<std::thread> threads;
+        for(int i=1; i < threadCount; ++i)
+            threads.push_back(std::thread(encode));
+        encode();
+        for(std::thread& thread : threads)
+            thread.join();
+        
+        if(bytes > 0)
+        {
+            auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+            LOG(DEBUG) << "encoded images of " << batch.size() << " results to " << bytes/1024 << " KiB in " << duration.count() << "ms";
+        }
+    }
+    
+    void CouchDBWriter::commit(std::vector<PendingResult>& batch)
+    {
+        encodeImages(batch);
+        
+        //fetch events that already exist for their current revisions and attachments
+        std::vector<std::string> eventIds;
+        for(const PendingResult& result : batch)
+        {
+            if(!result.eventId.empty())
+                eventIds.push_back(result.eventId);
+        }
+        
+        std::map<std::string,MetaData> existingEvents;
+        for(const MetaData& row : m_engine.fetchDocuments(eventIds, true, true))
+        {
+            if(row["doc"].isObject() && row["doc"].isMember("_rev"))
+                existingEvents[row["id"].asString()] = row["doc"];
+        }
+        
+        std::vector<Data> events(batch.size());
+        for(int i=0; i < batch.size(); ++i)
+        {
+            events[i].meta = batch[i].event;
+            if(!batch[i].eventId.empty())
+            {
+                events[i].meta["_id"] = batch[i].eventId;
+                auto existing = existingEvents.find(batch[i].eventId);
+                if(existing != existingEvents.end())
+                {
+                    events[i].meta["_rev"] = existing->second["_rev"];
+                    //attachments missing from the new revision are deleted, keep the stored ones as stubs
+                    if(existing->second.isMember("_attachments"))
+                        events[i].meta["_attachments"] = existing->second["_attachments"];
+                }
+            }
+        }
+        
+        const MetaData eventStatus = m_engine.updateDocuments(events, true);
+        
+        std::vector<PendingResult> failed;
+        std::vector<int> written;
+        for(int i=0; i < batch.size(); ++i)
+        {
+            if(eventStatus[i]["error"].asString().empty() && !eventStatus[i]["id"].asString().empty())
+            {
+                //remember the id, so a retry updates this event instead of creating a new one
+                batch[i].eventId = eventStatus[i]["id"].asString();
+                
+                if(!batch[i].encodedBest.empty() && m_engine.updateAttachment(batch[i].eventId, eventStatus[i]["rev"].asString(), "best", batch[i].bestContentType, batch[i].encodedBest, true).empty())
+                {
+                    //the poster is only linked once its event is complete, retry with the next commit
+                    LOG(WARNING) << "failed uploading image for event " << batch[i].eventId;
+                    failed.push_back(batch[i]);
+                    continue;
+                }
+                
+                written.push_back(i);
+            }
+            else
+            {
+                LOG(WARNING) << "failed writing event for " << batch[i].posterId << ": " << eventStatus[i]["error"].asString();
+                failed.push_back(batch[i]);
+            }
+        }
+        
+        //link the poster documents to their events
+        std::vector<std::string> posterIds;
+        for(int i : written)
+        {
+            posterIds.push_back(batch[i].posterId);
+        }
+        
+        const MetaData posters = m_engine.fetchDocuments(posterIds, true, false);
+        
+        std::vector<Data> docs;
+        std::vector<int> docIndex;
+        for(int j=0; j < written.size(); ++j)
+        {
+            int i = written[j];
+            if(posters[j]["doc"].isObject())
+            {
+                docs.push_back(Data());
+                docs.back().meta = posters[j]["doc"];
+                docs.back().meta["event"] = batch[i].eventId;
+                //the document is finished, its claim doesn't need to be renewed anymore
+                docs.back().meta.removeMember("leaseExpires");
+                docIndex.push_back(i);
+            }
+            else
+                failed.push_back(batch[i]);
+        }
+        
+        const MetaData posterStatus = m_engine.updateDocuments(docs);
+        
+        for(int k=0; k < docs.size(); ++k)
+        {
+            int i = docIndex[k];
+            if(posterStatus[k]["error"].asString().empty() && !posterStatus[k]["id"].asString().empty())
+            {
+                LOG(INFO) << "finished processing " << batch[i].posterId;
+                if(m_commitCallback)
+                    m_commitCallback(batch[i].posterId);
+            }
+            else
+            {
+                LOG(WARNING) << "failed linking " << batch[i].posterId << " to event " << batch[i].eventId << ": " << posterStatus[k]["error"].asString();
+                failed.push_back(batch[i]);
+            }
+        }
+        
+        batch.swap(failed);
+    }
+}
@@ -0,0 +1,163 @@
+/**
+ * This file is part of Poster Safari.
+ *
+ *  Poster Safari is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Poster Safari is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with Poster Safari.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ * 
+ *  Copyright 2017 Moritz Dannehl, Rebecca Lühmann, Nicolas Marin, Michael Nieß, Julian Wolff
+ * 
+ */
+
+#ifndef COUCHDB_WRITER_H
+#define COUCHDB_WRITER_H
+
+#include "couchdb.h"
+#include "imagedata.h"
+
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+
+namespace Postr 
+{
+    /**
+     * @brief Writes results of a Worker chain to a CouchDB instance in the background.
+     * Results are queued and committed periodically with _bulk_docs requests.
+     * Results that could not be written due to conflicts are retried with the next commit.
+     */
+    class CouchDBWriter
+    {
+    public:
+        /**
+         * @brief Settings for encoding result images before they are uploaded
+         */
+        struct ImageEncoding
+        {
+            std::string format = "jpg";     ///< file extension understood by cv::imencode, e.g. jpg, webp or png
+            int quality = 85;               ///< quality of lossy formats in range 1 to 100
+            int minQuality = 50;            ///< lowest quality used to meet maxBytes
+            int maxDimension = 2048;        ///< images are downscaled to this width/height. 0 keeps the original size.
+            bool progressive = true;        ///< write progressive JPEGs, which can be displayed while downloading
+            size_t maxBytes = 512*1024;     ///< byte budget per image. Quality and size are reduced until the image fits. 0 disables the budget.
+        };
+        
+        /**
+         * @brief Constructor
+         * @param engine the database connection to write to
+         * @param interval time in milliseconds between two commits
+         * @param batchSize maximum number of results written with a single commit
+         * @param maxAttempts number of commits a result is tried to be written with before it is dropped
+         */
+        explicit CouchDBWriter(CouchDB& engine, int interval = 2000, int batchSize = 25, int maxAttempts = 5);
+        
+        /**
+         * @brief Destructor
+         * Blocks until all queued results have been committed.
+         */
+        ~CouchDBWriter();
+        
+        /**
+         * @brief Queue the result of a processed poster document
+         * @param data a Data object that has been processed in a chain
+         */
+        void push(const Data& data);
+        
+        /**
+         * @brief Block until all results queued so far have been committed
+         */
+        void flush();
+        
+        /**
+         * @brief Set a function that is called with the ID of each poster document whose results have been committed
+         */
+        void setCommitCallback(std::function<void(const std::string&)> callback);
+        
+        /**
+         * @brief Set how result images are encoded
+         */
+        void setImageEncoding(const ImageEncoding& encoding);
+        
+        /**
+         * @brief Encode an image within the byte budget of the given settings
+         * @param image the image to encode
+         * @param encoding encoding settings
+         * @param encoded the encoded image
+         * @param contentType MIME type of the encoded image
+         * @return true on success
+         */
+        static bool encodeImage(const cv::Mat& image, const ImageEncoding& encoding, std::vector<uchar>& encoded, std::string& contentType);
+        
+        /**
+         * @brief Number of results waiting to be committed
+         */
+        int backlog() const;
+        
+        /**
+         * @brief Mean duration of a commit in milliseconds
+         */
+        double commitLatency() const;
+        
+    private:
+        struct PendingResult
+        {
+            std::string posterId;
+            std::string eventId;
+            MetaData event;
+            ImageData best;
+            std::vector<uchar> encodedBest;
+            std::string bestContentType;
+            int attempts;
+        };
+        
+        /**
+         * @brief Background thread committing queued results
+         */
+        void run();
+        
+        /**
+         * @brief Write a batch of results to DB
+         * @param batch results to write. Results that failed to be written remain in batch.
+         */
+        void commit(std::vector<PendingResult>& batch);
+        
+        /**
+         * @brief Encode the images of a batch in parallel. Images are encoded only once, even if the results are retried.
+         */
+        void encodeImages(std::vector<PendingResult>& batch);
+        
+        CouchDB& m_engine;
+        std::function<void(const std::string&)> m_commitCallback;
+        int m_interval;
+        int m_batchSize;
+        int m_maxAttempts;
+        ImageEncoding m_encoding;
+        
+        std::deque<PendingResult> m_queue;
+        mutable std::mutex m_queuemutex;
+        std::condition_variable m_queuecondition;
+        std::condition_variable m_flushcondition;
+        
+        std::atomic_int m_committing;
+        std::atomic_bool m_stop;
+        std::atomic_llong m_commits;
+        std::atomic_llong m_commitTime;
+        
+        std::thread m_thread;
+    };
+}
+
+#endif //COUCHDB_WRITER_H
@@ -21,21 +21,19 @@
 
 #include <opencv2/highgui.hpp>
 #include <opencv2/imgcodecs.hpp>
-#include "ocrworker.h"
-#include "bgsegmentworker.h"
+#include "pipeline.h"
 #include "workerloader.h"
-#include "textgroupcollateworker.h"
-#include "regexworker.h"
-#include "wordsplitworker.h"
-#include "spellcorrectworker.h"
-#include "votingtextmergeworker.h"
-#include "naivesemanticanalysis.h"
+#include "metrics.h"
+#include "memorytracker.h"
+#include "tracer.h"
 
 #include "couchdbstream.h"
 
 #include <iostream>
 #include <thread>
 #include <chrono>
+#include <memory>
+#include <sstream>
 
 #include "argagg.hpp"
 
@@ -61,8 +59,42 @@ int main(int argc, char **argv)
         "process and print result, but don't send the result back to database", 0},
         { "quiet", {"-q", "--quiet"},
         "hide progress", 0},
+        { "progress-rate", {"--progress-rate"},
+        "number of times per second progress bars are redrawn (default 10)", 1},
         { "verbose", {"-v", "--verbose"},
         "log to stdout (set to a value in range 1 (FATAL) to 6 (DEBUG) to specify the log level)", 1},
+        { "batch-size", {"-B", "--batch-size"},
+        "number of documents claimed from database with a single request (default 10)", 1},
+        { "prefetch", {"--prefetch"},
+        "number of claimed documents whose images are downloaded ahead of processing, 0 disables prefetching (default 2)", 1},
+        { "prefetch-budget", {"--prefetch-budget"},
+        "maximum size of prefetched images in MiB (default 256)", 1},
+        { "compress", {"-z", "--compress"},
+        "compress request bodies sent to database (responses are always accepted compressed)", 0},
+        { "image-format", {"--image-format"},
+        "format of result images uploaded to database: jpg, webp or png (default jpg)", 1},
+        { "image-quality", {"--image-quality"},
+        "quality of result images in range 1 to 100 (default 85)", 1},
+        { "image-size", {"--image-size"},
+        "maximum width and height of result images in pixels, 0 keeps the original size (default 2048)", 1},
+        { "image-budget", {"--image-budget"},
+        "maximum size of result images in KiB, 0 for no limit (default 512)", 1},
+        { "baseline", {"--baseline"},
+        "write baseline instead of progressive JPEGs", 0},
+        { "lease", {"-L", "--lease"},
+        "seconds a claimed document stays reserved for this engine without being renewed (default 600)", 1},
+        { "isolate", {"-I", "--isolate"},
+        "comma separated list of workers to run in separate processes, optionally followed by the number of processes, e.g. \"OCR:2,Background Segmentation\" (requires shared worker libraries)", 1},
+        { "metrics-port", {"-M", "--metrics-port"},
+        "serve per-stage metrics in the Prometheus text format on http://127.0.0.1:PORT/metrics", 1},
+        { "metrics-file", {"--metrics-file"},
+        "write per-stage metrics to this file periodically", 1},
+        { "metrics-interval", {"--metrics-interval"},
+        "seconds between two writes of the metrics file (default 10)", 1},
+        { "trace", {"--trace"},
+        "record the processing of documents as Chrome trace events and write them to this file on exit (view in https://ui.perfetto.dev)", 1},
+        { "trace-sample", {"--trace-sample"},
+        "fraction of documents to trace in range 0 to 1 (default 1)", 1},
     }};
     
     argagg::parser_results args;
@@ -94,35 +126,68 @@ int main(int argc, char **argv)
     bool interactive = true;
     if(args["quiet"])
         interactive = false;
+    if(args["progress-rate"])
+        Postr::Worker::progressRate = args["progress-rate"].as<int>();
     
     int loglevel = 3;
     if(args["verbose"])
         loglevel = args["verbose"];
     
+    int batchsize = 10;
+    if(args["batch-size"])
+        batchsize = args["batch-size"];
+    
+    int prefetch = 2;
+    if(args["prefetch"])
+        prefetch = args["prefetch"];
+    
+    size_t prefetchbudget = 256;
+    if(args["prefetch-budget"])
+        prefetchbudget = args["prefetch-budget"].as<int>();
+    
+    Postr::CouchDBWriter::ImageEncoding encoding;
+    if(args["image-format"])
+        encoding.format = args["image-format"].as<std::string>();
+    if(args["image-quality"])
+        encoding.quality = args["image-quality"];
+    if(args["image-size"])
+        encoding.maxDimension = args["image-size"];
+    if(args["image-budget"])
+        encoding.maxBytes = args["image-budget"].as<int>()*1024;
+    if(args["baseline"])
+        encoding.progressive = false;
+    
+    bool compress = false;
+    if(args["compress"])
+        compress = true;
+    
+    int lease = 600;
+    if(args["lease"])
+        lease = args["lease"];
+    
+    std::map<std::string,int> isolate;
+    if(args["isolate"])
+        isolate = Postr::Pipeline::parseIsolate(args["isolate"].as<std::string>());
+    
     Postr::Worker::initializeLog(loglevel);
+    Postr::MemoryTracker::install();
     
-    Postr::CouchDBStream datastream(DATABASE_URL, DATABASE_PORT, DATABASE_USER, DATABASE_PASSWORD, debugDB, dryrun);
-    
-    Postr::BgSegmentWorker bgsegmentworker;
-    Postr::OCRWorker ocrworker,ocrworker2;
-    Postr::TextGroupCollateWorker textgroupworker,textgroupworker2;
-    Postr::RegexWorker regexworker;
-    Postr::WordSplitWorker wordsplitworker;
-    Postr::SpellCorrectWorker spellcorrectworker;
-    Postr::VotingTextMergeWorker votingworker;
-    Postr::NaiveSemanticAnalysisWorker semanticanalysis;
-    
-    auto joiner = [](Postr::Data& data,const Postr::Data& data2){
-                        for(int i=0; i < data2.meta["text"].size(); ++i)
-                            data.meta["text"].append(data2.meta["text"][i]);
-                        if(!data.meta["images"].isMember("text"))
-                        {
-                            data.images.push_back(data2.image("text"));
-                            data.meta["images"]["text"] = data.meta["images"].size();
-                        }
-                    };
+    if(args["metrics-port"])
+        Postr::Metrics::serve(args["metrics-port"]);
+    if(args["metrics-file"])
+        Postr::Metrics::dump(args["metrics-file"].as<std::string>(), args["metrics-interval"].as<int>(10));
+    if(args["trace"])
+        Postr::Tracer::start(args["trace"].as<std::string>(), args["trace-sample"].as<double>(1));
+    
+    Postr::CouchDBStream datastream(DATABASE_URL, DATABASE_PORT, DATABASE_USER, DATABASE_PASSWORD, debugDB, dryrun, batchsize, prefetch, prefetchbudget*1024*1024, lease);
+    datastream.setCompression(true, compress);
+    datastream.setImageEncoding(encoding);
+    
+    Postr::Pipeline pipeline(isolate);
+    
+    std::vector<std::string> available = Postr::WorkerLoader::availableWorkers();
+    LOG(INFO) << "available Workers: " << available;
     
-
     bool success = true;
     std::vector<Postr::Worker::ChainValue> remaining(args.pos.size());
     std::vector<Postr::DataPtr> data(args.pos.size());
@@ -152,16 +217,9 @@ int main(int argc, char **argv)
             
         Postr::Worker::interactive = interactive;
         Postr::Worker::debug = debug; //debug shall be disabled when using concurrent pipelines
-        
-        std::vector<std::string> available = Postr::WorkerLoader::availableWorkers();
-        LOG(INFO) << "available Workers: " << available;
                     
         //store the chain in a variable to make sure we don't run into undefined behaviour because of invalid references
-        chain[argindex] = semanticanalysis << spellcorrectworker << wordsplitworker << regexworker << votingworker << Postr::Worker::join(
-            textgroupworker << ocrworker << bgsegmentworker, 
-            textgroupworker2 << ocrworker2, 
-            joiner
-        );
+        chain[argindex] = pipeline.chain();
         
         //start processing data in the chain and store the chain counter in a variable to be able to track the chain's progress
         remaining[argindex] = chain[argindex] << data[argindex];
@@ -170,11 +228,7 @@ int main(int argc, char **argv)
     
     if(args.pos.size() == 0)
     {    
-        semanticanalysis << spellcorrectworker << wordsplitworker << regexworker << votingworker << Postr::Worker::join(
-            textgroupworker << ocrworker << bgsegmentworker, 
-            textgroupworker2 << ocrworker2, 
-            joiner
-        ) << datastream;
+        pipeline.chain() << datastream;
     }
     
     for(int i=0; i < remaining.size(); ++i)
@@ -209,6 +263,9 @@ int main(int argc, char **argv)
         LOG(DEBUG) << "removing " << data[i]->meta["filename"].asString() << " from list";
     }
     
+    Postr::Metrics::stop();
+    Postr::Tracer::stop();
+    
     LOG(DEBUG) << "exit";
     
     return 0;
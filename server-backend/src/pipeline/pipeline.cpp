@@ -0,0 +1,87 @@
+/**
+ * This file is part of Poster Safari.
+ *
+ *  Poster Safari is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Poster Safari is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with Poster Safari.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ * 
+ *  Copyright 2017 Moritz Dannehl, Rebecca Lühmann, Nicolas Marin, Michael Nieß, Julian Wolff
+ * 
+ */
+
+#include "pipeline.h"
+
+#include <sstream>
+#include <cstdlib>
+
+namespace Postr 
+{
+    Pipeline::Pipeline(const std::map<std::string,int>& isolate)
+        : m_bgsegment(select(m_bgsegmentworker, isolate))
+        , m_ocr(select(m_ocrworker, isolate))
+        , m_ocr2(select(m_ocrworker2, isolate))
+        , m_textgroup(select(m_textgroupworker, isolate))
+        , m_textgroup2(select(m_textgroupworker2, isolate))
+        , m_regex(select(m_regexworker, isolate))
+        , m_wordsplit(select(m_wordsplitworker, isolate))
+        , m_spellcorrect(select(m_spellcorrectworker, isolate))
+        , m_voting(select(m_votingworker, isolate))
+        , m_semantic(select(m_semanticanalysis, isolate))
+    {
+    }
+    
+    Worker::WorkerChain Pipeline::chain()
+    {
+        return m_semantic << m_spellcorrect << m_wordsplit << m_regex << m_voting << Worker::join(
+            m_textgroup << m_ocr << m_bgsegment, 
+            m_textgroup2 << m_ocr2, 
+            joinText
+        );
+    }
+    
+    std::map<std::string,int> Pipeline::parseIsolate(const std::string& list)
+    {
+        std::map<std::string,int> isolate;
+        std::stringstream stream(list);
+        std::string entry;
+        while(std::getline(stream, entry, ','))
+        {
+            size_t colon = entry.rfind(':');
+            if(colon == std::string::npos)
+                isolate[entry] = 1;
+            else
+                isolate[entry.substr(0, colon)] = std::max(1, std::atoi(entry.substr(colon+1).c_str()));
+        }
+        return isolate;
+    }
+    
+    Worker& Pipeline::select(Worker& worker, const std::map<std::string,int>& isolate)
+    {
+        auto it = isolate.find(worker.name());
+        if(it == isolate.end())
+            return worker;
+        m_isolated.emplace_back(new ProcessWorker(worker.name(), it->second));
+        return *m_isolated.back();
+    }
+    
+    void Pipeline::joinText(Data& data, const Data& other)
+    {
+        for(int i=0; i < other.meta["text"].size(); ++i)
+            data.meta["text"].append(other.meta["text"][i]);
+        if(!data.meta["images"].isMember("text"))
+        {
+            data.images.push_back(other.image("text"));
+            data.meta["images"]["text"] = data.meta["images"].size();
+        }
+    }
+}
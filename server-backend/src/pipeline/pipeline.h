@@ -0,0 +1,99 @@
+/**
+ * This file is part of Poster Safari.
+ *
+ *  Poster Safari is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Poster Safari is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with Poster Safari.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ * 
+ *  Copyright 2017 Moritz Dannehl, Rebecca Lühmann, Nicolas Marin, Michael Nieß, Julian Wolff
+ * 
+ */
+
+#ifndef POSTR_PIPELINE_H
+#define POSTR_PIPELINE_H
+
+#include "ocrworker.h"
+#include "bgsegmentworker.h"
+#include "processworker.h"
+#include "textgroupcollateworker.h"
+#include "regexworker.h"
+#include "wordsplitworker.h"
+#include "spellcorrectworker.h"
+#include "votingtextmergeworker.h"
+#include "naivesemanticanalysis.h"
+
+#include <map>
+#include <memory>
+#include <vector>
+
+namespace Postr 
+{
+    /**
+     * @brief The chain of Workers that extracts the information of a poster.
+     * The Pipeline owns its Workers. Chains returned by chain() refer to them and must not outlive the Pipeline.
+     */
+    class Pipeline
+    {
+    public:
+        /**
+         * @brief Create the Workers of the pipeline
+         * @param isolate names of Workers that are run in separate processes, mapped to the number of processes (requires shared worker libraries)
+         */
+        explicit Pipeline(const std::map<std::string,int>& isolate = {});
+        
+        /**
+         * @brief The chain processing a document
+         */
+        Worker::WorkerChain chain();
+        
+        /**
+         * @brief Parse a list of Workers to isolate
+         * @param list comma separated list of worker names, optionally followed by the number of processes, e.g. "OCR:2,Background Segmentation"
+         * @return names of Workers mapped to the number of processes
+         */
+        static std::map<std::string,int> parseIsolate(const std::string& list);
+        
+    private:
+        Worker& select(Worker& worker, const std::map<std::string,int>& isolate);
+        
+        /**
+         * @brief Merge the text found in the whole image into the text found in the segmented poster
+         */
+        static void joinText(Data& data, const Data& other);
+        
+        BgSegmentWorker m_bgsegmentworker;
+        OCRWorker m_ocrworker, m_ocrworker2;
+        TextGroupCollateWorker m_textgroupworker, m_textgroupworker2;
+        RegexWorker m_regexworker;
+        WordSplitWorker m_wordsplitworker;
+        SpellCorrectWorker m_spellcorrectworker;
+        VotingTextMergeWorker m_votingworker;
+        NaiveSemanticAnalysisWorker m_semanticanalysis;
+        
+        //workers selected for isolation are replaced by workers running in separate processes
+        std::vector<std::unique_ptr<ProcessWorker>> m_isolated;
+        
+        Worker& m_bgsegment;
+        Worker& m_ocr;
+        Worker& m_ocr2;
+        Worker& m_textgroup;
+        Worker& m_textgroup2;
+        Worker& m_regex;
+        Worker& m_wordsplit;
+        Worker& m_spellcorrect;
+        Worker& m_voting;
+        Worker& m_semantic;
+    };
+}
+
+#endif //POSTR_PIPELINE_H
@@ -20,6 +20,7 @@
  */
 
 #include "stream.h"
+#include "configsnapshot.h"
 #include <thread>
 
 namespace Postr 
@@ -31,7 +32,13 @@ namespace Postr
     
     Stream::~Stream()
     {
-        while(m_tasks);
+        waitForTasks();
+    }
+    
+    void Stream::waitForTasks()
+    {
+        while(m_tasks)
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
     }
     
     void Stream::process(Worker::WorkerChain chain, const Data& data)
@@ -63,10 +70,13 @@ namespace Postr
     
     void operator<<(Worker::WorkerChain chain, Stream& stream)
     {
+        ConfigSnapshot<int> maxtasks(**chain.workers().begin(), [](const Worker& worker, int& maxtasks){
+            maxtasks = worker.config("stream_maxTasks", 5, "maximum number of documents being processed in parallel");
+        });
+        
         while(stream.is_open() && stream.good())
         {
-            int maxtasks = (*chain.workers().begin())->config("stream_maxTasks", 5, "maximum number of documents being processed in parallel");
-            while(stream.m_tasks > maxtasks)
+            while(stream.m_tasks > *maxtasks.get())
                 std::this_thread::sleep_for(std::chrono::milliseconds(500));
             
             Data data;
@@ -89,6 +89,12 @@ namespace Postr
          */
         virtual void handleError(const Data& data) = 0;
         
+        /**
+         * @brief Block until all chains started by this stream have handled their results.
+         * Derived streams call this in their destructor, before the members handleResult uses are destroyed.
+         */
+        void waitForTasks();
+        
         friend void operator<<(Worker::WorkerChain chain, Stream& stream);
         
     private:
@@ -0,0 +1,246 @@
+/**
+ * This file is part of Poster Safari.
+ *
+ *  Poster Safari is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Poster Safari is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with Poster Safari.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ * 
+ *  Copyright 2017 Moritz Dannehl, Rebecca Lühmann, Nicolas Marin, Michael Nieß, Julian Wolff
+ * 
+ */
+
+#include "workerloader.h"
+#include "ipc.h"
+#include "memorytracker.h"
+
+#include <signal.h>
+#include <unistd.h>
+
+#include <iostream>
+#include <thread>
+#include <chrono>
+#include <future>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+
+#include "argagg.hpp"
+
+#include "util.h"
+
+#undef LOG
+#define LOG(LEVEL) (CLOG(LEVEL, ELPP_CURR_FILE_LOGGER_ID) << "[WorkerHost " << getpid() << "] ")
+
+/**
+ * Hosts a shared object Worker for a ProcessWorker in another process.
+ * Documents arrive as messages on a socket, their images are read in place from the memory segment shared with the parent.
+ * The first half of the segment holds input images written by the parent, result images are written to the second half
+ * and released once the parent acknowledged the result.
+ */
+int main(int argc, char **argv)
+{
+    argagg::parser argparser {{
+        { "help", {"-h", "--help"},
+        "shows this help message", 0},
+        { "worker", {"-w", "--worker"},
+        "name of the worker to host", 1},
+        { "socket", {"-s", "--socket"},
+        "file descriptor of the socket connected to the parent process", 1},
+        { "memory", {"-m", "--memory"},
+        "file descriptor of the memory segment shared with the parent process", 1},
+        { "size", {"-S", "--size"},
+        "size of the shared memory segment in bytes", 1},
+        { "verbose", {"-v", "--verbose"},
+        "log to stdout (set to a value in range 1 (FATAL) to 6 (DEBUG) to specify the log level)", 1},
+    }};
+    
+    argagg::parser_results args;
+    try {
+        args = argparser.parse(argc, argv);
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    
+    if (args["help"] || !args["worker"] || !args["socket"] || !args["memory"] || !args["size"])
+    {
+        std::cout << "Usage: postr-workerhost [options]" << std::endl << "This program is started by postersafari to run workers in separate processes." << std::endl << argparser;
+        return args["help"] ? 0 : 1;
+    }
+    
+    Postr::Worker::initializeLog(args["verbose"].as<int>(2));
+    Postr::MemoryTracker::install();
+    Postr::Worker::interactive = false;
+    
+    //let the parent see the crash instead of trying to recover from it
+    for(int sig : {SIGSEGV, SIGABRT, SIGFPE, SIGILL, SIGBUS})
+        signal(sig, SIG_DFL);
+    //the parent handles SIGINT and closes the socket when it is done
+    signal(SIGINT, SIG_IGN);
+    
+    int socket = args["socket"].as<int>();
+    size_t size = args["size"].as<size_t>();
+    
+    Postr::IPC::SharedMemory memory;
+    if(!memory.attach(args["memory"].as<int>(), size))
+        return 1;
+    unsigned char *segment = memory.data();
+    
+    std::mutex sendmutex;
+    auto send = [&](const Postr::MetaData& message){
+        std::lock_guard<std::mutex> lk(sendmutex);
+        return Postr::IPC::send(socket, message);
+    };
+    
+    Postr::SharedWorkerPtr worker = Postr::WorkerLoader::loadWorker(args["worker"].as<std::string>());
+    if(!worker)
+    {
+        Postr::MetaData error;
+        error["type"] = "error";
+        error["reason"] = "cannot load worker " + args["worker"].as<std::string>();
+        send(error);
+        return 1;
+    }
+    
+    Postr::MetaData ready;
+    ready["type"] = "ready";
+    send(ready);
+    
+    Postr::IPC::Ring output(size/2, size - size/2);
+    std::deque<bool> unacknowledged; //whether the result waiting for an acknowledgement occupies the output ring
+    std::deque<Postr::MetaData> queue;
+    std::mutex mutex;
+    std::condition_variable condition;
+    bool closed = false;
+    
+    //processes one document at a time in the order they arrived
+    std::thread processor([&]{
+        while(true)
+        {
+            Postr::MetaData request;
+            {
+                std::unique_lock<std::mutex> lk(mutex);
+                condition.wait(lk, [&]{ return closed || !queue.empty(); });
+                if(queue.empty())
+                    return;
+                request = queue.front();
+                queue.pop_front();
+            }
+            
+            Postr::Data data;
+            data.meta = request["meta"];
+            for(const Postr::MetaData& handle : request["images"])
+                data.images.push_back(Postr::IPC::view(handle, segment, size/2));
+            
+            std::promise<std::pair<Postr::Data,int>> done;
+            std::future<std::pair<Postr::Data,int>> result = done.get_future();
+            auto start = std::chrono::steady_clock::now();
+            int status = worker->process(data, [&done](Postr::Data data, int status){
+                done.set_value(std::make_pair(data, status));
+            });
+            if(status == 0)
+            {
+                //report progress while the worker is busy
+                while(result.wait_for(std::chrono::milliseconds(200)) != std::future_status::ready)
+                {
+                    Postr::MetaData progress;
+                    progress["type"] = "progress";
+                    progress["value"] = worker->progress();
+                    send(progress);
+                }
+                std::pair<Postr::Data,int> processed = result.get();
+                data = processed.first;
+                status = processed.second;
+            }
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            
+            Postr::MetaData response;
+            response["type"] = "result";
+            response["id"] = request["id"];
+            response["status"] = status;
+            response["seconds"] = seconds;
+            response["meta"] = data.meta;
+            response["images"] = Json::Value(Json::arrayValue);
+            
+            //input images and regions of them are passed back by handle, new images are copied to the output ring
+            size_t bytes = 0;
+            for(const Postr::ImageData& image : data.images)
+            {
+                if(!image.empty() && (image.data < segment || image.data >= segment + size/2))
+                    bytes += (Postr::IPC::imageSize(image) + 63) / 64 * 64;
+            }
+            long region = -1;
+            if(bytes > 0)
+            {
+                std::unique_lock<std::mutex> lk(mutex);
+                if(output.fits(bytes))
+                    condition.wait(lk, [&]{ return closed || (region = output.allocate(bytes)) >= 0; });
+                if(region < 0)
+                {
+                    LOG(ERROR) << "result images of " << bytes << " bytes don't fit into shared memory";
+                    response["status"] = 1;
+                }
+            }
+            
+            size_t offset = region;
+            for(const Postr::ImageData& image : data.images)
+            {
+                if(image.empty())
+                    response["images"].append(Json::Value());
+                else if(image.data >= segment && image.data < segment + size/2)
+                    response["images"].append(Postr::IPC::handle(image, segment));
+                else if(region >= 0)
+                {
+                    response["images"].append(Postr::IPC::store(image, segment, offset));
+                    offset += (Postr::IPC::imageSize(image) + 63) / 64 * 64;
+                }
+                else
+                    response["images"].append(Json::Value());
+            }
+            
+            {
+                std::lock_guard<std::mutex> lk(mutex);
+                unacknowledged.push_back(region >= 0);
+            }
+            
+            if(!send(response))
+                return;
+        }
+    });
+    
+    Postr::MetaData message;
+    while(Postr::IPC::receive(socket, message))
+    {
+        std::string type = message["type"].asString();
+        std::lock_guard<std::mutex> lk(mutex);
+        if(type == "process")
+            queue.push_back(message);
+        else if(type == "ack" && !unacknowledged.empty())
+        {
+            if(unacknowledged.front())
+                output.release();
+            unacknowledged.pop_front();
+        }
+        condition.notify_all();
+    }
+    
+    LOG(DEBUG) << "connection closed";
+    {
+        std::lock_guard<std::mutex> lk(mutex);
+        closed = true;
+        condition.notify_all();
+    }
+    processor.join();
+    
+    return 0;
+}
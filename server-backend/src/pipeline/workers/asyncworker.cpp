@@ -20,6 +20,9 @@
  */
 
 #include "asyncworker.h"
+#include "metrics.h"
+#include "tracer.h"
+#include "memorytracker.h"
 
 #undef LOG
 #define LOG(LEVEL) (CLOG(LEVEL, ELPP_CURR_FILE_LOGGER_ID) << "[" << m_name << "] ")
@@ -29,8 +32,12 @@ namespace Postr
     AsyncWorker::AsyncWorker(const char *name)
         : Worker(name)
         , m_cancel(false)
+        , m_helpercpu(0)
+        , m_helpervoluntary(0)
+        , m_helperinvoluntary(0)
         , m_initialized(false)
         , m_progress(0)
+        , m_memory(nullptr)
     {
         m_initialized = false;
         LOG(DEBUG) << "calling _init()";
@@ -58,11 +65,16 @@ namespace Postr
     
     int AsyncWorker::process(Data data, WorkerCallback& callback)
     {
+        auto queued = std::chrono::steady_clock::now();
         std::unique_lock<std::mutex> lk(m_progressmutex);
         //wait for previously started tasks to finish
         m_startprocesscondition.wait(lk, [this]{
             return (0 == m_progress);
         });
+        auto started = std::chrono::steady_clock::now();
+        metrics().queueWait.observe(std::chrono::duration<double>(started - queued).count());
+        if(Tracer::enabled())
+            Tracer::complete("wait", m_name, Tracer::documentId(data.meta), queued, started);
         
         m_status = 0;
         
@@ -75,8 +87,6 @@ namespace Postr
         
         lk.unlock();
         
-        m_progresscondition.notify_all();
-        
         m_thread = std::thread(&AsyncWorker::_process, this, data, callback);
         
         m_thread.detach();
@@ -91,7 +101,37 @@ namespace Postr
         LOG(DEBUG) << m_name << " start processing";
         
         if(!m_abort && !m_cancel)
+        {
+            Tracer::Span span("process", m_name, Tracer::enabled() ? Tracer::documentId(data.meta) : "");
+            MemoryTracker::Scope memory(metrics());
+            m_memory = &memory;
+            m_helpercpu = 0;
+            m_helpervoluntary = 0;
+            m_helperinvoluntary = 0;
+            ThreadUsage before = ThreadUsage::now();
+            auto start = std::chrono::steady_clock::now();
             processAsync(data);
+            m_memory = nullptr;
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            ThreadUsage usage = ThreadUsage::now() - before;
+            //blocked time is that of the processing thread, helper threads only add their CPU time
+            double blocked = std::max(0., seconds - usage.cpu);
+            usage.cpu += m_helpercpu/1e6;
+            usage.voluntary += m_helpervoluntary;
+            usage.involuntary += m_helperinvoluntary;
+            metrics().processing.observe(seconds);
+            metrics().observeUsage(usage, blocked);
+            
+            MetaData& memoryUsage = data.meta["result"]["memory"][m_name];
+            memoryUsage["peak"] = (Json::Int64)memory.peak();
+            memoryUsage["document"] = (Json::UInt64)data.memoryUsage();
+            
+            MetaData& cpuUsage = data.meta["result"]["cpu"][m_name];
+            cpuUsage["seconds"] = usage.cpu;
+            cpuUsage["blocked"] = blocked;
+            cpuUsage["voluntarySwitches"] = (Json::Int64)usage.voluntary;
+            cpuUsage["involuntarySwitches"] = (Json::Int64)usage.involuntary;
+        }
         
         LOG(DEBUG) << m_name << " done";
         
@@ -119,12 +159,22 @@ namespace Postr
         m_initthread.detach();
     }
     
+    void AsyncWorker::chargeThread(const ThreadUsage& usage)
+    {
+        m_helpercpu.fetch_add(static_cast<uint64_t>(std::max(0., usage.cpu)*1e6), std::memory_order_relaxed);
+        m_helpervoluntary.fetch_add(usage.voluntary, std::memory_order_relaxed);
+        m_helperinvoluntary.fetch_add(usage.involuntary, std::memory_order_relaxed);
+    }
+    
+    const MemoryTracker::Scope& AsyncWorker::documentMemory() const
+    {
+        return *m_memory;
+    }
+    
     void AsyncWorker::progress(float progress)
     {
-        std::lock_guard<std::mutex> lk(m_progressmutex);
+        //progress is sampled by the progress observer, nobody needs to be notified
         m_progress = 100*progress;
-        //notify others that progress has changed
-        m_progresscondition.notify_all();
     }
     
     float AsyncWorker::progress() const
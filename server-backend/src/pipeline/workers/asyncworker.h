@@ -23,12 +23,15 @@
 #define ASYNCWORKER_H
 
 #include "worker.h"
+#include "memorytracker.h"
 
 #include <thread>
 #include <atomic>
 
 namespace Postr 
 {
+    struct ThreadUsage;
+    
     /**
      * @brief Base class for Workers which process data asynchronously
      */ 
@@ -62,11 +65,28 @@ namespace Postr
          */
         void progress(float progress);
         
+        /**
+         * Charge the CPU time and context switches of a helper thread started by processAsync to the current document.
+         * Call this from the helper thread before processAsync returns.
+         * @param usage resources used by the helper thread, i.e. ThreadUsage::now() minus ThreadUsage::now() when it started
+         */
+        void chargeThread(const ThreadUsage& usage);
+        
+        /**
+         * The memory scope of the current document. Helper threads started by processAsync open a MemoryTracker::Scope
+         * sharing it, so their images are attributed to this stage and included in the peak memory of the document.
+         * @return the scope of the document being processed, only valid during processAsync
+         */
+        const MemoryTracker::Scope& documentMemory() const;
+        
         std::atomic_bool m_cancel;
         
     private:
+        std::atomic<uint64_t> m_helpercpu;     ///< microseconds
+        std::atomic<int64_t> m_helpervoluntary, m_helperinvoluntary;
         std::atomic_bool m_initialized;
         std::atomic_int m_progress;
+        const MemoryTracker::Scope *m_memory;
         std::thread m_thread,m_initthread;
         void _process(Data data, WorkerCallback callback);
         void _init();
@@ -33,6 +33,7 @@ namespace Postr
 {
     _WORKER_CLASS_::_WORKER_CLASS_()
         : AsyncWorker(_WORKER_NAME_)
+        , m_settings(*this, &_WORKER_CLASS_::readSettings)
     {
     }
     
@@ -103,8 +104,22 @@ namespace Postr
         return bestpoint;
     }
     
+    void _WORKER_CLASS_::readSettings(const Worker& worker, Settings& settings)
+    {
+        settings.lowThreshold = worker.config("backgroundsegmentation_lowThresh", 120, "low threshold value used by the Canny filter");
+        settings.highThreshold = worker.config("backgroundsegmentation_highThresh", 400, "high threshold value used by the Canny filter");
+        settings.maxIntersections = worker.config("backgroundsegmentation_maxIntersections", 300, "maximum number of intersection points");
+        settings.dirDiff = worker.config("backgroundsegmentation_dirDiff", .08, "allowed difference in direction of a detected line to a existing line");
+        settings.maxDist = worker.config("backgroundsegmentation_maxDist", 0.01, "allowed distance that intersection points outside the image may have from the borders of the image, relative to image size");
+        settings.minSize = worker.config("backgroundsegmentation_minSize", .2, "minimum size of the detected area, relative to image size");
+        settings.maxSize = worker.config("backgroundsegmentation_maxSize", 1., "maximum size of the detected area, relative to image size");
+        settings.kernelSize = worker.config("backgroundsegmentation_kernelsize", 3, "kernel size used by the Canny filter");
+        settings.maxRuns = worker.config("backgroundsegmentation_maxRuns", 50, "maximum number of runs");
+    }
+    
     void _WORKER_CLASS_::processAsync(Data& data)
     {
+        std::shared_ptr<const Settings> settings = m_settings.get();
         
         ImageData src;
         
@@ -114,20 +129,14 @@ namespace Postr
             LOG(ERROR) << "there is no image to segment";                    
         }
         
-        config("filename");
-        
         cv::Mat dst, src_gray, detected_edges;
-        int lowThreshold = config("backgroundsegmentation_lowThresh", 120, "low threshold value used by the Canny filter");
-        int highThreshold = config("backgroundsegmentation_highThresh", 400, "high threshold value used by the Canny filter");
-        
-        int maxintersections = config("backgroundsegmentation_maxIntersections", 300, "maximum number of intersection points");
-        
-        double dirDiff = config("backgroundsegmentation_dirDiff", .08, "allowed difference in direction of a detected line to a existing line");
-        
-        double maxDist = config("backgroundsegmentation_maxDist", 0.01, "allowed distance that intersection points outside the image may have from the borders of the image, relative to image size");
-        
-        double minSize = config("backgroundsegmentation_minSize", .2, "minimum size of the detected area, relative to image size");
-        double maxSize = config("backgroundsegmentation_maxSize", 1., "maximum size of the detected area, relative to image size");
+        int lowThreshold = settings->lowThreshold;
+        int highThreshold = settings->highThreshold;
+        int maxintersections = settings->maxIntersections;
+        double dirDiff = settings->dirDiff;
+        double maxDist = settings->maxDist;
+        double minSize = settings->minSize;
+        double maxSize = settings->maxSize;
         
         // Define the destination image  
         cv::Mat quad;
@@ -136,10 +145,10 @@ namespace Postr
         {
             m_status = 1;
         
-            int kernel_size = config("backgroundsegmentation_kernelsize", 3, "kernel size used by the Canny filter");
+            int kernel_size = settings->kernelSize;
             int maxdim;
             
-            int maxruns = config("backgroundsegmentation_maxRuns", 50, "maximum number of runs");
+            int maxruns = settings->maxRuns;
             int runs = 0;
             
             int maxblur = 410;
@@ -23,6 +23,7 @@
 #define BGSEGMENTWORKER_H
 
 #include "asyncworker.h"
+#include "configsnapshot.h"
 
 #include <thread>
 #include <atomic>
@@ -49,7 +50,24 @@ namespace Postr
         ~_WORKER_CLASS_();
     
     private:        
+        /**
+         * @brief Config entries read for every document
+         */
+        struct Settings
+        {
+            int lowThreshold;
+            int highThreshold;
+            int maxIntersections;
+            double dirDiff;
+            double maxDist;
+            double minSize;
+            double maxSize;
+            int kernelSize;
+            int maxRuns;
+        };
+        
         void processAsync(Data& data) override;
+        static void readSettings(const Worker& worker, Settings& settings);
         /**
          * @brief compute the intersection point of two lines.
          * @param a one line 
@@ -108,6 +126,8 @@ namespace Postr
          * @return the intersection point that is nearest to p
          */
         static cv::Point2f findIntersectionPointNear(const cv::Point2f& p, const std::vector<cv::Vec4i>& lines);
+        
+        ConfigSnapshot<Settings> m_settings;
     };
 };
 
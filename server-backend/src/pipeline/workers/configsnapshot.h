@@ -0,0 +1,87 @@
+/**
+ * This file is part of Poster Safari.
+ *
+ *  Poster Safari is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Poster Safari is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with Poster Safari.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ * 
+ *  Copyright 2017 Moritz Dannehl, Rebecca Lühmann, Nicolas Marin, Michael Nieß, Julian Wolff
+ * 
+ */
+
+#ifndef CONFIGSNAPSHOT_H
+#define CONFIGSNAPSHOT_H
+
+#include "worker.h"
+
+#include <memory>
+#include <functional>
+
+namespace Postr 
+{
+    /**
+     * @brief Immutable, typed copy of the config entries used by a Worker.
+     * The entries are read with Worker::config into a struct once and again only after the config file has been reloaded.
+     * Reading a snapshot neither locks the config mutex nor looks up JSON values, so it is cheap enough for every document.
+     * A snapshot returned by get() never changes, a reload replaces it with a new one.
+     * @tparam T struct holding the config entries
+     */
+    template<class T>
+    class ConfigSnapshot
+    {
+    public:
+        typedef std::function<void(const Worker& worker, T& config)> Reader;
+        
+        /**
+         * @param worker the Worker whose config entries are read
+         * @param reader function reading all entries of T with worker.config
+         */
+        ConfigSnapshot(const Worker& worker, Reader reader)
+            : m_worker(worker)
+            , m_reader(reader)
+            , m_generation(-1)
+        {
+        }
+        
+        /**
+         * @brief The current snapshot. Keep the returned pointer while processing a document to see consistent values.
+         */
+        std::shared_ptr<const T> get() const
+        {
+            int generation = Worker::configGeneration();
+            if(generation != m_generation)
+            {
+                std::lock_guard<std::mutex> lk(m_readmutex);
+                if(generation != m_generation)
+                {
+                    std::shared_ptr<T> config = std::make_shared<T>();
+                    m_reader(m_worker, *config);
+                    std::atomic_store(&m_snapshot, std::shared_ptr<const T>(config));
+                    m_generation = generation;
+                }
+            }
+            return std::atomic_load(&m_snapshot);
+        }
+        
+    private:
+        const Worker& m_worker;
+        Reader m_reader;
+        mutable std::shared_ptr<const T> m_snapshot;
+        mutable std::atomic_int m_generation;
+        mutable std::mutex m_readmutex;
+        
+        ConfigSnapshot(const ConfigSnapshot&) = delete;
+    };
+}
+
+#endif //CONFIGSNAPSHOT_H
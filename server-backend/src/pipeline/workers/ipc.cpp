@@ -0,0 +1,315 @@
+/**
+ * This file is part of Poster Safari.
+ *
+ *  Poster Safari is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Poster Safari is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with Poster Safari.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ * 
+ *  Copyright 2017 Moritz Dannehl, Rebecca Lühmann, Nicolas Marin, Michael Nieß, Julian Wolff
+ * 
+ */
+
+#include "ipc.h"
+
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+
+#include <atomic>
+#include <cstdint>
+#include <sstream>
+
+#undef LOG
+#define LOG(LEVEL) (CLOG(LEVEL, ELPP_CURR_FILE_LOGGER_ID) << "[IPC] ")
+
+namespace Postr
+{
+    namespace IPC
+    {
+        //regions start at cache line boundaries
+        static const size_t alignment = 64;
+        
+        //refuse messages that can't be metadata of a single document
+        static const uint32_t maxMessageSize = 256*1024*1024;
+        
+        SharedMemory::SharedMemory()
+            : m_fd(-1)
+            , m_size(0)
+            , m_data(nullptr)
+        {
+        }
+        
+        SharedMemory::~SharedMemory()
+        {
+            release();
+        }
+        
+        bool SharedMemory::create(size_t size)
+        {
+            release();
+            
+            static std::atomic_int counter(0);
+            std::stringstream name;
+            name << "/postr-" << getpid() << "-" << counter++;
+            
+            int fd = shm_open(name.str().c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+            if(fd < 0)
+            {
+                LOG(ERROR) << "cannot create shared memory: " << strerror(errno);
+                return false;
+            }
+            //the segment lives on as long as a process has it open or mapped
+            shm_unlink(name.str().c_str());
+            
+            if(ftruncate(fd, size) != 0)
+            {
+                LOG(ERROR) << "cannot resize shared memory to " << size << " bytes: " << strerror(errno);
+                close(fd);
+                return false;
+            }
+            
+            return attach(fd, size);
+        }
+        
+        bool SharedMemory::attach(int fd, size_t size)
+        {
+            if(fd != m_fd)
+                release();
+            
+            void *data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if(data == MAP_FAILED)
+            {
+                LOG(ERROR) << "cannot map shared memory: " << strerror(errno);
+                close(fd);
+                return false;
+            }
+            
+            m_fd = fd;
+            m_size = size;
+            m_data = static_cast<unsigned char*>(data);
+            return true;
+        }
+        
+        void SharedMemory::release()
+        {
+            if(m_data)
+                munmap(m_data, m_size);
+            if(m_fd >= 0)
+                close(m_fd);
+            m_fd = -1;
+            m_size = 0;
+            m_data = nullptr;
+        }
+        
+        int SharedMemory::fd() const
+        {
+            return m_fd;
+        }
+        
+        size_t SharedMemory::size() const
+        {
+            return m_size;
+        }
+        
+        unsigned char *SharedMemory::data() const
+        {
+            return m_data;
+        }
+        
+        Ring::Ring(size_t offset, size_t size)
+            : m_offset(offset)
+            , m_size(size)
+            , m_head(0)
+        {
+        }
+        
+        long Ring::allocate(size_t bytes)
+        {
+            bytes = (bytes + alignment - 1) / alignment * alignment;
+            if(bytes == 0)
+                bytes = alignment;
+            
+            if(m_allocated.empty())
+                m_head = 0;
+            
+            size_t start;
+            if(m_allocated.empty() || m_head > m_allocated.front().first)
+            {
+                //free space behind the head and in front of the oldest region
+                size_t tail = m_allocated.empty() ? 0 : m_allocated.front().first;
+                if(m_head + bytes <= m_size)
+                    start = m_head;
+                else if(bytes < tail)
+                    start = 0;
+                else
+                    return -1;
+            }
+            else
+            {
+                //wrapped around, free space is between head and the oldest region
+                if(m_head + bytes < m_allocated.front().first)
+                    start = m_head;
+                else
+                    return -1;
+            }
+            
+            m_allocated.push_back(std::make_pair(start, bytes));
+            m_head = start + bytes;
+            return m_offset + start;
+        }
+        
+        void Ring::release()
+        {
+            if(!m_allocated.empty())
+                m_allocated.pop_front();
+        }
+        
+        void Ring::clear()
+        {
+            m_allocated.clear();
+            m_head = 0;
+        }
+        
+        bool Ring::fits(size_t bytes) const
+        {
+            return (bytes + alignment - 1) / alignment * alignment <= m_size;
+        }
+        
+        size_t Ring::allocations() const
+        {
+            return m_allocated.size();
+        }
+        
+        size_t imageSize(const ImageData& image)
+        {
+            return image.empty() ? 0 : image.total()*image.elemSize();
+        }
+        
+        MetaData store(const ImageData& image, unsigned char *segment, size_t offset)
+        {
+            MetaData result;
+            if(image.empty())
+                return result;
+            
+            //images are stored continuous, regions of larger images are compacted
+            cv::Mat target(image.rows, image.cols, image.type(), segment + offset);
+            image.copyTo(target);
+            
+            return handle(ImageData(target), segment);
+        }
+        
+        MetaData handle(const ImageData& image, const unsigned char *segment)
+        {
+            MetaData result;
+            if(image.empty())
+                return result;
+            
+            result["offset"] = (Json::UInt64)(image.data - segment);
+            result["rows"] = image.rows;
+            result["cols"] = image.cols;
+            result["type"] = image.type();
+            result["step"] = (Json::UInt64)image.step[0];
+            return result;
+        }
+        
+        ImageData view(const MetaData& handle, unsigned char *segment, size_t size)
+        {
+            if(!handle.isObject())
+                return ImageData();
+            
+            size_t offset = handle["offset"].asUInt64();
+            size_t step = handle["step"].asUInt64();
+            int rows = handle["rows"].asInt();
+            int cols = handle["cols"].asInt();
+            int type = handle["type"].asInt();
+            
+            if(rows <= 0 || cols <= 0 || step < cols*CV_ELEM_SIZE(type) || offset + step*(rows-1) + cols*CV_ELEM_SIZE(type) > size)
+            {
+                LOG(ERROR) << "invalid image handle " << handle;
+                return ImageData();
+            }
+            return ImageData(cv::Mat(rows, cols, type, segment + offset, step));
+        }
+        
+        static bool writeAll(int fd, const char *data, size_t length)
+        {
+            while(length > 0)
+            {
+                ssize_t written = ::send(fd, data, length, MSG_NOSIGNAL);
+                if(written < 0 && errno == EINTR)
+                    continue;
+                if(written <= 0)
+                    return false;
+                data += written;
+                length -= written;
+            }
+            return true;
+        }
+        
+        static bool readAll(int fd, char *data, size_t length)
+        {
+            while(length > 0)
+            {
+                ssize_t received = ::recv(fd, data, length, 0);
+                if(received < 0 && errno == EINTR)
+                    continue;
+                if(received <= 0)
+                    return false;
+                data += received;
+                length -= received;
+            }
+            return true;
+        }
+        
+        bool send(int fd, const MetaData& message)
+        {
+            Json::FastWriter writer;
+            std::string body = writer.write(message);
+            uint32_t length = body.size();
+            
+            //header and body in a single buffer to save a system call
+            std::string packet(reinterpret_cast<const char*>(&length), sizeof(length));
+            packet += body;
+            return writeAll(fd, packet.data(), packet.size());
+        }
+        
+        bool receive(int fd, MetaData& message)
+        {
+            uint32_t length;
+            if(!readAll(fd, reinterpret_cast<char*>(&length), sizeof(length)))
+                return false;
+            if(length > maxMessageSize)
+            {
+                LOG(ERROR) << "message of " << length << " bytes exceeds limit";
+                return false;
+            }
+            
+            std::string body(length, '\0');
+            if(!readAll(fd, &body[0], length))
+                return false;
+            
+            Json::Reader reader;
+            message = MetaData();
+            if(!reader.parse(body, message))
+            {
+                LOG(ERROR) << "failed parsing message " << body.substr(0, 256);
+                return false;
+            }
+            return true;
+        }
+    }
+}
@@ -0,0 +1,173 @@
+/**
+ * This file is part of Poster Safari.
+ *
+ *  Poster Safari is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Poster Safari is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with Poster Safari.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ * 
+ *  Copyright 2017 Moritz Dannehl, Rebecca Lühmann, Nicolas Marin, Michael Nieß, Julian Wolff
+ * 
+ */
+
+#ifndef IPC_H
+#define IPC_H
+
+#include "postrdata.h"
+
+#include <deque>
+#include <utility>
+
+namespace Postr
+{
+    /**
+     * @brief Building blocks for exchanging Data with worker processes.
+     * Metadata is sent as length prefixed JSON messages over a socket, images are placed in shared memory and passed by handle.
+     */
+    namespace IPC
+    {
+        /**
+         * @brief A memory segment that can be mapped by a child process.
+         * The segment has no name in the file system, it is shared by passing its file descriptor to the child.
+         */
+        class SharedMemory
+        {
+        public:
+            SharedMemory();
+            ~SharedMemory();
+            
+            /**
+             * @brief Create and map a new segment
+             * @param size size of the segment in bytes
+             * @return true on success
+             */
+            bool create(size_t size);
+            
+            /**
+             * @brief Map a segment created by another process
+             * @param fd file descriptor of the segment
+             * @param size size of the segment in bytes
+             * @return true on success
+             */
+            bool attach(int fd, size_t size);
+            
+            /**
+             * @brief Unmap the segment and close its file descriptor
+             */
+            void release();
+            
+            int fd() const;
+            size_t size() const;
+            unsigned char *data() const;
+            
+        private:
+            int m_fd;
+            size_t m_size;
+            unsigned char *m_data;
+            
+            SharedMemory(const SharedMemory&) = delete;
+        };
+        
+        /**
+         * @brief Hands out regions of a buffer in a circular fashion.
+         * Regions must be released in the order they have been allocated. Only the owner of a ring allocates from it.
+         */
+        class Ring
+        {
+        public:
+            /**
+             * @param offset first byte of the ring within its segment
+             * @param size size of the ring in bytes
+             */
+            Ring(size_t offset = 0, size_t size = 0);
+            
+            /**
+             * @brief Allocate a region
+             * @param bytes size of the region
+             * @return offset of the region within the segment or -1 if the ring is too full at the moment
+             */
+            long allocate(size_t bytes);
+            
+            /**
+             * @brief Release the oldest allocated region
+             */
+            void release();
+            
+            /**
+             * @brief Release all regions
+             */
+            void clear();
+            
+            /**
+             * @brief Check whether a region of the given size fits into the empty ring
+             */
+            bool fits(size_t bytes) const;
+            
+            /**
+             * @brief Number of allocated regions
+             */
+            size_t allocations() const;
+            
+        private:
+            size_t m_offset;
+            size_t m_size;
+            size_t m_head;
+            std::deque<std::pair<size_t,size_t>> m_allocated;
+        };
+        
+        /**
+         * @brief Number of bytes an image occupies in shared memory
+         */
+        size_t imageSize(const ImageData& image);
+        
+        /**
+         * @brief Copy an image to shared memory
+         * @param image the image to copy
+         * @param segment first byte of the segment
+         * @param offset offset of a region of at least imageSize(image) bytes
+         * @return a handle describing the image
+         */
+        MetaData store(const ImageData& image, unsigned char *segment, size_t offset);
+        
+        /**
+         * @brief Describe an image that already lies in shared memory
+         * @param image an image whose buffer lies within the segment
+         * @param segment first byte of the segment
+         * @return a handle describing the image
+         */
+        MetaData handle(const ImageData& image, const unsigned char *segment);
+        
+        /**
+         * @brief Create an image header for a handle without copying the image
+         * @param handle a handle returned by store or handle
+         * @param segment first byte of the segment
+         * @param size size of the segment, handles pointing outside of it yield an empty image
+         */
+        ImageData view(const MetaData& handle, unsigned char *segment, size_t size);
+        
+        /**
+         * @brief Send a message
+         * @param fd a connected stream socket
+         * @return false if the connection is broken
+         */
+        bool send(int fd, const MetaData& message);
+        
+        /**
+         * @brief Receive a message. Blocks until a complete message arrived.
+         * @param fd a connected stream socket
+         * @return false if the connection is closed or broken
+         */
+        bool receive(int fd, MetaData& message);
+    }
+}
+
+#endif //IPC_H
@@ -0,0 +1,187 @@
+/**
+ * This file is part of Poster Safari.
+ *
+ *  Poster Safari is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Poster Safari is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with Poster Safari.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ * 
+ *  Copyright 2017 Moritz Dannehl, Rebecca Lühmann, Nicolas Marin, Michael Nieß, Julian Wolff
+ * 
+ */
+
+#include "logsink.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+
+namespace Postr 
+{
+#ifndef WORKER_LIBRARY
+    std::vector<std::string> LogSink::m_buffer;
+    size_t LogSink::m_head = 0;
+    size_t LogSink::m_size = 0;
+    size_t LogSink::m_dropped = 0;
+    size_t LogSink::m_written = 0;
+    bool LogSink::m_running = false;
+    bool LogSink::m_writing = false;
+    std::string LogSink::m_filename;
+    size_t LogSink::m_maxFileSize = 0;
+    std::atomic_int LogSink::m_level(4);
+    std::mutex LogSink::m_mutex;
+    std::condition_variable LogSink::m_condition;
+    std::condition_variable LogSink::m_flushcondition;
+    std::thread LogSink::m_thread;
+#endif
+    
+    void LogSink::start(const std::string& filename, size_t maxFileSize)
+    {
+        std::lock_guard<std::mutex> lk(m_mutex);
+        if(m_running)
+            return;
+        
+        m_filename = filename;
+        m_maxFileSize = maxFileSize;
+        m_buffer.resize(Capacity);
+        m_head = 0;
+        m_size = 0;
+        m_running = true;
+        m_thread = std::thread(&LogSink::write);
+        std::atexit(&LogSink::stop);
+    }
+    
+    void LogSink::setLevel(int level)
+    {
+        m_level = level;
+    }
+    
+    int LogSink::level()
+    {
+        return m_level;
+    }
+    
+    int LogSink::rank(el::Level level)
+    {
+        switch(level)
+        {
+            case el::Level::Fatal: return 1;
+            case el::Level::Error: return 2;
+            case el::Level::Warning: return 3;
+            case el::Level::Info: return 4;
+            case el::Level::Verbose: return 5;
+            default: return 6;
+        }
+    }
+    
+    void LogSink::handle(const el::LogDispatchData* data)
+    {
+        const el::LogMessage* message = data->logMessage();
+        if(data->dispatchAction() != el::base::DispatchAction::NormalLog || rank(message->level()) > m_level)
+            return;
+        
+        std::string line = message->logger()->logBuilder()->build(message, true);
+        
+        {
+            std::lock_guard<std::mutex> lk(m_mutex);
+            if(!m_running)
+                return;
+            if(m_size == Capacity)
+            {
+                ++m_dropped;
+                return;
+            }
+            m_buffer[(m_head + m_size) % Capacity].swap(line);
+            ++m_size;
+        }
+        m_condition.notify_one();
+        
+        //the process is about to abort
+        if(message->level() == el::Level::Fatal)
+            flush();
+    }
+    
+    void LogSink::flush()
+    {
+        std::unique_lock<std::mutex> lk(m_mutex);
+        m_flushcondition.wait_for(lk, std::chrono::seconds(1), []{
+            return !m_running || (m_size == 0 && !m_writing);
+        });
+    }
+    
+    void LogSink::stop()
+    {
+        {
+            std::lock_guard<std::mutex> lk(m_mutex);
+            if(!m_running)
+                return;
+            m_running = false;
+        }
+        m_condition.notify_all();
+        if(m_thread.joinable())
+            m_thread.join();
+    }
+    
+    void LogSink::write()
+    {
+        std::FILE *file = std::fopen(m_filename.c_str(), "a");
+        if(file)
+            m_written = std::ftell(file);
+        
+        std::vector<std::string> lines;
+        std::unique_lock<std::mutex> lk(m_mutex);
+        while(true)
+        {
+            m_condition.wait(lk, []{ return m_size > 0 || !m_running; });
+            if(m_size == 0 && !m_running)
+                break;
+            
+            //take all buffered messages and write them without holding the lock
+            lines.clear();
+            for(; m_size > 0; --m_size, m_head = (m_head+1) % Capacity)
+                lines.push_back(std::move(m_buffer[m_head]));
+            if(m_dropped > 0)
+            {
+                lines.push_back("dropped " + std::to_string(m_dropped) + " log messages because the log file could not be written fast enough\n");
+                m_dropped = 0;
+            }
+            m_writing = true;
+            lk.unlock();
+            
+            for(const std::string& line : lines)
+            {
+                if(!file)
+                    break;
+                std::fwrite(line.data(), 1, line.size(), file);
+                m_written += line.size();
+                if(m_maxFileSize > 0 && m_written >= m_maxFileSize)
+                {
+                    //keep the previous file, like logrotate with a single generation
+                    std::fclose(file);
+                    std::rename(m_filename.c_str(), (m_filename + ".1").c_str());
+                    file = std::fopen(m_filename.c_str(), "w");
+                    m_written = 0;
+                }
+            }
+            if(file)
+                std::fflush(file);
+            
+            lk.lock();
+            m_writing = false;
+            m_flushcondition.notify_all();
+        }
+        
+        if(file)
+            std::fclose(file);
+        m_flushcondition.notify_all();
+    }
+}
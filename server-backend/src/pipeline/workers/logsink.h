@@ -0,0 +1,105 @@
+/**
+ * This file is part of Poster Safari.
+ *
+ *  Poster Safari is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Poster Safari is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with Poster Safari.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ * 
+ *  Copyright 2017 Moritz Dannehl, Rebecca Lühmann, Nicolas Marin, Michael Nieß, Julian Wolff
+ * 
+ */
+
+#ifndef LOGSINK_H
+#define LOGSINK_H
+
+#include "easylogging++.h"
+
+#include <atomic>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+
+namespace Postr 
+{
+    /**
+     * @brief Writes log messages to the log file from a background thread.
+     * Logging threads only format the message and put it into a ring buffer, they never wait for the file system.
+     * If the buffer is full, messages are dropped and the number of dropped messages is logged later.
+     * Fatal messages are written before the logging thread continues.
+     */
+    class LogSink : public el::LogDispatchCallback
+    {
+    public:
+        /**
+         * @brief Number of messages the ring buffer holds
+         */
+        static const size_t Capacity = 8192;
+        
+        /**
+         * @brief Start the background writer. Calling this again has no effect.
+         * @param filename log file to append to
+         * @param maxFileSize size in bytes after which the log file is moved to filename.1 and a new file is started
+         */
+        static void start(const std::string& filename, size_t maxFileSize);
+        
+        /**
+         * @brief Set the most verbose level written to the log file
+         * @param level level in range 1 (FATAL) to 6 (DEBUG)
+         */
+        static void setLevel(int level);
+        
+        /**
+         * @brief Most verbose level written to the log file in range 1 (FATAL) to 6 (DEBUG)
+         */
+        static int level();
+        
+        /**
+         * @brief Block until all buffered messages have been written or a second passed
+         */
+        static void flush();
+        
+        /**
+         * @brief Write all buffered messages and stop the background writer
+         */
+        static void stop();
+        
+        /**
+         * @brief Convert an easylogging++ level to a level in range 1 (FATAL) to 6 (DEBUG)
+         */
+        static int rank(el::Level level);
+        
+    private:
+        void handle(const el::LogDispatchData* data) override;
+        
+        static void write();
+        
+        static std::vector<std::string> m_buffer;
+        static size_t m_head;
+        static size_t m_size;
+        static size_t m_dropped;
+        static size_t m_written;
+        static bool m_running;
+        static bool m_writing;
+        static std::string m_filename;
+        static size_t m_maxFileSize;
+        static std::atomic_int m_level;
+        static std::mutex m_mutex;
+        static std::condition_variable m_condition;
+        static std::condition_variable m_flushcondition;
+        static std::thread m_thread;
+    };
+}
+
+#endif //LOGSINK_H
@@ -0,0 +1,159 @@
+/**
+ * This file is part of Poster Safari.
+ *
+ *  Poster Safari is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Poster Safari is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with Poster Safari.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ * 
+ *  Copyright 2017 Moritz Dannehl, Rebecca Lühmann, Nicolas Marin, Michael Nieß, Julian Wolff
+ * 
+ */
+
+#include "memorytracker.h"
+#include "metrics.h"
+
+#include <opencv2/core.hpp>
+
+#include <fstream>
+#include <algorithm>
+#include <unistd.h>
+
+namespace Postr 
+{
+#if CV_VERSION_MAJOR >= 4
+    typedef cv::AccessFlag AccessFlags;
+#else
+    typedef int AccessFlags;
+#endif
+    
+    /**
+     * @brief Allocates cv::Mat buffers with the standard allocator and counts their bytes
+     */
+    class MemoryTracker::CountingAllocator : public cv::MatAllocator
+    {
+    public:
+        cv::UMatData* allocate(int dims, const int* sizes, int type, void* data, size_t* step, AccessFlags flags, cv::UMatUsageFlags usageFlags) const override
+        {
+            cv::UMatData* u = cv::Mat::getStdAllocator()->allocate(dims, sizes, type, data, step, flags, usageFlags);
+            if(u)
+            {
+                //route unmap and deallocate of this buffer back to this allocator
+                u->prevAllocator = u->currAllocator = this;
+                u->userdata = t_stage;
+                MemoryTracker::allocated(t_stage, u->size);
+            }
+            return u;
+        }
+        
+        bool allocate(cv::UMatData* data, AccessFlags accessflags, cv::UMatUsageFlags usageFlags) const override
+        {
+            return cv::Mat::getStdAllocator()->allocate(data, accessflags, usageFlags);
+        }
+        
+        void deallocate(cv::UMatData* u) const override
+        {
+            if(!u)
+                return;
+            MemoryTracker::freed(static_cast<StageMetrics*>(u->userdata), u->size);
+            u->userdata = nullptr;
+            cv::Mat::getStdAllocator()->deallocate(u);
+        }
+    };
+    
+#ifndef WORKER_LIBRARY
+    std::atomic<int64_t> MemoryTracker::m_allocated(0);
+    std::atomic<int64_t> MemoryTracker::m_peak(0);
+    thread_local StageMetrics *MemoryTracker::t_stage = nullptr;
+    thread_local MemoryTracker::Usage *MemoryTracker::t_usage = nullptr;
+#endif
+    
+    MemoryTracker::Scope::Scope(StageMetrics& stage)
+        : m_previousStage(t_stage)
+        , m_previousUsage(t_usage)
+        , m_usage(&m_ownUsage)
+    {
+        t_stage = &stage;
+        t_usage = m_usage;
+    }
+    
+    MemoryTracker::Scope::Scope(StageMetrics& stage, const Scope& shared)
+        : m_previousStage(t_stage)
+        , m_previousUsage(t_usage)
+        , m_usage(shared.m_usage)
+    {
+        t_stage = &stage;
+        t_usage = m_usage;
+    }
+    
+    MemoryTracker::Scope::~Scope()
+    {
+        t_stage = m_previousStage;
+        t_usage = m_previousUsage;
+    }
+    
+    int64_t MemoryTracker::Scope::peak() const
+    {
+        return m_usage->peak.load(std::memory_order_relaxed);
+    }
+    
+    void MemoryTracker::install()
+    {
+        //never destroyed, images may be freed during static destruction
+        static CountingAllocator *allocator = new CountingAllocator;
+        cv::Mat::setDefaultAllocator(allocator);
+    }
+    
+    void MemoryTracker::raise(std::atomic<int64_t>& peak, int64_t value)
+    {
+        int64_t current = peak.load(std::memory_order_relaxed);
+        while(value > current && !peak.compare_exchange_weak(current, value, std::memory_order_relaxed));
+    }
+    
+    void MemoryTracker::allocated(StageMetrics *stage, int64_t bytes)
+    {
+        raise(m_peak, m_allocated.fetch_add(bytes, std::memory_order_relaxed) + bytes);
+        if(stage)
+            raise(stage->peakMemory, stage->memory.fetch_add(bytes, std::memory_order_relaxed) + bytes);
+        if(t_usage)
+            raise(t_usage->peak, t_usage->current.fetch_add(bytes, std::memory_order_relaxed) + bytes);
+    }
+    
+    void MemoryTracker::freed(StageMetrics *stage, int64_t bytes)
+    {
+        m_allocated.fetch_sub(bytes, std::memory_order_relaxed);
+        if(stage)
+            stage->memory.fetch_sub(bytes, std::memory_order_relaxed);
+        if(t_usage)
+            t_usage->current.fetch_sub(bytes, std::memory_order_relaxed);
+    }
+    
+    int64_t MemoryTracker::allocatedBytes()
+    {
+        return m_allocated.load(std::memory_order_relaxed);
+    }
+    
+    int64_t MemoryTracker::peakAllocatedBytes()
+    {
+        return m_peak.load(std::memory_order_relaxed);
+    }
+    
+    int64_t MemoryTracker::residentBytes()
+    {
+        //the second field of statm is the number of resident pages
+        std::ifstream statm("/proc/self/statm");
+        int64_t size = 0, resident = 0;
+        if(!(statm >> size >> resident))
+            return 0;
+        return resident * ::sysconf(_SC_PAGESIZE);
+    }
+}
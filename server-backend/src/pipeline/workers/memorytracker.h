@@ -0,0 +1,110 @@
+/**
+ * This file is part of Poster Safari.
+ *
+ *  Poster Safari is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Poster Safari is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with Poster Safari.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ * 
+ *  Copyright 2017 Moritz Dannehl, Rebecca Lühmann, Nicolas Marin, Michael Nieß, Julian Wolff
+ * 
+ */
+
+#ifndef MEMORYTRACKER_H
+#define MEMORYTRACKER_H
+
+#include <atomic>
+#include <cstdint>
+
+namespace Postr 
+{
+    struct StageMetrics;
+    
+    /**
+     * @brief Counts the bytes held by images.
+     * After install() every cv::Mat buffer is allocated by a counting allocator. A buffer is attributed to the stage
+     * whose Scope is active on the allocating thread, until it is freed, no matter which thread frees it.
+     */
+    class MemoryTracker
+    {
+        struct Usage
+        {
+            Usage() : current(0), peak(0) {}
+            std::atomic<int64_t> current;
+            std::atomic<int64_t> peak;
+        };
+        
+    public:
+        /**
+         * @brief Attributes images allocated by the calling thread to a stage while it exists
+         */
+        class Scope
+        {
+        public:
+            explicit Scope(StageMetrics& stage);
+            
+            /**
+             * @brief Attributes images allocated by the calling thread to a stage and counts them in the peak of another scope.
+             * Helper threads use this to add their images to the scope of the thread that started them, which must outlive this scope.
+             */
+            Scope(StageMetrics& stage, const Scope& shared);
+            ~Scope();
+            
+            /**
+             * @brief Maximum number of bytes allocated in this scope and not freed yet, including threads sharing it
+             */
+            int64_t peak() const;
+            
+        private:
+            StageMetrics *m_previousStage;
+            Usage *m_previousUsage;
+            Usage m_ownUsage;
+            Usage *m_usage;
+            
+            Scope(const Scope& other) = delete;
+        };
+        
+        /**
+         * @brief Make the counting allocator the default allocator of cv::Mat. Buffers allocated before are not counted.
+         */
+        static void install();
+        
+        /**
+         * @brief Bytes currently held by counted images
+         */
+        static int64_t allocatedBytes();
+        
+        /**
+         * @brief Maximum of allocatedBytes() since install()
+         */
+        static int64_t peakAllocatedBytes();
+        
+        /**
+         * @brief Resident set size of this process in bytes
+         */
+        static int64_t residentBytes();
+        
+    private:
+        class CountingAllocator;
+        
+        static void allocated(StageMetrics *stage, int64_t bytes);
+        static void freed(StageMetrics *stage, int64_t bytes);
+        static void raise(std::atomic<int64_t>& peak, int64_t value);
+        
+        static std::atomic<int64_t> m_allocated;
+        static std::atomic<int64_t> m_peak;
+        static thread_local StageMetrics *t_stage;
+        static thread_local Usage *t_usage;
+    };
+}
+
+#endif //MEMORYTRACKER_H
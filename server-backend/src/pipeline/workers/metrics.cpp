@@ -0,0 +1,413 @@
+/**
+ * This file is part of Poster Safari.
+ *
+ *  Poster Safari is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Poster Safari is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with Poster Safari.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ * 
+ *  Copyright 2017 Moritz Dannehl, Rebecca Lühmann, Nicolas Marin, Michael Nieß, Julian Wolff
+ * 
+ */
+
+#include "metrics.h"
+#include "memorytracker.h"
+
+#include "easylogging++.h"
+
+#include <sstream>
+#include <fstream>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <limits>
+#include <vector>
+#include <algorithm>
+
+#include <unistd.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#undef LOG
+#define LOG(LEVEL) (CLOG(LEVEL, ELPP_CURR_FILE_LOGGER_ID) << "[Metrics] ")
+
+namespace Postr 
+{
+    const double Histogram::Bounds[Histogram::BucketCount] = {
+        0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 10, 60, 
+        std::numeric_limits<double>::infinity()
+    };
+    
+#ifndef WORKER_LIBRARY
+    std::map<std::string, std::unique_ptr<StageMetrics>> Metrics::m_stages;
+    std::mutex Metrics::m_stagesmutex;
+    std::chrono::steady_clock::time_point Metrics::m_start = std::chrono::steady_clock::now();
+    int Metrics::m_socket = -1;
+    std::thread Metrics::m_serverthread;
+    std::thread Metrics::m_dumpthread;
+    std::mutex Metrics::m_dumpmutex;
+    std::condition_variable Metrics::m_dumpcondition;
+    bool Metrics::m_stop = false;
+#endif
+    
+    Histogram::Histogram()
+        : m_count(0)
+        , m_sumMicroseconds(0)
+    {
+        for(std::atomic<uint64_t>& bucket : m_buckets)
+            bucket = 0;
+    }
+    
+    void Histogram::observe(double seconds)
+    {
+        if(seconds < 0)
+            seconds = 0;
+        
+        int i = 0;
+        while(seconds > Bounds[i])
+            ++i;
+        
+        m_buckets[i].fetch_add(1, std::memory_order_relaxed);
+        m_sumMicroseconds.fetch_add(static_cast<uint64_t>(seconds*1e6), std::memory_order_relaxed);
+        m_count.fetch_add(1, std::memory_order_relaxed);
+    }
+    
+    uint64_t Histogram::bucket(int index) const
+    {
+        return m_buckets[index].load(std::memory_order_relaxed);
+    }
+    
+    uint64_t Histogram::count() const
+    {
+        return m_count.load(std::memory_order_relaxed);
+    }
+    
+    double Histogram::sum() const
+    {
+        return m_sumMicroseconds.load(std::memory_order_relaxed)/1e6;
+    }
+    
+    ThreadUsage ThreadUsage::now()
+    {
+        ThreadUsage usage;
+        timespec cpu;
+        if(clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu) == 0)
+            usage.cpu = cpu.tv_sec + cpu.tv_nsec/1e9;
+        rusage switches;
+        if(getrusage(RUSAGE_THREAD, &switches) == 0)
+        {
+            usage.voluntary = switches.ru_nvcsw;
+            usage.involuntary = switches.ru_nivcsw;
+        }
+        return usage;
+    }
+    
+    ThreadUsage ThreadUsage::operator-(const ThreadUsage& other) const
+    {
+        ThreadUsage usage;
+        usage.cpu = cpu - other.cpu;
+        usage.voluntary = voluntary - other.voluntary;
+        usage.involuntary = involuntary - other.involuntary;
+        return usage;
+    }
+    
+    void StageMetrics::observeUsage(const ThreadUsage& usage, double blocked)
+    {
+        cpuMicroseconds.fetch_add(static_cast<uint64_t>(std::max(0., usage.cpu)*1e6), std::memory_order_relaxed);
+        blockedMicroseconds.fetch_add(static_cast<uint64_t>(std::max(0., blocked)*1e6), std::memory_order_relaxed);
+        voluntarySwitches.fetch_add(std::max<int64_t>(0, usage.voluntary), std::memory_order_relaxed);
+        involuntarySwitches.fetch_add(std::max<int64_t>(0, usage.involuntary), std::memory_order_relaxed);
+    }
+    
+    StageMetrics& Metrics::stage(const std::string& name)
+    {
+        std::lock_guard<std::mutex> lk(m_stagesmutex);
+        std::unique_ptr<StageMetrics>& stage = m_stages[name];
+        if(!stage)
+            stage.reset(new StageMetrics);
+        return *stage;
+    }
+    
+    static void writeHistogram(std::ostream& out, const std::string& metric, const std::string& stage, const Histogram& histogram)
+    {
+        uint64_t cumulative = 0;
+        for(int i=0; i < Histogram::BucketCount; ++i)
+        {
+            cumulative += histogram.bucket(i);
+            out << metric << "_bucket{stage=\"" << stage << "\",le=\"";
+            if(i == Histogram::BucketCount-1)
+                out << "+Inf";
+            else
+                out << Histogram::Bounds[i];
+            out << "\"} " << cumulative << "\n";
+        }
+        out << metric << "_sum{stage=\"" << stage << "\"} " << histogram.sum() << "\n";
+        out << metric << "_count{stage=\"" << stage << "\"} " << histogram.count() << "\n";
+    }
+    
+    std::string Metrics::prometheus()
+    {
+        //collect the stages first, the metrics themselves are read without holding the lock
+        std::vector<std::pair<std::string, const StageMetrics*>> stages;
+        {
+            std::lock_guard<std::mutex> lk(m_stagesmutex);
+            for(const auto& stage : m_stages)
+                stages.push_back({stage.first, stage.second.get()});
+        }
+        
+        std::ostringstream out;
+        
+        out << "# HELP postr_uptime_seconds Time since the pipeline started.\n";
+        out << "# TYPE postr_uptime_seconds gauge\n";
+        out << "postr_uptime_seconds " << std::chrono::duration<double>(std::chrono::steady_clock::now() - m_start).count() << "\n";
+        
+        out << "# HELP postr_resident_bytes Resident set size of the process.\n";
+        out << "# TYPE postr_resident_bytes gauge\n";
+        out << "postr_resident_bytes " << MemoryTracker::residentBytes() << "\n";
+        
+        out << "# HELP postr_image_bytes Bytes held by images.\n";
+        out << "# TYPE postr_image_bytes gauge\n";
+        out << "postr_image_bytes " << MemoryTracker::allocatedBytes() << "\n";
+        
+        out << "# HELP postr_image_peak_bytes Maximum of postr_image_bytes.\n";
+        out << "# TYPE postr_image_peak_bytes gauge\n";
+        out << "postr_image_peak_bytes " << MemoryTracker::peakAllocatedBytes() << "\n";
+        
+        out << "# HELP postr_stage_documents_total Documents processed by a stage.\n";
+        out << "# TYPE postr_stage_documents_total counter\n";
+        for(const auto& stage : stages)
+            out << "postr_stage_documents_total{stage=\"" << stage.first << "\"} " << stage.second->documents << "\n";
+        
+        out << "# HELP postr_stage_errors_total Documents a stage failed to process.\n";
+        out << "# TYPE postr_stage_errors_total counter\n";
+        for(const auto& stage : stages)
+            out << "postr_stage_errors_total{stage=\"" << stage.first << "\"} " << stage.second->errors << "\n";
+        
+        out << "# HELP postr_stage_inflight Documents currently handed to a stage.\n";
+        out << "# TYPE postr_stage_inflight gauge\n";
+        for(const auto& stage : stages)
+            out << "postr_stage_inflight{stage=\"" << stage.first << "\"} " << stage.second->inflight << "\n";
+        
+        out << "# HELP postr_stage_image_bytes Bytes held by images a stage allocated.\n";
+        out << "# TYPE postr_stage_image_bytes gauge\n";
+        for(const auto& stage : stages)
+            out << "postr_stage_image_bytes{stage=\"" << stage.first << "\"} " << stage.second->memory << "\n";
+        
+        out << "# HELP postr_stage_image_peak_bytes Maximum of postr_stage_image_bytes.\n";
+        out << "# TYPE postr_stage_image_peak_bytes gauge\n";
+        for(const auto& stage : stages)
+            out << "postr_stage_image_peak_bytes{stage=\"" << stage.first << "\"} " << stage.second->peakMemory << "\n";
+        
+        out << "# HELP postr_stage_cpu_seconds_total CPU time of the threads processing documents in a stage.\n";
+        out << "# TYPE postr_stage_cpu_seconds_total counter\n";
+        for(const auto& stage : stages)
+            out << "postr_stage_cpu_seconds_total{stage=\"" << stage.first << "\"} " << stage.second->cpuMicroseconds/1e6 << "\n";
+        
+        out << "# HELP postr_stage_blocked_seconds_total Processing time a stage did not spend on a CPU, e.g. waiting for I/O, locks or the scheduler.\n";
+        out << "# TYPE postr_stage_blocked_seconds_total counter\n";
+        for(const auto& stage : stages)
+            out << "postr_stage_blocked_seconds_total{stage=\"" << stage.first << "\"} " << stage.second->blockedMicroseconds/1e6 << "\n";
+        
+        out << "# HELP postr_stage_context_switches_total Context switches of the threads processing documents in a stage.\n";
+        out << "# TYPE postr_stage_context_switches_total counter\n";
+        for(const auto& stage : stages)
+        {
+            out << "postr_stage_context_switches_total{stage=\"" << stage.first << "\",kind=\"voluntary\"} " << stage.second->voluntarySwitches << "\n";
+            out << "postr_stage_context_switches_total{stage=\"" << stage.first << "\",kind=\"involuntary\"} " << stage.second->involuntarySwitches << "\n";
+        }
+        
+        out << "# HELP postr_stage_queue_wait_seconds Time a document waited for a stage to become free.\n";
+        out << "# TYPE postr_stage_queue_wait_seconds histogram\n";
+        for(const auto& stage : stages)
+            writeHistogram(out, "postr_stage_queue_wait_seconds", stage.first, stage.second->queueWait);
+        
+        out << "# HELP postr_stage_processing_seconds Time a stage spent processing a document.\n";
+        out << "# TYPE postr_stage_processing_seconds histogram\n";
+        for(const auto& stage : stages)
+            writeHistogram(out, "postr_stage_processing_seconds", stage.first, stage.second->processing);
+        
+        out << "# HELP postr_stage_latency_seconds Time from handing a document to a stage until its result arrived.\n";
+        out << "# TYPE postr_stage_latency_seconds histogram\n";
+        for(const auto& stage : stages)
+            writeHistogram(out, "postr_stage_latency_seconds", stage.first, stage.second->latency);
+        
+        return out.str();
+    }
+    
+    bool Metrics::serve(int port)
+    {
+        if(m_socket >= 0)
+        {
+            LOG(WARNING) << "metrics are already served";
+            return false;
+        }
+        
+        int sock = ::socket(AF_INET, SOCK_STREAM, 0);
+        if(sock < 0)
+        {
+            LOG(ERROR) << "could not create socket: " << std::strerror(errno);
+            return false;
+        }
+        
+        int reuse = 1;
+        ::setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+        
+        sockaddr_in address;
+        std::memset(&address, 0, sizeof(address));
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        address.sin_port = htons(port);
+        
+        if(::bind(sock, (sockaddr*)&address, sizeof(address)) < 0 || ::listen(sock, 16) < 0)
+        {
+            LOG(ERROR) << "could not listen on port " << port << ": " << std::strerror(errno);
+            ::close(sock);
+            return false;
+        }
+        
+        m_socket = sock;
+        m_serverthread = std::thread([sock]{
+            while(true)
+            {
+                int connection = ::accept(sock, nullptr, nullptr);
+                if(connection < 0)
+                {
+                    if(errno == EINTR)
+                        continue;
+                    break;
+                }
+                
+                //a client that doesn't send or receive must not block scraping or stop()
+                timeval timeout;
+                timeout.tv_sec = 2;
+                timeout.tv_usec = 0;
+                ::setsockopt(connection, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+                ::setsockopt(connection, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+                
+                //the request is not parsed, every request is answered with the metrics
+                char request[1024];
+                ::recv(connection, request, sizeof(request), 0);
+                
+                std::string body = prometheus();
+                std::ostringstream response;
+                response << "HTTP/1.1 200 OK\r\n"
+                         << "Content-Type: text/plain; version=0.0.4\r\n"
+                         << "Content-Length: " << body.size() << "\r\n"
+                         << "Connection: close\r\n\r\n"
+                         << body;
+                std::string data = response.str();
+                
+                size_t sent = 0;
+                while(sent < data.size())
+                {
+                    ssize_t n = ::send(connection, data.data()+sent, data.size()-sent, MSG_NOSIGNAL);
+                    if(n <= 0)
+                        break;
+                    sent += n;
+                }
+                ::close(connection);
+            }
+        });
+        
+        LOG(INFO) << "serving metrics on http://127.0.0.1:" << port << "/metrics";
+        return true;
+    }
+    
+    void Metrics::writeFile(const std::string& filename, std::map<std::string, std::pair<uint64_t, uint64_t>>& last, std::chrono::steady_clock::time_point& lastWrite)
+    {
+        auto now = std::chrono::steady_clock::now();
+        double seconds = std::chrono::duration<double>(now - lastWrite).count();
+        lastWrite = now;
+        
+        std::ostringstream out;
+        out << prometheus();
+        std::ostringstream cores;
+        out << "# HELP postr_stage_documents_per_second Documents processed by a stage per second since the last write.\n";
+        out << "# TYPE postr_stage_documents_per_second gauge\n";
+        cores << "# HELP postr_stage_cpu_cores CPU seconds a stage used per second since the last write, i.e. the number of busy cores.\n";
+        cores << "# TYPE postr_stage_cpu_cores gauge\n";
+        {
+            std::lock_guard<std::mutex> lk(m_stagesmutex);
+            for(const auto& stage : m_stages)
+            {
+                uint64_t documents = stage.second->documents;
+                uint64_t cpu = stage.second->cpuMicroseconds;
+                std::pair<uint64_t, uint64_t>& previous = last[stage.first];
+                out << "postr_stage_documents_per_second{stage=\"" << stage.first << "\"} " << (seconds > 0 ? (documents-previous.first)/seconds : 0) << "\n";
+                cores << "postr_stage_cpu_cores{stage=\"" << stage.first << "\"} " << (seconds > 0 ? (cpu-previous.second)/1e6/seconds : 0) << "\n";
+                previous = std::make_pair(documents, cpu);
+            }
+        }
+        out << cores.str();
+        
+        //write to a temporary file first so readers never see a partially written file
+        std::string tmp = filename + ".tmp";
+        {
+            std::ofstream file(tmp, std::ios::trunc);
+            file << out.str();
+            if(!file)
+            {
+                LOG(WARNING) << "could not write metrics to " << tmp;
+                return;
+            }
+        }
+        if(std::rename(tmp.c_str(), filename.c_str()) != 0)
+            LOG(WARNING) << "could not write metrics to " << filename << ": " << std::strerror(errno);
+    }
+    
+    void Metrics::dump(const std::string& filename, int seconds)
+    {
+        if(m_dumpthread.joinable())
+        {
+            LOG(WARNING) << "metrics are already dumped";
+            return;
+        }
+        
+        seconds = std::max(1, seconds);
+        m_dumpthread = std::thread([filename, seconds]{
+            std::map<std::string, std::pair<uint64_t, uint64_t>> last;
+            auto lastWrite = m_start;
+            
+            std::unique_lock<std::mutex> lk(m_dumpmutex);
+            while(!m_stop)
+            {
+                m_dumpcondition.wait_for(lk, std::chrono::seconds(seconds), []{ return m_stop; });
+                writeFile(filename, last, lastWrite);
+            }
+        });
+    }
+    
+    void Metrics::stop()
+    {
+        {
+            std::lock_guard<std::mutex> lk(m_dumpmutex);
+            m_stop = true;
+        }
+        m_dumpcondition.notify_all();
+        if(m_dumpthread.joinable())
+            m_dumpthread.join();
+        
+        if(m_socket >= 0)
+        {
+            //wake up the server thread blocked in accept
+            ::shutdown(m_socket, SHUT_RDWR);
+            if(m_serverthread.joinable())
+                m_serverthread.join();
+            ::close(m_socket);
+            m_socket = -1;
+        }
+    }
+}
@@ -0,0 +1,165 @@
+/**
+ * This file is part of Poster Safari.
+ *
+ *  Poster Safari is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Poster Safari is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with Poster Safari.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ * 
+ *  Copyright 2017 Moritz Dannehl, Rebecca Lühmann, Nicolas Marin, Michael Nieß, Julian Wolff
+ * 
+ */
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <chrono>
+
+namespace Postr 
+{
+    /**
+     * @brief Latency histogram with fixed buckets that can be updated from any thread without locking
+     */
+    class Histogram
+    {
+    public:
+        static const int BucketCount = 14;
+        
+        /**
+         * @brief Upper bounds of the buckets in seconds. The last bucket is unbounded.
+         */
+        static const double Bounds[BucketCount];
+        
+        Histogram();
+        
+        /**
+         * @brief Record a duration
+         * @param seconds duration in seconds
+         */
+        void observe(double seconds);
+        
+        /**
+         * @brief Number of durations in the bucket with the given index, not cumulative
+         */
+        uint64_t bucket(int index) const;
+        uint64_t count() const;
+        double sum() const;
+        
+    private:
+        std::atomic<uint64_t> m_buckets[BucketCount];
+        std::atomic<uint64_t> m_count;
+        std::atomic<uint64_t> m_sumMicroseconds;
+    };
+    
+    /**
+     * @brief CPU time and context switches of the calling thread since it started
+     */
+    struct ThreadUsage
+    {
+        double cpu = 0;             ///< CPU time in seconds, user and system
+        int64_t voluntary = 0;      ///< context switches because the thread blocked, e.g. on I/O or a lock
+        int64_t involuntary = 0;    ///< context switches because the scheduler preempted the thread
+        
+        static ThreadUsage now();
+        ThreadUsage operator-(const ThreadUsage& other) const;
+    };
+    
+    /**
+     * @brief Metrics of a pipeline stage
+     */
+    struct StageMetrics
+    {
+        Histogram queueWait;        ///< time a document waited for the worker to become free
+        Histogram processing;       ///< time the worker spent on a document
+        Histogram latency;          ///< time from handing a document to the worker until its result arrived
+        std::atomic<uint64_t> documents;
+        std::atomic<uint64_t> errors;
+        std::atomic<int64_t> inflight;
+        std::atomic<int64_t> memory;        ///< bytes of images allocated by the stage and not freed yet
+        std::atomic<int64_t> peakMemory;    ///< maximum of memory
+        std::atomic<uint64_t> cpuMicroseconds;      ///< CPU time of the threads processing documents
+        std::atomic<uint64_t> blockedMicroseconds;  ///< processing time the threads did not spend on a CPU
+        std::atomic<uint64_t> voluntarySwitches;
+        std::atomic<uint64_t> involuntarySwitches;
+        
+        StageMetrics() : documents(0), errors(0), inflight(0), memory(0), peakMemory(0), cpuMicroseconds(0), blockedMicroseconds(0), voluntarySwitches(0), involuntarySwitches(0) {}
+        
+        /**
+         * @brief Record the resources used to process a document
+         * @param usage CPU time and context switches of the threads that processed the document
+         * @param blocked time in seconds the processing thread did not spend on a CPU
+         */
+        void observeUsage(const ThreadUsage& usage, double blocked);
+    };
+    
+    /**
+     * @brief Registry of the metrics of all pipeline stages.
+     * Stages are identified by the name of their Worker. Workers look up their StageMetrics once and update them lock-free.
+     * The metrics can be scraped in the Prometheus text format from a local port and dumped to a file periodically.
+     */
+    class Metrics
+    {
+    public:
+        /**
+         * @brief Metrics of the stage with the given name. The reference stays valid until the process exits.
+         */
+        static StageMetrics& stage(const std::string& name);
+        
+        /**
+         * @brief All metrics in the Prometheus text exposition format
+         */
+        static std::string prometheus();
+        
+        /**
+         * @brief Serve the metrics over HTTP on the loopback interface (e.g. http://127.0.0.1:9464/metrics)
+         * @param port port to listen on
+         * @return true if the server started
+         */
+        static bool serve(int port);
+        
+        /**
+         * @brief Write the metrics to a file periodically. The file additionally contains documents per second of each stage over the last interval.
+         * @param filename file to write to, it is replaced on every write
+         * @param seconds interval between two writes
+         */
+        static void dump(const std::string& filename, int seconds = 10);
+        
+        /**
+         * @brief Stop serving and dumping metrics. The file is written a last time.
+         */
+        static void stop();
+        
+    private:
+        static std::map<std::string, std::unique_ptr<StageMetrics>> m_stages;
+        static std::mutex m_stagesmutex;
+        static std::chrono::steady_clock::time_point m_start;
+        
+        static int m_socket;
+        static std::thread m_serverthread;
+        static std::thread m_dumpthread;
+        static std::mutex m_dumpmutex;
+        static std::condition_variable m_dumpcondition;
+        static bool m_stop;
+        
+        static void writeFile(const std::string& filename, std::map<std::string, std::pair<uint64_t, uint64_t>>& last, std::chrono::steady_clock::time_point& lastWrite);
+    };
+}
+
+#endif //METRICS_H
@@ -20,10 +20,13 @@
  */
 
 #include "ocrworker.h"
+#include "metrics.h"
 #include "util.h"
 #include <iostream>
 #include <string>
+#include <algorithm>
 #include <tesseract/publictypes.h>
+#include <opencv2/imgproc.hpp>
 #include <opencv2/highgui.hpp>
 #include <opencv2/photo.hpp>
 
@@ -35,6 +38,7 @@ namespace Postr
     
     _WORKER_CLASS_::_WORKER_CLASS_()
         : AsyncWorker(_WORKER_NAME_)
+        , m_settings(*this, [this](const Worker&, Settings& settings){ readSettings(settings); })
     {
         
         /*std::vector<std::string> imagenames = File::locateAll(".*tmp", {"/home/wolff/repos/fallstudie/postr-processing/src/pipeline/workers/spellcorrect/glyphs/images/"});
@@ -96,22 +100,13 @@ namespace Postr
         std::string lang = config("OCR_language", "deu+eng", "languages used by OCR");
         
         std::vector<std::string> dirs = File::DataLocation;
-        std::string customdatapath = File::directory(File::locate("deu.traineddata", dirs, -1));
-        const char* datapath = configBool("OCR_useSystemTessData", false, "use system provided tessdata instead of custom ones for Poster Safari.")?NULL:customdatapath.c_str();
-        
-        api = cv::text::OCRTesseract::create(
-            datapath, 
-            lang.c_str(), 
-            validChars.c_str(), 
-            tesseract::OEM_DEFAULT,
-            tesseract::PSM_SINGLE_LINE);
-
-        fullpageapi = cv::text::OCRTesseract::create(
-            datapath, 
-            lang.c_str(), 
-            validChars.c_str(), 
-            tesseract::OEM_DEFAULT,
-            tesseract::PSM_SPARSE_TEXT);
+        m_tessdata = File::directory(File::locate("deu.traineddata", dirs, -1));
+        m_systemtessdata = configBool("OCR_useSystemTessData", false, "use system provided tessdata instead of custom ones for Poster Safari.");
+        m_language = lang;
+        m_whitelist = validChars;
+        
+        m_engines.resize(1);
+        prepareEngine(m_engines[0], false);
         
         try 
         {
@@ -122,8 +117,8 @@ namespace Postr
             const std::string& classifierfile2 = File::locate("trained_classifierNM2.xml", dirs, -1);
             LOG(DEBUG) << "Using trained classifier " << classifierfile1;
             LOG(DEBUG) << "Using trained classifier " << classifierfile2;
-            er_filter1 = cv::text::createERFilterNM1(cv::text::loadClassifierNM1(classifierfile1),6,0.0001f,0.6f,0.2f,true,0.1f);
-            er_filter2 = cv::text::createERFilterNM2(cv::text::loadClassifierNM2(classifierfile2),0.3);
+            er_classifier1 = cv::text::loadClassifierNM1(classifierfile1);
+            er_classifier2 = cv::text::loadClassifierNM2(classifierfile2);
         } 
         catch(cv::Exception& e)
         {
@@ -132,23 +127,129 @@ namespace Postr
         }
     }
     
+    void _WORKER_CLASS_::prepareEngine(OCREngine& engine, bool fullpage) const
+    {
+        const char* datapath = m_systemtessdata ? NULL : m_tessdata.c_str();
+        
+        if(!engine.api)
+        {
+            engine.api = cv::text::OCRTesseract::create(
+                datapath, 
+                m_language.c_str(), 
+                m_whitelist.c_str(), 
+                tesseract::OEM_DEFAULT,
+                tesseract::PSM_SINGLE_LINE);
+        }
+
+        //most posters don't need the original image analyzed, don't load a second model for them
+        if(fullpage && !engine.fullpageapi)
+        {
+            engine.fullpageapi = cv::text::OCRTesseract::create(
+                datapath, 
+                m_language.c_str(), 
+                m_whitelist.c_str(), 
+                tesseract::OEM_DEFAULT,
+                tesseract::PSM_SPARSE_TEXT);
+        }
+    }
+    
+    void _WORKER_CLASS_::createERFilters(size_t count)
+    {
+        while(er_filters.size() < count)
+        {
+            er_filters.push_back(std::make_pair(
+                cv::text::createERFilterNM1(er_classifier1,6,0.0001f,0.6f,0.2f,true,0.1f),
+                cv::text::createERFilterNM2(er_classifier2,0.3)));
+        }
+    }
+    
+    double _WORKER_CLASS_::estimateTextHeight(const cv::Mat& image)
+    {
+        if(!er_classifier1 || !er_classifier2 || image.empty())
+            return 0;
+        
+        // Find character candidates in the lightness channel and its negative of a small copy of the image
+        int maxdim = std::max(image.cols,image.rows);
+        double scale = std::min(1., 1024./maxdim);
+        cv::Mat small;
+        cv::resize(image, small, cv::Size(), scale, scale, cv::INTER_AREA);
+        if(small.channels() == 3)
+            cv::cvtColor(small, small, cv::COLOR_BGR2GRAY);
+        else if(small.channels() == 4)
+            cv::cvtColor(small, small, cv::COLOR_BGRA2GRAY);
+        std::vector<cv::Mat> channels = {small, 255-small};
+        
+        createERFilters(channels.size());
+        std::vector<int> heights;
+        for(int c=0; c < channels.size(); ++c)
+        {
+            std::vector<cv::text::ERStat> regions;
+            er_filters[c].first->run(channels[c], regions);
+            er_filters[c].second->run(channels[c], regions);
+            for(const cv::text::ERStat& region : regions)
+                if(region.parent != NULL)
+                    heights.push_back(region.rect.height);
+        }
+        if(heights.size() < 10)
+            return 0;
+        
+        // Use the height of small characters, so small text is still detected
+        std::nth_element(heights.begin(), heights.begin() + heights.size()/4, heights.end());
+        int height = heights[heights.size()/4];
+        
+        // Characters close to the size of the smallest detectable regions are unreliable, there might be even smaller text
+        if(height < 6)
+            return 0;
+        return height/scale;
+    }
+    
     _WORKER_CLASS_::~_WORKER_CLASS_()
     {
         m_cancel = true;
         while(progress());
         
-        if(er_filter1)
-            er_filter1.release();
-        if(er_filter2)
-            er_filter2.release();
+        er_filters.clear();
     }
     
     void _WORKER_CLASS_::initAsync()
     {
     }
     
+    void _WORKER_CLASS_::readSettings(Settings& settings) const
+    {
+        settings.onlyResizeIfSmaller = configBool("ocr_onlyResizeIfSmaller", false, "Resize image only if it is smaller than DIN A4 at 300dpi.");
+        settings.resizeTo300dpi = configBool("ocr_resizeTo300dpi", true, "Resize each image to at least DIN A4 at 300dpi (keeping aspect ratio) for OCR. Might improve OCR quality.");
+        settings.denoise = configBool("ocr_denoise", false, "Denoise image. This is a very resource intensive step.");
+        settings.analyzeOriginalImage = configBool("OCR_readOriginalImage", false, "Analyze not only ER filtered words, but also the original image");
+        settings.threads = config("OCR_threads", 0, "Number of threads filtering the channels of an image concurrently. 0 uses one thread per CPU core.");
+        if(settings.threads <= 0)
+            settings.threads = std::max(1u, std::thread::hardware_concurrency());
+        settings.adaptiveScale = configBool("ocr_adaptiveScale", true, "Choose the scale text is detected at from the estimated height of the text instead of resizing every image to DIN A4 at 300dpi. Small text lines are upscaled for recognition.");
+        settings.detectionTextHeight = config("ocr_detectionTextHeight", 24, "Height in pixels small characters are scaled to for text detection if ocr_adaptiveScale is set.");
+        settings.recognitionTextHeight = config("ocr_recognitionTextHeight", 40, "Minimum height in pixels of text lines passed to recognition if ocr_adaptiveScale is set. Smaller lines are upscaled.");
+        settings.engines = config("OCR_engines", 0, "Number of Tesseract engines recognizing text groups in parallel. Every engine holds its own copy of the language models. 0 uses one engine per CPU core, at most 4.");
+        if(settings.engines <= 0)
+            settings.engines = std::min(4u, std::max(1u, std::thread::hardware_concurrency()));
+        
+        std::string textLineOutputDir = config("OCR_saveTextLinesTo", "", "If set to a directory, extracted text lines will be saved as images.");
+        String::replaceAll(textLineOutputDir, "~", File::homeDirectory());
+        if(!textLineOutputDir.empty())
+        {
+            if(File::isDirectory(textLineOutputDir))
+                LOG(INFO) << "extracted text lines will be saved to " << textLineOutputDir;
+            else
+            {
+                LOG(WARNING) << "extracted text lines will not be saved to " << textLineOutputDir << ", as this is not an existing directory";
+                textLineOutputDir = "";
+            }
+        }
+        settings.textLineOutputDir = textLineOutputDir;
+    }
+    
     void _WORKER_CLASS_::processAsync(Data& data)
     {
+        std::shared_ptr<const Settings> settings = m_settings.get();
+        
         ImageData src;
         ImageData textImage;
         
@@ -159,26 +260,47 @@ namespace Postr
         }
         
         std::vector<cv::Mat> channels;
+        double reportScale = 1; //from the scale text is detected at to the scale text positions are reported at
         
         if(0 == m_status && !m_cancel)
         {
             src = data.images[data.bestImage()].clone();
             
-            bool forceScale = !configBool("ocr_onlyResizeIfSmaller", false, "Resize image only if it is smaller than DIN A4 at 300dpi.");
-            if(configBool("ocr_resizeTo300dpi", true, "Resize each image to at least DIN A4 at 300dpi (keeping aspect ratio) for OCR. Might improve OCR quality."))
+            // Text positions are reported relative to the image resized to DIN A4 at 300dpi
+            bool forceScale = !settings->onlyResizeIfSmaller;
+            double fixedScale = 1;
+            if(settings->resizeTo300dpi)
             {
                 if(src.cols > src.rows && (src.cols < 3508 || forceScale))
-                    cv::resize(src, src, cv::Size(), 3508./(double)src.cols, 3508./(double)src.cols, cv::INTER_AREA);
+                    fixedScale = 3508./(double)src.cols;
                 else if(src.cols < 2480 || forceScale)
-                    cv::resize(src, src, cv::Size(), 2480./(double)src.cols, 2480./(double)src.cols, cv::INTER_AREA);
+                    fixedScale = 2480./(double)src.cols;
             }
             
+            // Detect text at a scale that brings the small text to detectionTextHeight instead of always resizing to 300dpi.
+            // The fixed scale is an upper bound, so this never costs more than resizing to 300dpi.
+            double scale = fixedScale;
+            if(settings->adaptiveScale)
+            {
+                double textHeight = estimateTextHeight(src);
+                if(textHeight > 0)
+                {
+                    int maxdim = std::max(src.cols,src.rows);
+                    scale = std::min(fixedScale, std::max(800./maxdim, settings->detectionTextHeight/textHeight));
+                }
+                LOG(DEBUG) << "estimated text height " << textHeight << "px, detecting text at scale " << scale << " instead of " << fixedScale;
+            }
+            reportScale = fixedScale/scale;
+            
+            if(scale != 1)
+                cv::resize(src, src, cv::Size(), scale, scale, cv::INTER_AREA);
+            
             if(debug)
                 textImage = src.clone();
         
             int maxdim = std::max(src.cols,src.rows);
             
-            if(configBool("ocr_denoise", false, "Denoise image. This is a very resource intensive step."))
+            if(settings->denoise)
                 cv::fastNlMeansDenoising(src, src, 10, 7, 27);
             
             if(false && debug)
@@ -200,26 +322,48 @@ namespace Postr
             progress(progress()+1);
         }
         
-        std::vector< std::vector<cv::text::ERStat> > regions(channels.size());
-        
         if(0 == m_status && !m_cancel)
-        {                
-            // Apply the default cascade classifier to each independent channel (could be done in parallel)
-            for (int c=0; c<(int)channels.size(); c++)
+        {
+            if(!er_classifier1 || !er_classifier2)
             {
-                er_filter1->run(channels[c], regions[c]);
-                er_filter2->run(channels[c], regions[c]);
-                progress(progress()+1);
+                LOG(ERROR) << "ER filters are not initialized";
+                m_status = 1;
             }
         }
         
+        std::vector< std::vector<cv::text::ERStat> > regions(channels.size());
+        
         if(0 == m_status && !m_cancel)
         {
-            if(!er_filter1 || !er_filter2)
+            createERFilters(channels.size());
+            
+            // Apply the default cascade classifier to each independent channel in parallel
+            const float startProgress = progress();
+            std::atomic_int next(0);
+            std::atomic_int filtered(0);
+            auto filter = [&]{
+                for(int c = next++; c < (int)channels.size() && !m_cancel; c = next++)
+                {
+                    er_filters[c].first->run(channels[c], regions[c]);
+                    er_filters[c].second->run(channels[c], regions[c]);
+                    progress(startProgress + (++filtered));
+                }
+            };
+            
+            int threadCount = std::min<int>(channels.size(), settings->threads);
+            std::vector<std::thread> threads;
+            for(int i=1; i < threadCount; ++i)
             {
-                LOG(ERROR) << "ER filters are not initialized";
-                m_status = 1;
+                threads.push_back(std::thread([&]{
+                    MemoryTracker::Scope memory(metrics(), documentMemory());
+                    ThreadUsage start = ThreadUsage::now();
+                    filter();
+                    chargeThread(ThreadUsage::now() - start);
+                }));
             }
+            filter();
+            for(std::thread& thread : threads)
+                thread.join();
         }
         
         std::vector< std::vector<cv::Vec2i> > region_groups;
@@ -233,75 +377,103 @@ namespace Postr
             progress(progress()+5);
         }
         
-        std::string textLineOutputDir = config("OCR_saveTextLinesTo", "", "If set to a directory, extracted text lines will be saved as images.");
-        String::replaceAll(textLineOutputDir, "~", File::homeDirectory());
-        if(!textLineOutputDir.empty())
+        const std::string& textLineOutputDir = settings->textLineOutputDir;
+        bool analyzeOriginalImage = settings->analyzeOriginalImage || groups_boxes.size() < 5;
+        
+        //text recognized in a group
+        struct Recognition
         {
-            if(File::isDirectory(textLineOutputDir))
-                LOG(INFO) << "extracted text lines will be saved to " << textLineOutputDir;
-            else
-            {
-                LOG(WARNING) << "extracted text lines will not be saved to " << textLineOutputDir << ", as this is not an existing directory";
-                textLineOutputDir = "";
-            }
-        }
-        bool analyzeOriginalImage = configBool("OCR_readOriginalImage", false, "Analyze not only ER filtered words, but also the original image");
+            std::vector<cv::Rect>   boxes, boxes_orig;
+            std::vector<std::string> words, words_orig;
+            std::vector<float>  confidences, confidences_orig;
+            std::string output, output_orig;
+            cv::Mat textLine;   ///< kept if text lines are saved
+            double upscale = 1; ///< scale of the text line passed to Tesseract
+        };
+        std::vector<Recognition> recognitions(groups_boxes.size());
         
         if(0 == m_status && !m_cancel)
         {
-            float progincr = (100-progress())/groups_boxes.size();
+            const float startProgress = progress();
+            const float progincr = (100-startProgress)/groups_boxes.size();
+            std::atomic_int completed(0);
             
-            for (int i=0; i < groups_boxes.size() && !m_cancel; i++)
-            {
-                if(debug)
-                    rectangle(textImage, groups_boxes[i], cv::Scalar(0, 255, 255));
-                
-                cv::Mat group_img = cv::Mat::zeros(src.rows+2, src.cols+2, CV_8UC1);
-                cv::Mat group_img_orig = cv::Mat::zeros(src.rows+2, src.cols+2, src.type());
-    
-                er_draw(channels, regions, region_groups[i], group_img);
-                cv::Mat group_segmentation;
-                group_img.copyTo(group_segmentation);
-                
+            cv::Mat group_img_orig;
+            if(analyzeOriginalImage)
                 copyMakeBorder(src, group_img_orig, 1, 1, 1, 1, cv::BORDER_CONSTANT, 0);
-                
-                cv::Mat group_img_scaled;
-                
-                if(debug)
-                {
-                    group_img_scaled = group_img_orig(groups_boxes[i]);
-                    int maxdim = std::max(src.cols,src.rows);
-                    cv::resize(group_img_scaled, group_img_scaled, cv::Size(), 800./maxdim, 800./maxdim, cv::INTER_AREA);
-                }
-                
-                group_img(groups_boxes[i]).copyTo(group_img);
-                copyMakeBorder(group_img,group_img,15,15,15,15,cv::BORDER_CONSTANT,cv::Scalar(0));
-                
-                std::vector<cv::Rect>   boxes;
-                std::vector<std::string> words;
-                std::vector<float>  confidences;
-                std::string output;
-                api->run(group_img, output, &boxes, &words, &confidences, cv::text::OCR_LEVEL_TEXTLINE);
-                output.erase(remove(output.begin(), output.end(), '\n'), output.end());
-                
-                std::vector<cv::Rect>   boxes_orig;
-                std::vector<std::string> words_orig;
-                std::vector<float>  confidences_orig;
-                std::string output_orig;
-                
-                if(groups_boxes.size() < 5)
-                    analyzeOriginalImage = true;
-                
-                if(analyzeOriginalImage)
+            
+            // Recognize the groups in parallel, each thread uses its own Tesseract engines
+            std::atomic_int next(0);
+            auto recognize = [&](OCREngine& engine){
+                for (int i = next++; i < groups_boxes.size() && !m_cancel; i = next++)
                 {
-                    fullpageapi->run(group_img_orig, output_orig, &boxes_orig, &words_orig, &confidences_orig, cv::text::OCR_LEVEL_TEXTLINE);
-                    output_orig.erase(remove(output_orig.begin(), output_orig.end(), '\n'), output_orig.end());
+                    Recognition& recognition = recognitions[i];
+                    
+                    cv::Mat group_img = cv::Mat::zeros(src.rows+2, src.cols+2, CV_8UC1);
+                    er_draw(channels, regions, region_groups[i], group_img);
+                    
+                    group_img(groups_boxes[i]).copyTo(group_img);
+                    
+                    // Upscale only small text lines for recognition
+                    if(settings->adaptiveScale && group_img.rows < settings->recognitionTextHeight)
+                    {
+                        recognition.upscale = std::min(4., settings->recognitionTextHeight/(double)group_img.rows);
+                        cv::resize(group_img, group_img, cv::Size(), recognition.upscale, recognition.upscale, cv::INTER_CUBIC);
+                        cv::threshold(group_img, group_img, 127, 255, cv::THRESH_BINARY);
+                    }
+                    copyMakeBorder(group_img,group_img,15,15,15,15,cv::BORDER_CONSTANT,cv::Scalar(0));
+                    
+                    engine.api->run(group_img, recognition.output, &recognition.boxes, &recognition.words, &recognition.confidences, cv::text::OCR_LEVEL_TEXTLINE);
+                    recognition.output.erase(remove(recognition.output.begin(), recognition.output.end(), '\n'), recognition.output.end());
+                    
+                    if(analyzeOriginalImage)
+                    {
+                        engine.fullpageapi->run(group_img_orig, recognition.output_orig, &recognition.boxes_orig, &recognition.words_orig, &recognition.confidences_orig, cv::text::OCR_LEVEL_TEXTLINE);
+                        recognition.output_orig.erase(remove(recognition.output_orig.begin(), recognition.output_orig.end(), '\n'), recognition.output_orig.end());
+                    }
+                    
+                    if(!textLineOutputDir.empty())
+                        recognition.textLine = group_img;
+                    
+                    float groupsProgress = startProgress + progincr*(++completed);
+                    if(groupsProgress < 100)
+                        progress(groupsProgress);
                 }
+            };
+            
+            int threadCount = std::max(1, std::min<int>(groups_boxes.size(), settings->engines));
+            if(m_engines.size() < threadCount)
+                m_engines.resize(threadCount);
+            std::vector<std::thread> threads;
+            for(int t=1; t < threadCount; ++t)
+            {
+                threads.push_back(std::thread([&, t]{
+                    MemoryTracker::Scope memory(metrics(), documentMemory());
+                    ThreadUsage start = ThreadUsage::now();
+                    //engines are created by the thread that needs them first, loading traineddata of several engines in parallel
+                    prepareEngine(m_engines[t], analyzeOriginalImage);
+                    recognize(m_engines[t]);
+                    chargeThread(ThreadUsage::now() - start);
+                }));
+            }
+            prepareEngine(m_engines[0], analyzeOriginalImage);
+            recognize(m_engines[0]);
+            for(std::thread& thread : threads)
+                thread.join();
+            
+            // Merge the results in the order of the groups
+            for (int i=0; i < groups_boxes.size() && !m_cancel; i++)
+            {
+                Recognition& recognition = recognitions[i];
+                std::vector<cv::Rect>& boxes = recognition.boxes;
+                std::vector<std::string>& words = recognition.words;
+                std::vector<float>& confidences = recognition.confidences;
+                std::vector<cv::Rect>& boxes_orig = recognition.boxes_orig;
+                std::vector<std::string>& words_orig = recognition.words_orig;
+                std::vector<float>& confidences_orig = recognition.confidences_orig;
                 
-                if(false && debug)
-                {
-                    imshow("group "+std::to_string(i)+": "+output,group_img_scaled);
-                }
+                if(debug)
+                    rectangle(textImage, groups_boxes[i], cv::Scalar(0, 255, 255));
                 
                 if(!textLineOutputDir.empty())
                 {
@@ -311,19 +483,18 @@ namespace Postr
                     std::vector<int> compression_params;
                     compression_params.push_back(CV_IMWRITE_PNG_COMPRESSION);
                     compression_params.push_back(9);
-                    cv::imwrite(textLineOutputDir+"/"+std::to_string(textLineCount)+".tiff", group_img, compression_params);
+                    cv::imwrite(textLineOutputDir+"/"+std::to_string(textLineCount)+".tiff", recognition.textLine, compression_params);
                 }
-                    
-                if(progress()+progincr < 100)
-                    progress(progress()+progincr);
             
-                if (output.size() < 3)
+                if (recognition.output.size() < 3)
                     continue;
 
                 for (int j=0; j < boxes.size() && !m_cancel; j++)
                 {
-                    boxes[j].x += groups_boxes[i].x-15;
-                    boxes[j].y += groups_boxes[i].y-15;
+                    boxes[j].x = groups_boxes[i].x + cvRound((boxes[j].x-15)/recognition.upscale);
+                    boxes[j].y = groups_boxes[i].y + cvRound((boxes[j].y-15)/recognition.upscale);
+                    boxes[j].width = cvRound(boxes[j].width/recognition.upscale);
+                    boxes[j].height = cvRound(boxes[j].height/recognition.upscale);
                     //cout << "  word = " << words[j] << "\t confidence = " << confidences[j] << endl;
                     if ((words[j].size() < 2) || (confidences[j] < 51) ||
                             ((words[j].size()==2) && (words[j][0] == words[j][1])) ||
@@ -335,10 +506,10 @@ namespace Postr
                     words[j].erase(remove(words[j].begin(), words[j].end(), '\n'), words[j].end());
                     data.meta["text"][index]["text"] = words[j];
                     data.meta["text"][index]["confidence"] = confidences[j];
-                    data.meta["text"][index]["x"] = boxes[j].x;
-                    data.meta["text"][index]["y"] = boxes[j].y;
-                    data.meta["text"][index]["width"] = boxes[j].width;
-                    data.meta["text"][index]["height"] = boxes[j].height;
+                    data.meta["text"][index]["x"] = cvRound(boxes[j].x*reportScale);
+                    data.meta["text"][index]["y"] = cvRound(boxes[j].y*reportScale);
+                    data.meta["text"][index]["width"] = cvRound(boxes[j].width*reportScale);
+                    data.meta["text"][index]["height"] = cvRound(boxes[j].height*reportScale);
                     if(debug)
                         rectangle(textImage, boxes[j], cv::Scalar(255, 0, 0));
                 }
@@ -360,10 +531,10 @@ namespace Postr
                         words_orig[j].erase(remove(words_orig[j].begin(), words_orig[j].end(), '\n'), words_orig[j].end());
                         data.meta["text"][index]["text"] = words_orig[j];
                         data.meta["text"][index]["confidence"] = confidences_orig[j];
-                        data.meta["text"][index]["x"] = boxes_orig[j].x;
-                        data.meta["text"][index]["y"] = boxes_orig[j].y;
-                        data.meta["text"][index]["width"] = boxes_orig[j].width;
-                        data.meta["text"][index]["height"] = boxes_orig[j].height;
+                        data.meta["text"][index]["x"] = cvRound(boxes_orig[j].x*reportScale);
+                        data.meta["text"][index]["y"] = cvRound(boxes_orig[j].y*reportScale);
+                        data.meta["text"][index]["width"] = cvRound(boxes_orig[j].width*reportScale);
+                        data.meta["text"][index]["height"] = cvRound(boxes_orig[j].height*reportScale);
                         if(debug)
                             rectangle(textImage, boxes_orig[j], cv::Scalar(255, 0, 0));
                     }
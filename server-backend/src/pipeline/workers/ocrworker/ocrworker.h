@@ -23,11 +23,13 @@
 #define OCRWORKER_H
 
 #include "asyncworker.h"
+#include "configsnapshot.h"
 
 #include  <opencv2/text.hpp>
 
 #include <thread>
 #include <atomic>
+#include <vector>
 
 #ifdef _WORKER_NAME_
 #undef _WORKER_NAME_
@@ -51,8 +53,38 @@ namespace Postr
         ~_WORKER_CLASS_();
     
     private:        
+        /**
+         * @brief Config entries read for every document
+         */
+        struct Settings
+        {
+            bool resizeTo300dpi;
+            bool adaptiveScale;
+            int detectionTextHeight;        ///< pixels
+            int recognitionTextHeight;      ///< pixels
+            bool onlyResizeIfSmaller;
+            bool denoise;
+            std::string textLineOutputDir;  ///< existing directory or empty
+            bool analyzeOriginalImage;
+            int threads;                    ///< threads filtering channels concurrently
+            int engines;                    ///< Tesseract engines recognizing text groups concurrently
+        };
+        
         void processAsync(Data& data) override;
         void initAsync() override;
+        void readSettings(Settings& settings) const;
+        
+        /**
+         * @brief Create ER filters for at least the given number of channels
+         */
+        void createERFilters(size_t count);
+        
+        /**
+         * @brief Estimate the height of small characters from character candidates found by the ER filters in a downscaled copy of an image
+         * @param image the image to estimate the text height of
+         * @return the height in pixels of the image or 0 if it could not be estimated
+         */
+        double estimateTextHeight(const cv::Mat& image);
         /**
          * @brief Draw previously extracted ER regions to a matrix
          * @param channels channels that were used with an ER filter
@@ -68,8 +100,31 @@ namespace Postr
          */
         bool isRepetitive(const std::string& s);
     
-        cv::Ptr<cv::text::OCRTesseract> api,fullpageapi;
-        cv::Ptr<cv::text::ERFilter> er_filter1,er_filter2;
+        /**
+         * @brief The Tesseract engines used by one thread: one reading single text lines and one reading sparse text
+         */
+        struct OCREngine
+        {
+            cv::Ptr<cv::text::OCRTesseract> api,fullpageapi;
+        };
+        
+        /**
+         * @brief Create the Tesseract engines of a thread that don't exist yet. This loads the language models and takes a while.
+         * @param engine the engines of the thread
+         * @param fullpage also create the engine reading sparse text in the original image
+         */
+        void prepareEngine(OCREngine& engine, bool fullpage) const;
+        
+        std::vector<OCREngine> m_engines;  ///< one per thread recognizing text groups, created when first needed
+        std::string m_tessdata, m_language, m_whitelist;
+        bool m_systemtessdata;
+        cv::Ptr<cv::text::ERFilter::Callback> er_classifier1,er_classifier2;
+        /**
+         * ER filters keep state while running. Every channel has its own pair of filters (1st and 2nd stage) 
+         * sharing the loaded classifiers, so channels can be filtered concurrently.
+         */
+        std::vector<std::pair<cv::Ptr<cv::text::ERFilter>,cv::Ptr<cv::text::ERFilter>>> er_filters;
+        ConfigSnapshot<Settings> m_settings;
     };
 };
 
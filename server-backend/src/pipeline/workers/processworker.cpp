@@ -0,0 +1,582 @@
+/**
+ * This file is part of Poster Safari.
+ *
+ *  Poster Safari is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Poster Safari is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with Poster Safari.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ * 
+ *  Copyright 2017 Moritz Dannehl, Rebecca Lühmann, Nicolas Marin, Michael Nieß, Julian Wolff
+ * 
+ */
+
+#include "processworker.h"
+#include "metrics.h"
+#include "util.h"
+
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <limits.h>
+#include <string.h>
+
+#include <chrono>
+
+#undef LOG
+#define LOG(LEVEL) (CLOG(LEVEL, ELPP_CURR_FILE_LOGGER_ID) << "[" << m_name << " process] ")
+
+namespace Postr
+{
+    /**
+     * @brief A document sent to a worker host
+     */
+    struct ProcessWorker::Request
+    {
+        long id;
+        Data data;
+        std::function<void(Data, int)> callback;
+        std::vector<MetaData> handles;                  ///< handles of the input images in shared memory
+        std::chrono::steady_clock::time_point queued;
+        std::chrono::steady_clock::time_point sent;
+    };
+    
+    /**
+     * @brief A worker host process and the memory shared with it
+     */
+    struct ProcessWorker::Host
+    {
+        int index = 0;
+        pid_t pid = -1;
+        int socket = -1;
+        bool ready = false;
+        IPC::SharedMemory memory;
+        IPC::Ring input;                                ///< first half of the segment, written by this process
+        std::deque<std::shared_ptr<Request>> queued;    ///< waiting for space in the input ring
+        std::deque<std::shared_ptr<Request>> inflight;  ///< sent to the host, answered in order
+        std::atomic_int progress;                        ///< progress of the current document in hundredths of a percent
+        std::mutex mutex;
+        std::thread reader;
+        
+        Host() : progress(0) {}
+        
+        size_t load() const
+        {
+            return queued.size() + inflight.size();
+        }
+    };
+    
+    double ProcessWorker::IpcStats::overheadSeconds() const
+    {
+        return roundTripSeconds - processingSeconds + copySeconds;
+    }
+    
+    ProcessWorker::ProcessWorker(const std::string& name, int processes, size_t segmentSize)
+        : Worker("")
+        , m_workername(name)
+        , m_segmentSize(segmentSize)
+        , m_nextid(0)
+        , m_stop(false)
+    {
+        m_name = m_workername.c_str();
+        
+        for(int i=0; i < std::max(1, processes); ++i)
+        {
+            m_hosts.emplace_back(new Host);
+            Host *host = m_hosts.back().get();
+            host->index = i;
+            if(spawn(*host))
+                host->reader = std::thread(&ProcessWorker::receive, this, host);
+        }
+    }
+    
+    ProcessWorker::~ProcessWorker()
+    {
+        m_stop = true;
+        
+        for(std::unique_ptr<Host>& host : m_hosts)
+        {
+            //the host exits when its socket is closed
+            if(host->socket >= 0)
+                shutdown(host->socket, SHUT_RDWR);
+        }
+        
+        for(std::unique_ptr<Host>& host : m_hosts)
+        {
+            if(host->reader.joinable())
+                host->reader.join();
+            
+            if(host->pid > 0)
+            {
+                auto start = std::chrono::steady_clock::now();
+                while(waitpid(host->pid, nullptr, WNOHANG) == 0)
+                {
+                    if(std::chrono::steady_clock::now() - start > std::chrono::seconds(10))
+                    {
+                        LOG(ERROR) << "killed worker host " << host->pid << " after waiting 10 seconds for it to finish";
+                        kill(host->pid, SIGKILL);
+                        waitpid(host->pid, nullptr, 0);
+                        break;
+                    }
+                    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+                }
+            }
+            if(host->socket >= 0)
+                close(host->socket);
+        }
+        
+        logStatistics();
+    }
+    
+    std::string ProcessWorker::hostExecutable()
+    {
+        std::vector<std::string> dirs;
+        
+        //prefer the host installed next to the running binary
+        char path[PATH_MAX];
+        ssize_t length = readlink("/proc/self/exe", path, sizeof(path)-1);
+        if(length > 0)
+        {
+            std::string self(path, length);
+            dirs.push_back(self.substr(0, self.find_last_of('/')));
+        }
+        dirs.insert(dirs.end(), File::BinaryLocation.begin(), File::BinaryLocation.end());
+        dirs.push_back(".");
+        
+        return File::locate("postr-workerhost", dirs, 2);
+    }
+    
+    bool ProcessWorker::spawn(Host& host)
+    {
+        static const std::string executable = hostExecutable();
+        if(executable.empty())
+        {
+            LOG(ERROR) << "cannot find postr-workerhost";
+            return false;
+        }
+        
+        int fds[2];
+        if(socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) != 0)
+        {
+            LOG(ERROR) << "cannot create socket: " << strerror(errno);
+            return false;
+        }
+        
+        if(!host.memory.create(m_segmentSize))
+        {
+            close(fds[0]);
+            close(fds[1]);
+            return false;
+        }
+        
+        //everything the child needs is prepared before forking, only async-signal-safe calls are allowed in between fork and exec
+        std::vector<std::string> arguments = {
+            executable,
+            "--worker", m_workername,
+            "--socket", std::to_string(fds[1]),
+            "--memory", std::to_string(host.memory.fd()),
+            "--size", std::to_string(m_segmentSize)
+        };
+        std::vector<char*> argv;
+        for(std::string& argument : arguments)
+            argv.push_back(&argument[0]);
+        argv.push_back(nullptr);
+        int memoryfd = host.memory.fd();
+        
+        pid_t pid = fork();
+        if(pid < 0)
+        {
+            LOG(ERROR) << "cannot start worker host: " << strerror(errno);
+            close(fds[0]);
+            close(fds[1]);
+            host.memory.release();
+            return false;
+        }
+        if(pid == 0)
+        {
+            fcntl(fds[1], F_SETFD, 0);
+            fcntl(memoryfd, F_SETFD, 0);
+            execv(argv[0], argv.data());
+            _exit(127);
+        }
+        
+        close(fds[1]);
+        
+        std::lock_guard<std::mutex> lk(host.mutex);
+        host.pid = pid;
+        host.socket = fds[0];
+        host.ready = false;
+        host.progress = 0;
+        host.input = IPC::Ring(0, m_segmentSize/2);
+        
+        LOG(INFO) << "started worker host " << pid;
+        return true;
+    }
+    
+    int ProcessWorker::process(Data data, WorkerCallback& callback)
+    {
+        if(m_abort)
+            return 1;
+        
+        std::shared_ptr<Request> request = std::make_shared<Request>();
+        request->id = m_nextid++;
+        request->data = data;
+        request->callback = callback;
+        request->queued = std::chrono::steady_clock::now();
+        
+        size_t bytes = 0;
+        for(const ImageData& image : data.images)
+            bytes += IPC::imageSize(image) + 64;
+        
+        Host *host = nullptr;
+        size_t load = 0;
+        for(std::unique_ptr<Host>& candidate : m_hosts)
+        {
+            std::lock_guard<std::mutex> lk(candidate->mutex);
+            if(candidate->pid > 0 && (!host || candidate->load() < load))
+            {
+                host = candidate.get();
+                load = candidate->load();
+            }
+        }
+        
+        bool accepted = false;
+        if(host)
+        {
+            std::lock_guard<std::mutex> lk(host->mutex);
+            if(host->pid > 0 && host->input.fits(bytes))
+            {
+                host->queued.push_back(request);
+                dispatch(*host);
+                accepted = true;
+            }
+        }
+        
+        if(!accepted)
+        {
+            //fail this document only, the chain continues with the next one
+            if(!host)
+                LOG(ERROR) << "no worker host running";
+            else
+                LOG(ERROR) << "images of " << bytes << " bytes don't fit into shared memory of " << m_segmentSize/2 << " bytes";
+            {
+                std::lock_guard<std::mutex> lk(m_statsmutex);
+                ++m_stats.failures;
+            }
+            m_status = 1;
+            if(callback)
+                callback(data, 1);
+            return 0;
+        }
+        
+        std::lock_guard<std::mutex> lk(m_progressmutex);
+        m_progresscondition.notify_all();
+        return 0;
+    }
+    
+    void ProcessWorker::dispatch(Host& host)
+    {
+        while(!host.queued.empty() && host.socket >= 0)
+        {
+            std::shared_ptr<Request> request = host.queued.front();
+            
+            size_t bytes = 0;
+            for(const ImageData& image : request->data.images)
+                bytes += (IPC::imageSize(image) + 63) / 64 * 64;
+            
+            //all images of a document share one region so regions are released in order
+            long region = host.input.allocate(bytes);
+            if(region < 0)
+                return;
+            
+            auto start = std::chrono::steady_clock::now();
+            MetaData message;
+            message["type"] = "process";
+            message["id"] = (Json::Int64)request->id;
+            message["meta"] = request->data.meta;
+            message["images"] = Json::Value(Json::arrayValue);
+            request->handles.clear();
+            size_t offset = region;
+            for(const ImageData& image : request->data.images)
+            {
+                MetaData handle = IPC::store(image, host.memory.data(), offset);
+                request->handles.push_back(handle);
+                message["images"].append(handle);
+                offset += (IPC::imageSize(image) + 63) / 64 * 64;
+            }
+            double copySeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            {
+                std::lock_guard<std::mutex> lk(m_statsmutex);
+                m_stats.copySeconds += copySeconds;
+                m_stats.bytesCopied += bytes;
+            }
+            
+            host.queued.pop_front();
+            host.inflight.push_back(request);
+            request->sent = std::chrono::steady_clock::now();
+            metrics().queueWait.observe(std::chrono::duration<double>(request->sent - request->queued).count());
+            
+            //a broken connection is detected by the reader thread which fails all documents in flight
+            IPC::send(host.socket, message);
+        }
+    }
+    
+    void ProcessWorker::receive(Host *host)
+    {
+        while(!m_stop)
+        {
+            MetaData message;
+            while(IPC::receive(host->socket, message))
+            {
+                std::string type = message["type"].asString();
+                if(type == "result")
+                    finish(*host, message);
+                else if(type == "progress")
+                {
+                    host->progress = 100*message["value"].asFloat();
+                }
+                else if(type == "ready")
+                {
+                    std::lock_guard<std::mutex> lk(host->mutex);
+                    host->ready = true;
+                    LOG(DEBUG) << "worker host " << host->pid << " is ready";
+                }
+                else if(type == "error")
+                    LOG(ERROR) << "worker host " << host->pid << ": " << message["reason"].asString();
+            }
+            
+            if(m_stop)
+                break;
+            
+            bool wasReady;
+            {
+                std::lock_guard<std::mutex> lk(host->mutex);
+                wasReady = host->ready;
+            }
+            fail(*host);
+            
+            //a host which never got ready would fail again
+            if(!wasReady || !spawn(*host))
+            {
+                LOG(ERROR) << "giving up on worker host " << host->index;
+                std::deque<std::shared_ptr<Request>> queued;
+                {
+                    std::lock_guard<std::mutex> lk(host->mutex);
+                    queued.swap(host->queued);
+                    host->pid = -1;
+                }
+                for(std::shared_ptr<Request>& request : queued)
+                {
+                    if(request->callback)
+                        request->callback(request->data, 1);
+                }
+                break;
+            }
+            
+            std::lock_guard<std::mutex> lk(host->mutex);
+            dispatch(*host);
+        }
+        
+        std::lock_guard<std::mutex> lk(m_progressmutex);
+        m_progresscondition.notify_all();
+    }
+    
+    void ProcessWorker::finish(Host& host, const MetaData& message)
+    {
+        std::shared_ptr<Request> request;
+        Data result;
+        int status = message["status"].asInt();
+        double roundTrip, copySeconds = 0;
+        size_t copied = 0;
+        {
+            std::lock_guard<std::mutex> lk(host.mutex);
+            if(host.inflight.empty() || host.inflight.front()->id != message["id"].asInt64())
+            {
+                LOG(ERROR) << "unexpected result " << message["id"].asInt64();
+                return;
+            }
+            request = host.inflight.front();
+            roundTrip = std::chrono::duration<double>(std::chrono::steady_clock::now() - request->sent).count();
+            
+            result.meta = message["meta"];
+            const MetaData& handles = message["images"];
+            result.images.resize(handles.size());
+            auto start = std::chrono::steady_clock::now();
+            for(int i=0; i < handles.size(); ++i)
+            {
+                if(!handles[i].isObject())
+                    continue;
+                
+                size_t offset = handles[i]["offset"].asUInt64();
+                if(offset < m_segmentSize/2)
+                {
+                    //the worker returned an input image or a region of it, use the original buffer
+                    for(int j=0; j < request->handles.size(); ++j)
+                    {
+                        const MetaData& input = request->handles[j];
+                        const ImageData& original = request->data.images[j];
+                        if(!input.isObject() || offset < input["offset"].asUInt64())
+                            continue;
+                        size_t step = input["step"].asUInt64();
+                        size_t delta = offset - input["offset"].asUInt64();
+                        int y = delta / step;
+                        int x = (delta % step) / original.elemSize();
+                        int rows = handles[i]["rows"].asInt();
+                        int cols = handles[i]["cols"].asInt();
+                        if(handles[i]["type"].asInt() == original.type() && y + rows <= original.rows && x + cols <= original.cols)
+                        {
+                            result.images[i] = ImageData(original(cv::Rect(x, y, cols, rows)));
+                            break;
+                        }
+                    }
+                    if(result.images[i].empty())
+                        LOG(ERROR) << "result image " << i << " points to an unknown input image";
+                }
+                else
+                {
+                    ImageData image = IPC::view(handles[i], host.memory.data(), host.memory.size());
+                    result.images[i] = ImageData(image.clone());
+                    copied += IPC::imageSize(image);
+                }
+            }
+            copySeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            
+            //the result images have been copied, the host may reuse their memory
+            MetaData ack;
+            ack["type"] = "ack";
+            ack["id"] = message["id"];
+            IPC::send(host.socket, ack);
+            
+            host.inflight.pop_front();
+            host.input.release();
+            host.progress = 0;
+            dispatch(host);
+        }
+        
+        bool log;
+        {
+            std::lock_guard<std::mutex> lk(m_statsmutex);
+            log = (++m_stats.requests % 100 == 0);
+            if(status != 0)
+                ++m_stats.failures;
+            m_stats.bytesCopied += copied;
+            m_stats.copySeconds += copySeconds;
+            m_stats.roundTripSeconds += roundTrip;
+            m_stats.processingSeconds += message["seconds"].asDouble();
+        }
+        metrics().processing.observe(message["seconds"].asDouble());
+        //the worker in the host process reports the resources it used in the result
+        const MetaData& cpu = result.meta["result"]["cpu"][m_name];
+        if(cpu.isObject())
+        {
+            ThreadUsage usage;
+            usage.cpu = cpu["seconds"].asDouble();
+            usage.voluntary = cpu["voluntarySwitches"].asInt64();
+            usage.involuntary = cpu["involuntarySwitches"].asInt64();
+            metrics().observeUsage(usage, cpu["blocked"].asDouble());
+        }
+        if(log)
+            logStatistics();
+        
+        m_status = status;
+        if(request->callback && !m_abort)
+            request->callback(result, status);
+        
+        std::lock_guard<std::mutex> lk(m_progressmutex);
+        m_progresscondition.notify_all();
+    }
+    
+    void ProcessWorker::fail(Host& host)
+    {
+        std::deque<std::shared_ptr<Request>> failed;
+        {
+            std::lock_guard<std::mutex> lk(host.mutex);
+            
+            //the host may still be alive if it closed the connection on its own
+            int status = 0;
+            if(host.pid > 0)
+            {
+                kill(host.pid, SIGKILL);
+                waitpid(host.pid, &status, 0);
+            }
+            if(WIFSIGNALED(status) && WTERMSIG(status) != SIGKILL)
+                LOG(ERROR) << "worker host " << host.pid << " crashed with signal " << WTERMSIG(status) << " (" << strsignal(WTERMSIG(status)) << "), failing " << host.inflight.size() << " documents";
+            else
+                LOG(ERROR) << "worker host " << host.pid << " terminated, failing " << host.inflight.size() << " documents";
+            
+            close(host.socket);
+            host.socket = -1;
+            host.pid = -1;
+            host.progress = 0;
+            host.memory.release();
+            host.input.clear();
+            failed.swap(host.inflight);
+        }
+        
+        {
+            std::lock_guard<std::mutex> lk(m_statsmutex);
+            m_stats.failures += failed.size();
+            ++m_stats.restarts;
+        }
+        
+        m_status = 1;
+        for(std::shared_ptr<Request>& request : failed)
+        {
+            if(request->callback && !m_abort)
+                request->callback(request->data, 1);
+        }
+    }
+    
+    float ProcessWorker::progress() const
+    {
+        float progress = 0;
+        for(const std::unique_ptr<Host>& host : m_hosts)
+        {
+            std::lock_guard<std::mutex> lk(host->mutex);
+            if(!host->inflight.empty() || !host->queued.empty())
+                progress = std::max(progress, std::max(100, (int)host->progress)/100.f); //at least 1% while busy
+        }
+        return progress;
+    }
+    
+    bool ProcessWorker::running() const
+    {
+        for(const std::unique_ptr<Host>& host : m_hosts)
+        {
+            std::lock_guard<std::mutex> lk(host->mutex);
+            if(host->pid > 0)
+                return true;
+        }
+        return false;
+    }
+    
+    ProcessWorker::IpcStats ProcessWorker::statistics() const
+    {
+        std::lock_guard<std::mutex> lk(m_statsmutex);
+        return m_stats;
+    }
+    
+    void ProcessWorker::logStatistics() const
+    {
+        IpcStats stats = statistics();
+        if(stats.requests == 0)
+            return;
+        
+        LOG(INFO) << stats.requests << " documents in " << m_hosts.size() << " processes, "
+                  << stats.failures << " failed, " << stats.restarts << " restarts, "
+                  << "processing " << 1000*stats.processingSeconds/stats.requests << " ms/document, "
+                  << "IPC overhead " << 1000*stats.overheadSeconds()/stats.requests << " ms/document "
+                  << "(copying " << stats.bytesCopied/(1024*1024) << " MiB took " << 1000*stats.copySeconds << " ms)";
+    }
+}
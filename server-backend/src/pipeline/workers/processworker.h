@@ -0,0 +1,112 @@
+/**
+ * This file is part of Poster Safari.
+ *
+ *  Poster Safari is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Poster Safari is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with Poster Safari.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ * 
+ *  Copyright 2017 Moritz Dannehl, Rebecca Lühmann, Nicolas Marin, Michael Nieß, Julian Wolff
+ * 
+ */
+
+#ifndef PROCESSWORKER_H
+#define PROCESSWORKER_H
+
+#include "worker.h"
+#include "ipc.h"
+
+#include <map>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <condition_variable>
+
+namespace Postr
+{
+    /**
+     * @brief Runs a shared object Worker in separate worker host processes (postr-workerhost).
+     * A crash of the worker only fails the documents it was processing at that time, the host is restarted afterwards.
+     * Each host shares a memory segment with this process. Input images are copied to the segment once and passed to the
+     * host by handle, result images are read from the segment. Only metadata is sent over a socket.
+     * Documents are distributed to the host with the fewest documents in flight.
+     */
+    class ProcessWorker final : public Worker
+    {
+    public:
+        /**
+         * @brief Statistics of the communication with the worker hosts
+         */
+        struct IpcStats
+        {
+            long requests = 0;
+            long failures = 0;
+            long restarts = 0;
+            size_t bytesCopied = 0;         ///< image bytes copied to and from shared memory
+            double copySeconds = 0;         ///< time spent copying images to and from shared memory
+            double roundTripSeconds = 0;    ///< time between sending a document and receiving its result
+            double processingSeconds = 0;   ///< time the worker spent processing as measured by the hosts
+            
+            /**
+             * @brief Time spent on inter-process communication instead of processing
+             */
+            double overheadSeconds() const;
+        };
+        
+        /**
+         * @brief Start the worker hosts
+         * @param name name of the Worker as given by WorkerLoader::availableWorkers
+         * @param processes number of worker host processes
+         * @param segmentSize size of the memory segment shared with each process in bytes.
+         * Half of it holds input images, the other half result images.
+         */
+        explicit ProcessWorker(const std::string& name, int processes = 1, size_t segmentSize = 256*1024*1024);
+        ~ProcessWorker();
+        
+        int process(Data data, WorkerCallback& callback = nullptr) override;
+        float progress() const override;
+        
+        /**
+         * @brief Check whether at least one worker host is running
+         */
+        bool running() const;
+        
+        IpcStats statistics() const;
+        
+    private:
+        struct Request;
+        struct Host;
+        
+        bool spawn(Host& host);
+        void receive(Host *host);
+        void dispatch(Host& host);
+        void finish(Host& host, const MetaData& message);
+        void fail(Host& host);
+        void logStatistics() const;
+        
+        static std::string hostExecutable();
+        
+        std::string m_workername;
+        size_t m_segmentSize;
+        std::vector<std::unique_ptr<Host>> m_hosts;
+        std::atomic_long m_nextid;
+        std::atomic_bool m_stop;
+        
+        IpcStats m_stats;
+        mutable std::mutex m_statsmutex;
+        
+        ProcessWorker(const ProcessWorker& other) = delete;
+    };
+}
+
+#endif //PROCESSWORKER_H
@@ -53,6 +53,8 @@ namespace Postr
         ~_WORKER_CLASS_();
     
     private:        
+        friend struct MicroBenchmark;
+        
         class SpellCorrect;
         
         void processAsync(Data& data) override;
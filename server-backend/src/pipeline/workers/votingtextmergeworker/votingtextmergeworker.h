@@ -25,6 +25,8 @@ namespace Postr
         ~_WORKER_CLASS_();
     
     private:        
+        friend struct MicroBenchmark;
+        
         void processAsync(Data& data) override;
         /**
          * @brief Get the edits needed to transform s1 to s2
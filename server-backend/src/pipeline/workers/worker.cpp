@@ -20,6 +20,9 @@
  */
 
 #include "worker.h"
+#include "metrics.h"
+#include "tracer.h"
+#include "logsink.h"
 #include "util.h"
 
 #include <chrono>
@@ -27,6 +30,8 @@
 #include <iostream>
 #include <functional>
 
+#include <sys/stat.h>
+
 
 #ifdef WORKER_LIBRARY
 //INITIALIZE_NULL_EASYLOGGINGPP
@@ -43,10 +48,22 @@ namespace Postr
     std::atomic_int Worker::m_configaccesscounter(0);
     std::mutex Worker::m_configaccessmutex;
     Data Worker::m_config;
+    std::atomic_int Worker::m_configgeneration(0);
+    long long Worker::m_configmodified = 0;
+    std::thread Worker::m_configwatcher;
+    std::condition_variable Worker::m_configwatchcondition;
+    bool Worker::m_stopconfigwatcher = false;
     std::condition_variable Worker::m_progresscondition;
     std::mutex Worker::m_progressmutex;
     std::atomic_bool Worker::m_abort(false);
     std::atomic_int Worker::m_progressbars(0);
+    std::atomic_int Worker::progressRate(10);
+    std::multiset<const Worker*> Worker::m_observedworkers;
+    std::mutex Worker::m_observermutex;
+    bool Worker::m_observing = false;
+    int Worker::m_observergeneration = 0;
+    std::thread Worker::m_observer;
+    std::condition_variable Worker::m_observercondition;
 #endif
     
 #ifdef ELPP_DISABLE_DEFAULT_CRASH_HANDLING
@@ -58,6 +75,7 @@ namespace Postr
             static bool crashed = false;
             if(!crashed)
                 el::Helpers::logCrashReason(sig, true, el::Level::Error, el::base::consts::kDefaultLoggerId);
+            LogSink::flush();
             crashed = true;
             //el::Helpers::crashAbort(sig);
         }
@@ -69,14 +87,15 @@ namespace Postr
     
     void Worker::LogDispatcher::handle(const el::LogDispatchData* /*handlePtr*/)
     {
-        m_progressbars = 0;
-        std::cout << "\033[J";
-        m_progresscondition.notify_all();
+        //clear the progress bars below the log line, they are redrawn by the progress observer
+        if(m_progressbars.exchange(0) > 0)
+            std::cout << "\033[J";
     }
     
     Worker::Worker(const char *name)
         : m_status(0)
         , m_name(name)
+        , m_metrics(nullptr)
     {        
         cv::redirectError(cvNulDevReport);
         
@@ -99,23 +118,39 @@ namespace Postr
 #ifdef ELPP_DISABLE_DEFAULT_CRASH_HANDLING
         el::Helpers::setCrashHandler(Worker::handleCrash);
 #endif
-        el::Helpers::installLogDispatchCallback<Worker::LogDispatcher>(Util::uuid());
+        el::Helpers::installLogDispatchCallback<Worker::LogDispatcher>("ProgressDispatcher");
+        //the log file is written by the LogSink in the background
+        el::Helpers::installLogDispatchCallback<LogSink>("LogSink");
+        LogSink::start("pipeline.log", 2097152); //2MB
         el::Configurations defaultConf;
         defaultConf = *el::Loggers::getLogger("default")->configurations();
         defaultConf.setGlobally(el::ConfigurationType::Format, "%datetime %level %msg");
-        defaultConf.setGlobally(el::ConfigurationType::Filename, "pipeline.log");
-        defaultConf.setGlobally(el::ConfigurationType::MaxLogFileSize, "2097152"); //2MB
+        defaultConf.setGlobally(el::ConfigurationType::ToFile, "false");
         if(loglevel >= 0)
         {
+            //the log file additionally gets everything up to INFO. Levels logged nowhere are disabled, so their messages are not formatted.
+            int filelevel = std::max(loglevel, 4);
+            LogSink::setLevel(filelevel);
             el::Level level[6] = {el::Level::Fatal, el::Level::Error, el::Level::Warning, el::Level::Info, el::Level::Verbose, el::Level::Debug};
             for(int i=0; i<6; ++i)
             {
                 defaultConf.set(level[i], el::ConfigurationType::ToStandardOutput, loglevel > i ? "true" : "false");
+                defaultConf.set(level[i], el::ConfigurationType::Enabled, filelevel > i ? "true" : "false");
             }
         }
         el::Loggers::reconfigureLogger("default", defaultConf);
         el::Loggers::addFlag(el::LoggingFlag::ColoredTerminalOutput);
-        el::Loggers::addFlag(el::LoggingFlag::StrictLogFileSizeCheck);
+    }
+    
+    /**
+     * @brief Modification time of a file in nanoseconds or 0 if it does not exist
+     */
+    static long long modificationTime(const std::string& filename)
+    {
+        struct stat info;
+        if(stat(filename.c_str(), &info) != 0)
+            return 0;
+        return (long long)info.st_mtim.tv_sec*1000000000 + info.st_mtim.tv_nsec;
     }
     
     void Worker::initializeConfig()
@@ -148,6 +183,7 @@ namespace Postr
                     {
                         m_config.meta[it.key().asString()] = oldconfig.meta[it.key().asString()];
                     }
+                    m_configmodified = modificationTime(fname);
                 }
                 config("filename", fname);
             }
@@ -155,7 +191,25 @@ namespace Postr
             LOG(INFO) << "using config file " << config("filename");
         }
         
-        ++m_configaccesscounter;
+        if(0 == m_configaccesscounter++)
+        {
+            int interval = config("config_reloadInterval", 5, "seconds between checks for changes of the config file, 0 disables reloading the config while running");
+            
+            std::lock_guard<std::mutex> guard(m_configaccessmutex);
+            if(interval > 0 && !m_configwatcher.joinable())
+            {
+                m_stopconfigwatcher = false;
+                m_configwatcher = std::thread([interval]{
+                    std::unique_lock<std::mutex> lk(m_configaccessmutex);
+                    while(!m_configwatchcondition.wait_for(lk, std::chrono::seconds(interval), []{ return m_stopconfigwatcher; }))
+                    {
+                        lk.unlock();
+                        reloadConfig();
+                        lk.lock();
+                    }
+                });
+            }
+        }
     }
     
     void Worker::releaseConfig()
@@ -163,6 +217,14 @@ namespace Postr
         --m_configaccesscounter;
         if(m_configaccesscounter <= 0)
         {
+            {
+                std::lock_guard<std::mutex> guard(m_configaccessmutex);
+                m_stopconfigwatcher = true;
+                m_configwatchcondition.notify_all();
+            }
+            if(m_configwatcher.joinable() && m_configwatcher.get_id() != std::this_thread::get_id())
+                m_configwatcher.join();
+            
             std::string fname = config("filename", File::homeDirectory()+"/.config/postr.conf");
                 
             std::ofstream ofs(fname, std::ofstream::out);
@@ -171,10 +233,49 @@ namespace Postr
             m_config.meta.removeMember("filename");
             Json::StyledWriter writer;
             ofs << writer.write(m_config.meta);
+            ofs.close();
+            m_configmodified = modificationTime(fname);
             LOG(DEBUG) << "writing config to " << fname;
         }
     }
     
+    int Worker::configGeneration()
+    {
+        return m_configgeneration;
+    }
+    
+    bool Worker::reloadConfig()
+    {
+        std::string fname;
+        {
+            std::lock_guard<std::mutex> guard(m_configaccessmutex);
+            fname = m_config.meta["filename"]["value"].asString();
+            if(fname.empty() || modificationTime(fname) == m_configmodified)
+                return false;
+        }
+        
+        std::ifstream ifs(fname, std::ifstream::in);
+        std::string file_contents((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+        Data newconfig(file_contents);
+        if(!newconfig.meta.isObject())
+            return false;
+        
+        {
+            std::lock_guard<std::mutex> guard(m_configaccessmutex);
+            //only values are taken from the file, defaults and descriptions are owned by the workers
+            for(const std::string& name : newconfig.meta.getMemberNames())
+            {
+                if(name != "filename" && newconfig.meta[name].isMember("value"))
+                    m_config.meta[name]["value"] = newconfig.meta[name]["value"];
+            }
+            m_configmodified = modificationTime(fname);
+        }
+        
+        ++m_configgeneration;
+        LOG(INFO) << "reloaded config file " << fname;
+        return true;
+    }
+    
     int Worker::processBlocking(Data& data)
     {
         std::set<const Worker*> progress;
@@ -206,6 +307,17 @@ namespace Postr
         return m_name;
     }
     
+    StageMetrics& Worker::metrics() const
+    {
+        StageMetrics* metrics = m_metrics.load(std::memory_order_acquire);
+        if(!metrics)
+        {
+            metrics = &Metrics::stage(m_name);
+            m_metrics.store(metrics, std::memory_order_release);
+        }
+        return *metrics;
+    }
+    
     std::string Worker::config(const std::string& name, const std::string& def, const std::string& descr) const
     {
         std::lock_guard<std::mutex> guard(m_configaccessmutex);
@@ -287,56 +399,94 @@ namespace Postr
     
     bool Worker::waitForFinished(ChainValue c, std::set<const Worker*> workers)
     {
-        std::unique_lock<std::mutex> lk(m_progressmutex);
+        bool observe = interactive && progressRate > 0 && !workers.empty();
+        if(observe)
+        {
+            std::lock_guard<std::mutex> lk(m_observermutex);
+            m_observedworkers.insert(workers.begin(), workers.end());
+            if(!m_observing)
+            {
+                m_observing = true;
+                m_observer = std::thread(&Worker::observeProgress, m_observergeneration);
+            }
+        }
         
-        if((*c)>0)
-        Worker::m_progresscondition.wait(lk, [c,workers](){
-            //LOG(DEBUG) << "A notified";
-            
-            if(interactive && !workers.empty())
+        {
+            std::unique_lock<std::mutex> lk(m_progressmutex);
+            //Workers notify when they finish. The timeout covers notifications sent right before waiting.
+            while((*c) > 0 && !m_abort)
+                m_progresscondition.wait_for(lk, std::chrono::milliseconds(100));
+        }
+        
+        if(observe)
+        {
+            //the last waiting chain stops the observer, so it never outlives the statics it uses
+            std::thread observer;
             {
-                bool printed = false;
-                std::cout << "\033[2K";
-                static int lastcount = 0;
-                int count = 0;
+                std::lock_guard<std::mutex> lk(m_observermutex);
                 for(const Worker* w : workers)
+                    m_observedworkers.erase(m_observedworkers.find(w));
+                if(m_observedworkers.empty() && m_observing)
                 {
-                    if(w->progress())
-                        ++count;
+                    m_observing = false;
+                    ++m_observergeneration;
+                    observer.swap(m_observer);
                 }
-                if(!m_progressbars)
-                    --lastcount;
-                if(count < lastcount)
-                    std::cout << "\033["+std::to_string(lastcount-count)+"B\r";
-                for(const Worker* w : workers)
-                {
-                    if(w->progress())
-                    {
-                        printed = true;
-                        w->printProgress(false);
-                        std::cout << "\n";
-                    }
-                }
-                std::cout << "\033[J";
-                m_progressbars = count;
-                if(m_progressbars)
-                    std::cout << "\033["+std::to_string(count)+"A\r";
-                std::cout.flush();
-                lastcount = count;
             }
-            
-            if(m_abort)
-                return true;
-            
-            //LOG(DEBUG) << "A done";
-            return ((*c) <= 0);
-        });
+            m_observercondition.notify_all();
+            if(observer.joinable())
+                observer.join();
+        }
         
         LOG(DEBUG) << "stop waiting";
         
         return !m_abort;
     }
     
+    void Worker::observeProgress(int generation)
+    {
+        int lastcount = 0;
+        //the lock keeps observed Workers alive while their progress is printed
+        std::unique_lock<std::mutex> lk(m_observermutex);
+        while(true)
+        {
+            int rate = std::max(1, progressRate.load());
+            m_observercondition.wait_for(lk, std::chrono::milliseconds(1000/rate));
+            
+            if(generation != m_observergeneration)
+                return;
+            if(m_observedworkers.empty() || !interactive || progressRate <= 0)
+                continue;
+            
+            std::set<const Worker*> workers(m_observedworkers.begin(), m_observedworkers.end());
+            std::cout << "\033[2K";
+            int count = 0;
+            for(const Worker* w : workers)
+            {
+                if(w->progress())
+                    ++count;
+            }
+            if(!m_progressbars)
+                --lastcount;
+            if(count < lastcount)
+                std::cout << "\033["+std::to_string(lastcount-count)+"B\r";
+            for(const Worker* w : workers)
+            {
+                if(w->progress())
+                {
+                    w->printProgress(false);
+                    std::cout << "\n";
+                }
+            }
+            std::cout << "\033[J";
+            m_progressbars = count;
+            if(m_progressbars)
+                std::cout << "\033["+std::to_string(count)+"A\r";
+            std::cout.flush();
+            lastcount = count;
+        }
+    }
+    
     Worker::ChainValue operator<<(Worker::WorkerChain chain, DataPtr data)
     {
         Worker::ChainCounter pending(new std::atomic_int);
@@ -361,11 +511,24 @@ namespace Postr
                 std::thread t([this,data,pending](std::promise<void> promise){
                     std::shared_ptr< std::promise<void> > p(new std::promise<void>);
                     *p = std::move(promise);
-                    process(*data, [this,data,pending,p](Data d, int status) {
+                    StageMetrics& stage = metrics();
+                    ++stage.inflight;
+                    std::string document = Tracer::enabled() ? Tracer::documentId(data->meta) : "";
+                    long thread = Tracer::currentThread();
+                    auto start = std::chrono::steady_clock::now();
+                    int started = process(*data, [this,data,pending,p,&stage,document,thread,start](Data d, int status) {
+                        auto end = std::chrono::steady_clock::now();
+                        stage.latency.observe(std::chrono::duration<double>(end - start).count());
+                        Tracer::complete("stage", name(), document, start, end, thread);
+                        --stage.inflight;
+                        ++stage.documents;
+                        *data = d;
                         if(0 != status)
+                        {
+                            ++stage.errors;
                             LOG(ERROR) << name() << " failed";
-                        
-                        *data = d;
+                            data->meta["result"]["errors"].append(name());
+                        }
                     
                         --(*pending);
                         
@@ -373,6 +536,9 @@ namespace Postr
                             (*p).set_value();
                         
                     });
+                    //the callback is not called if processing could not be started
+                    if(0 != started)
+                        --stage.inflight;
                 },std::move(promise));
                 t.detach();
             }
@@ -391,11 +557,23 @@ namespace Postr
                 std::thread t([&right,left,data,pending](std::promise<void> promise){
                     std::shared_ptr< std::promise<void> > p(new std::promise<void>);
                     *p = std::move(promise);
-                    right.process(*data, [&right,left,data,pending,p](Data d, int status) {
+                    StageMetrics& stage = right.metrics();
+                    ++stage.inflight;
+                    std::string document = Tracer::enabled() ? Tracer::documentId(data->meta) : "";
+                    long thread = Tracer::currentThread();
+                    auto start = std::chrono::steady_clock::now();
+                    int started = right.process(*data, [&right,left,data,pending,p,&stage,document,thread,start](Data d, int status) {
+                        auto end = std::chrono::steady_clock::now();
+                        stage.latency.observe(std::chrono::duration<double>(end - start).count());
+                        Tracer::complete("stage", right.name(), document, start, end, thread);
+                        --stage.inflight;
+                        ++stage.documents;
                         *data = d;
                         if(0 != status)
                         {
+                            ++stage.errors;
                             LOG(ERROR) << right.name() << " failed";
+                            data->meta["result"]["errors"].append(right.name());
                             *pending = 0;
                         }
                         else
@@ -407,6 +585,9 @@ namespace Postr
                         if(0 == *pending)
                             (*p).set_value();
                     });
+                    //the callback is not called if processing could not be started
+                    if(0 != started)
+                        --stage.inflight;
                 },std::move(promise));
                 t.detach();
             }
@@ -470,15 +651,23 @@ namespace Postr
                 std::future<void> future1 = promise1.get_future();
                 std::future<void> future2 = promise2.get_future();
                 
+                std::string document = Tracer::enabled() ? Tracer::documentId(data->meta) : "";
+                auto start = std::chrono::steady_clock::now();
+                
                 one(d1,p1,std::move(promise1));
                 other(d2,p2,std::move(promise2));
             
                 future1.wait();
                 future2.wait();
                 
+                Tracer::complete("join", "wait for branches", document, start, std::chrono::steady_clock::now());
+                
                 LOG(DEBUG) << "joining!";
                 
-                fn(*d1,*d2);
+                {
+                    Tracer::Span merge("join", "merge", document);
+                    fn(*d1,*d2);
+                }
                 *data = *d1;
                 
                 (*pending) = p-one.count()-other.count();
@@ -27,6 +27,8 @@
 #include <mutex>
 #include <condition_variable>
 #include <future>
+#include <thread>
+#include <set>
 
 #if (defined _MSC_VER || defined WIN32 || defined _WIN32 || defined WINCE || defined __CYGWIN__) && defined CVAPI_EXPORTS
 #  define WORKER_EXPORTS __declspec(dllexport)
@@ -38,6 +40,8 @@
 
 namespace Postr 
 {
+    struct StageMetrics;
+    
     /**
      * @brief This is the base class for Workers.
      * Workers are processing units that can be used in a pipelined chain.
@@ -135,6 +139,12 @@ namespace Postr
          */
         std::string name() const;
         
+        /**
+         * @brief Latency histograms and counters of this Worker, shared by all Workers with the same name.
+         * @return The metrics of this Worker
+         */
+        StageMetrics& metrics() const;
+        
         static void initializeLog(int loglevel);
     
         /**
@@ -147,6 +157,13 @@ namespace Postr
          * Set this to false when using mutliple concurrent pipelines.
          */
         static std::atomic_bool debug;
+        
+        /**
+         * Number of times per second the progress bars of waiting chains are redrawn if interactive is true.
+         * Progress is sampled by a single observer thread, Workers never wait for the progress to be printed.
+         * Set this to 0 to disable progress bars.
+         */
+        static std::atomic_int progressRate;
       
         /**
          * @brief Implicit cast to a chain
@@ -196,11 +213,25 @@ namespace Postr
         */
         bool configBool(const std::string& name, const bool defval, const std::string& descr = "") const;
         
+        /**
+         * @brief Generation of the config. Incremented whenever the config file has been reloaded.
+         * Use ConfigSnapshot to read config entries in hot paths, it only reads the config again when the generation changed.
+         */
+        static int configGeneration();
+        
+        /**
+         * @brief Read the config file again if it has been modified since it has been read.
+         * This is done periodically as configured by config_reloadInterval.
+         * @return true if the config has been reloaded
+         */
+        static bool reloadConfig();
+        
         /**
          * @brief Block until a chain has finished
          * @param c the ChainValue of the chain
          * @param workers a vector of pointers to workers to print a progress bar for
-         * @return true if the chain finished normally. false if the chain was aborted (e.g. by a SIGINT or due to unexpected behaviour)
+         * @return true if the chain finished normally. false if the chain was aborted (e.g. by a SIGINT or due to unexpected behaviour).
+         * A chain in which a Worker failed finishes normally, the names of failed Workers are appended to meta["result"]["errors"] of its data.
          */
         static bool waitForFinished(ChainValue c, std::set<const Worker*> workers = {});
         
@@ -221,6 +252,7 @@ namespace Postr
     protected:
         int m_status;
         const char *m_name;
+        mutable std::atomic<StageMetrics*> m_metrics;
         static el::base::type::StoragePointer m_storage;
         static std::condition_variable m_progresscondition;
         static std::mutex m_progressmutex;
@@ -238,11 +270,28 @@ namespace Postr
         static Data m_config;
         static std::atomic_int m_configaccesscounter;
         static std::mutex m_configaccessmutex;
+        static std::atomic_int m_configgeneration;
+        static long long m_configmodified;
+        static std::thread m_configwatcher;
+        static std::condition_variable m_configwatchcondition;
+        static bool m_stopconfigwatcher;
         
         static std::atomic_int m_progressbars;
+        static std::multiset<const Worker*> m_observedworkers;
+        static std::mutex m_observermutex;
+        static bool m_observing;
+        static int m_observergeneration;
+        static std::thread m_observer;
+        static std::condition_variable m_observercondition;
         
         static void handleCrash(int sig);
         
+        /**
+         * @brief Print the progress of observed Workers until the last waiting chain stopped this observer
+         * @param generation the generation of this observer, it stops when m_observergeneration changes
+         */
+        static void observeProgress(int generation);
+        
         friend ChainValue operator<<(WorkerChain chain, DataPtr data);
         friend WorkerChain operator<<(WorkerChain left, Worker& right);
         friend WorkerChain operator<<(WorkerChain left, WorkerChain right);
@@ -0,0 +1,175 @@
+/**
+ * This file is part of Poster Safari.
+ *
+ *  Poster Safari is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Poster Safari is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with Poster Safari.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ * 
+ *  Copyright 2017 Moritz Dannehl, Rebecca Lühmann, Nicolas Marin, Michael Nieß, Julian Wolff
+ * 
+ */
+
+#ifndef WORKER_ABI_H
+#define WORKER_ABI_H
+
+#include <stddef.h>
+
+/**
+ * @brief Version of the binary interface between shared object workers and their host.
+ * Increment whenever the layout of the structs below or the signature of an exported function changes.
+ * Version 1 added processView, version 2 added worker instances (createWorker, processInstance, instanceProgress and destroyWorker).
+ */
+#define POSTR_WORKER_ABI_VERSION 2
+
+#ifdef __cplusplus
+extern "C" 
+{
+#endif
+
+    /**
+     * @brief View of an image buffer owned by the caller
+     */
+    typedef struct PostrImageView
+    {
+        int rows;
+        int cols;
+        int type;               ///< OpenCV matrix type, e.g. CV_8UC3
+        size_t step;            ///< bytes per row
+        unsigned char *data;    ///< first pixel or NULL for an empty image
+    } PostrImageView;
+    
+    /**
+     * @brief View of a Data object: JSON metadata without images plus views of the image buffers
+     */
+    typedef struct PostrDataView
+    {
+        const char *meta;
+        size_t metaLength;
+        const PostrImageView *images;
+        int imageCount;
+    } PostrDataView;
+    
+    /**
+     * @brief Called by a worker when it finished processing.
+     * The view and its buffers are only valid during the call.
+     * @param result view of the processed data
+     * @param status 0 on success
+     * @param context the context passed to processView
+     */
+    typedef void (*PostrResultCallback)(const PostrDataView *result, int status, void *context);
+    
+    /**
+     * @brief Opaque handle of a worker instance created by createWorker.
+     * Instances are independent of each other and of the instance used by process and processView.
+     */
+    typedef struct PostrWorker PostrWorker;
+    
+#ifdef __cplusplus
+}
+
+#include "postrdata.h"
+
+namespace Postr
+{
+    namespace WorkerABI
+    {
+        /**
+         * @brief Holds a view of a Data object together with the storage it points to
+         */
+        struct DataView
+        {
+            std::string meta;
+            std::vector<PostrImageView> images;
+            PostrDataView view;
+            
+            explicit DataView(const Data& data)
+                : meta(data.serialize(false))
+            {
+                images.reserve(data.images.size());
+                for(const ImageData& image : data.images)
+                {
+                    PostrImageView imageview;
+                    imageview.rows = image.rows;
+                    imageview.cols = image.cols;
+                    imageview.type = image.type();
+                    imageview.step = image.empty() ? 0 : image.step[0];
+                    imageview.data = image.empty() ? nullptr : image.data;
+                    images.push_back(imageview);
+                }
+                view.meta = meta.c_str();
+                view.metaLength = meta.size();
+                view.images = images.data();
+                view.imageCount = images.size();
+            }
+            
+            DataView(const DataView&) = delete;
+        };
+        
+        /**
+         * @brief Create a Data object from a view without copying image buffers.
+         * The images of the returned object point to the buffers of the view and must not outlive them.
+         */
+        inline Data wrap(const PostrDataView& view)
+        {
+            Data data(std::string(view.meta, view.metaLength));
+            data.images.resize(view.imageCount);
+            for(int i=0; i < view.imageCount; ++i)
+            {
+                const PostrImageView& image = view.images[i];
+                if(image.data)
+                    data.images[i] = cv::Mat(image.rows, image.cols, image.type, image.data, image.step);
+            }
+            return data;
+        }
+        
+        /**
+         * @brief Create a Data object from a view that owns its images.
+         * Images whose buffers belong to one of the images in origin are shared with origin, all other images are copied.
+         * @param view a view that is only valid for the duration of the call
+         * @param origin Data whose image buffers may be referenced by view
+         */
+        inline Data adopt(const PostrDataView& view, const Data& origin)
+        {
+            Data data = wrap(view);
+            for(ImageData& image : data.images)
+            {
+                if(image.empty())
+                    continue;
+                
+                bool shared = false;
+                for(const ImageData& original : origin.images)
+                {
+                    if(original.empty() || original.type() != image.type() || original.step[0] != image.step[0] || image.data < original.data)
+                        continue;
+                    
+                    //the worker may return the original image or a region of it
+                    size_t offset = image.data - original.data;
+                    int y = offset / original.step[0];
+                    int x = (offset % original.step[0]) / original.elemSize();
+                    if(x + image.cols <= original.cols && y + image.rows <= original.rows)
+                    {
+                        image = ImageData(original(cv::Rect(x, y, image.cols, image.rows)));
+                        shared = true;
+                        break;
+                    }
+                }
+                if(!shared)
+                    image = ImageData(image.clone());
+            }
+            return data;
+        }
+    }
+}
+#endif //__cplusplus
+
+#endif //WORKER_ABI_H
@@ -24,40 +24,66 @@
 
 #ifdef WORKER_LIBRARY
 
+#include <atomic>
 #include <functional>
+#include <mutex>
+
+#include "workerabi.h"
 
 typedef std::function<void(const char*, int)>* WorkerCallbackSerialized;
         
-Postr::_WORKER_CLASS_ *_worker = nullptr;
-WorkerCallbackSerialized _serialcallback = nullptr;
+//instance used by hosts that don't create instances of their own
+std::atomic<Postr::_WORKER_CLASS_*> _worker(nullptr);
+std::mutex _workermutex;
 
-void _allocate()
+Postr::_WORKER_CLASS_ *_allocate()
 {
-    _worker = new Postr::_WORKER_CLASS_();
+    //several hosts may call into the shared instance concurrently, only one of them creates it
+    Postr::_WORKER_CLASS_ *worker = _worker.load();
+    if(worker)
+        return worker;
+    
+    std::lock_guard<std::mutex> lk(_workermutex);
+    worker = _worker.load();
+    if(!worker)
+    {
+        worker = new Postr::_WORKER_CLASS_();
+        _worker.store(worker);
+    }
+    return worker;
 }
 
 void _free()
 {
-    delete _worker;
+    std::lock_guard<std::mutex> lk(_workermutex);
+    delete _worker.exchange(nullptr);
 }
 
-void _callback(Postr::Data data, int status)
+int _process(const char *serialdata, void *callback = 0)
 {
-    if(_serialcallback)
-        (*_serialcallback)(data.serialize(true).data(), status);
-    _serialcallback = nullptr;
+    //every call keeps its own callback, concurrent calls must not overwrite each other's
+    WorkerCallbackSerialized serialcallback = (WorkerCallbackSerialized)callback;
+    Postr::Data data(serialdata);
+    return _allocate()->process(data, [serialcallback](Postr::Data data, int status){
+        if(serialcallback)
+            (*serialcallback)(data.serialize(true).data(), status);
+    });
 }
 
-int _process(const char *serialdata, void *callback = 0)
+int _processView(Postr::_WORKER_CLASS_ *worker, const PostrDataView *view, PostrResultCallback callback, void *context)
 {
-    _serialcallback = (WorkerCallbackSerialized)callback;
-    Postr::Data data(serialdata);
-    return _worker->process(data, _callback);
+    //the images are used in place, the host keeps them alive until the callback has been called
+    Postr::Data data = Postr::WorkerABI::wrap(*view);
+    return worker->process(data, [callback, context](Postr::Data result, int status){
+        Postr::WorkerABI::DataView resultview(result);
+        if(callback)
+            callback(&resultview.view, status, context);
+    });
 }
 
-float _progress()
+Postr::_WORKER_CLASS_ *_instance(PostrWorker *worker)
 {
-    return _worker->progress();
+    return reinterpret_cast<Postr::_WORKER_CLASS_*>(worker);
 }
 
 extern "C" 
@@ -69,16 +95,42 @@ extern "C"
 
     WORKER_EXPORTS int process(const char *serialdata, void *callback = 0)
     {
-        if(!_worker)
-            _allocate();
-        _process(serialdata, callback);
+        return _process(serialdata, callback);
+    }
+    
+    WORKER_EXPORTS int abiVersion()
+    {
+        return POSTR_WORKER_ABI_VERSION;
+    }
+    
+    WORKER_EXPORTS int processView(const PostrDataView *view, PostrResultCallback callback, void *context)
+    {
+        return _processView(_allocate(), view, callback, context);
     }
     
     WORKER_EXPORTS float progress()
     {
-        if(!_worker)
-            _allocate();
-        return _progress();
+        return _allocate()->progress();
+    }
+    
+    WORKER_EXPORTS PostrWorker *createWorker()
+    {
+        return reinterpret_cast<PostrWorker*>(new Postr::_WORKER_CLASS_());
+    }
+    
+    WORKER_EXPORTS void destroyWorker(PostrWorker *worker)
+    {
+        delete _instance(worker);
+    }
+    
+    WORKER_EXPORTS int processInstance(PostrWorker *worker, const PostrDataView *view, PostrResultCallback callback, void *context)
+    {
+        return _processView(_instance(worker), view, callback, context);
+    }
+    
+    WORKER_EXPORTS float instanceProgress(PostrWorker *worker)
+    {
+        return _instance(worker)->progress();
     }
     
     WORKER_EXPORTS const char *name()
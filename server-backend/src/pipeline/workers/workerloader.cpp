@@ -26,20 +26,72 @@
 //TODO: include headers neccessary for shared object loading on MS Windows
 #else
 #include <dlfcn.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <limits.h>
 #endif
 
+#include <fstream>
+#include <regex>
+#include <chrono>
+
 #undef LOG
 #define LOG(LEVEL) (CLOG(LEVEL, ELPP_CURR_FILE_LOGGER_ID) << "[WorkerLoader] ")
 
 namespace Postr 
 {
+    std::map<std::string,std::string> WorkerLoader::m_workers;
+    bool WorkerLoader::m_discovered = false;
+    std::mutex WorkerLoader::m_discovermutex;
+    
+    /**
+     * @brief Keeps the data passed to processView and its view alive until the worker calls back
+     */
+    struct SharedObjectWorker::PendingCall
+    {
+        PendingCall(SharedObjectWorker *worker, const Data& data, WorkerCallback& callback)
+            : worker(worker)
+            , data(data)
+            , callback(callback)
+            , view(this->data)
+        {
+        }
+        
+        SharedObjectWorker *worker;
+        Data data;
+        std::function<void(Data, int)> callback;
+        WorkerABI::DataView view;
+    };
+    
+    /**
+     * @brief Owns the callback passed to the serialized interface until the worker calls back
+     */
+    struct SharedObjectWorker::SerializedCall
+    {
+        SerializedCall(SharedObjectWorker *worker, WorkerCallback& callback)
+            : worker(worker)
+            , callback(callback)
+        {
+        }
+        
+        SharedObjectWorker *worker;
+        std::function<void(Data, int)> callback;
+        std::function<void(const char*, int)> function;
+    };
+    
     SharedObjectWorker::SharedObjectWorker(const std::string& name, const std::string& filename)
         : Worker("")
         , m_workername(name)
         , m_process(nullptr)
+        , m_processView(nullptr)
+        , m_processInstance(nullptr)
         , m_progress(nullptr)
+        , m_instanceProgress(nullptr)
         , m_free(nullptr)
-        , m_serialized_callback(nullptr)
+        , m_destroy(nullptr)
+        , m_instance(nullptr)
+        , m_handle(nullptr)
     {
         m_name = m_workername.c_str();
         
@@ -69,6 +121,37 @@ namespace Postr
             return;
         }
         
+        //workers built against an older interface don't export abiVersion
+        int(*abiVersion)() = (int(*)())dlsym(m_handle, "abiVersion");
+        int abi = (dlerror() == NULL && abiVersion) ? abiVersion() : 0;
+        if(abi > POSTR_WORKER_ABI_VERSION)
+            LOG(WARNING) << filename << " uses the newer worker ABI version " << abi << ", falling back to the serialized interface";
+        else if(abi >= 1)
+        {
+            m_processView = (int(*)(const PostrDataView*, PostrResultCallback, void*))(dlsym(m_handle, "processView"));
+            if ((error = dlerror()) != NULL) 
+            {
+                LOG(WARNING) << error;
+                m_processView = nullptr;
+            }
+        }
+        if(abi >= 2 && abi <= POSTR_WORKER_ABI_VERSION)
+        {
+            PostrWorker*(*create)() = (PostrWorker*(*)())dlsym(m_handle, "createWorker");
+            m_destroy = (void(*)(PostrWorker*))dlsym(m_handle, "destroyWorker");
+            m_processInstance = (int(*)(PostrWorker*, const PostrDataView*, PostrResultCallback, void*))dlsym(m_handle, "processInstance");
+            m_instanceProgress = (float(*)(PostrWorker*))dlsym(m_handle, "instanceProgress");
+            if ((error = dlerror()) != NULL || !create || !m_destroy || !m_processInstance || !m_instanceProgress)
+            {
+                LOG(WARNING) << (error ? error : "incomplete instance interface");
+                m_destroy = nullptr;
+                m_processInstance = nullptr;
+                m_instanceProgress = nullptr;
+            }
+            else
+                m_instance = create();
+        }
+        
         m_progress = (float(*)())dlsym(m_handle, "progress");
         if ((error = dlerror()) != NULL) 
         {
@@ -88,37 +171,117 @@ namespace Postr
         
         Dl_info info;
         dladdr((void*)m_free, &info);
-        LOG(INFO) << "loaded " << name << " from " << info.dli_fname;
+        LOG(INFO) << "loaded " << name << " from " << info.dli_fname << (m_instance ? "" : m_processView ? " (shared instance)" : " (serialized interface)");
         
     }
     
     SharedObjectWorker::~SharedObjectWorker()
     {
-        if(m_free)
+        if(m_instance)
+            m_destroy(m_instance);
+        else if(m_free)
             m_free();
         
-        delete m_serialized_callback;
-        
-        dlclose(m_handle);
+        if(m_handle)
+            dlclose(m_handle);
     }
     
     int SharedObjectWorker::process(Data data, WorkerCallback& callback)
     {
-        if(m_process)
+        if(m_instance || m_processView)
+        {
+            std::shared_ptr<PendingCall> call = std::make_shared<PendingCall>(this, data, callback);
+            {
+                std::lock_guard<std::mutex> lk(m_pendingmutex);
+                m_pending[call.get()] = call;
+            }
+            
+            int status;
+            if(m_instance)
+                status = m_processInstance(m_instance, &call->view.view, &SharedObjectWorker::viewCallback, call.get());
+            else
+                status = m_processView(&call->view.view, &SharedObjectWorker::viewCallback, call.get());
+            
+            if(status != 0)
+            {
+                //the worker refused the data and won't call back
+                std::lock_guard<std::mutex> lk(m_pendingmutex);
+                m_pending.erase(call.get());
+            }
+            return status;
+        }
+        else if(m_process)
         {
-            delete m_serialized_callback;
-            m_serialized_callback = new std::function<void(const char*, int)>([callback](const char *serialdata, int status){
-                Data fromserialized(serialdata);
-                if(callback)
-                    callback(fromserialized, status);
-            });
-            return m_process(data.serialize(true).data(), (void*)m_serialized_callback);
+            //every call gets its own callback, concurrent calls must not overwrite each other's
+            std::shared_ptr<SerializedCall> call = std::make_shared<SerializedCall>(this, callback);
+            SerializedCall *context = call.get();
+            call->function = [context](const char *serialdata, int status){
+                SharedObjectWorker::serializedCallback(context, serialdata, status);
+            };
+            {
+                std::lock_guard<std::mutex> lk(m_pendingmutex);
+                m_serialized[context] = call;
+            }
+            
+            int status = m_process(data.serialize(true).data(), (void*)&call->function);
+            if(status != 0)
+            {
+                //the worker refused the data and won't call back
+                std::lock_guard<std::mutex> lk(m_pendingmutex);
+                m_serialized.erase(context);
+            }
+            return status;
         }
         return 1;
     }
     
+    void SharedObjectWorker::viewCallback(const PostrDataView *result, int status, void *context)
+    {
+        PendingCall *call = static_cast<PendingCall*>(context);
+        SharedObjectWorker *worker = call->worker;
+        
+        std::shared_ptr<PendingCall> pending;
+        {
+            std::lock_guard<std::mutex> lk(worker->m_pendingmutex);
+            auto it = worker->m_pending.find(call);
+            if(it == worker->m_pending.end())
+                return;
+            pending = it->second;
+            worker->m_pending.erase(it);
+        }
+        
+        //the result view is only valid during this call. Images the worker created are copied, input images are shared.
+        Data data = WorkerABI::adopt(*result, pending->data);
+        if(pending->callback)
+            pending->callback(data, status);
+    }
+    
+    void SharedObjectWorker::serializedCallback(SerializedCall *call, const char *serialdata, int status)
+    {
+        SharedObjectWorker *worker = call->worker;
+        
+        std::shared_ptr<SerializedCall> pending;
+        {
+            std::lock_guard<std::mutex> lk(worker->m_pendingmutex);
+            auto it = worker->m_serialized.find(call);
+            if(it == worker->m_serialized.end())
+                return;
+            pending = it->second;
+            worker->m_serialized.erase(it);
+        }
+        
+        Data fromserialized(serialdata);
+        if(pending->callback)
+            pending->callback(fromserialized, status);
+        
+        //releasing the last reference deletes the function that is calling us, nothing of it is used after this
+        pending.reset();
+    }
+    
     float SharedObjectWorker::progress() const
     {
+        if(m_instance)
+            return m_instanceProgress(m_instance);
         if(m_progress)
             return m_progress();
         return 0;
@@ -138,6 +301,12 @@ namespace Postr
     SharedWorkerPtr WorkerLoader::loadWorker(const std::string& name)
     {
         std::map<std::string,std::string> workers = findWorkers(name);
+        if(workers.size() && !File::exists(workers.begin()->second))
+        {
+            //the worker has been removed or moved since this process discovered it
+            refresh();
+            workers = findWorkers(name);
+        }
         if(workers.size())
         {
             auto it=workers.begin();
@@ -146,44 +315,214 @@ namespace Postr
         
         return nullptr;
     }
+    
+    void WorkerLoader::refresh()
+    {
+        std::lock_guard<std::mutex> lk(m_discovermutex);
+        m_discovered = false;
+        m_workers.clear();
+    }
        
     const std::map<std::string,std::string> WorkerLoader::findWorkers(const std::string& name)
     {
+        std::lock_guard<std::mutex> lk(m_discovermutex);
+        if(!m_discovered)
+        {
+            discover();
+            m_discovered = true;
+        }
+        
+        if(name.empty())
+            return m_workers;
+        
         std::map<std::string,std::string> workers;
+        auto it = m_workers.find(name);
+        if(it != m_workers.end())
+            workers.insert(*it);
+        return workers;
+    }
+    
+    /**
+     * @brief Modification time of a file in nanoseconds or -1 if the file does not exist
+     */
+    static Json::Int64 modificationTime(const std::string& path, Json::Int64 *size = nullptr)
+    {
+        struct stat info;
+        if(stat(path.c_str(), &info) != 0)
+            return -1;
+        if(size)
+            *size = info.st_size;
+        return (Json::Int64)info.st_mtim.tv_sec*1000000000 + info.st_mtim.tv_nsec;
+    }
+    
+    void WorkerLoader::discover()
+    {
+        auto start = std::chrono::steady_clock::now();
+        
+        MetaData manifest;
+        std::ifstream in(manifestFile());
+        if(in)
+        {
+            Json::Reader reader;
+            if(!reader.parse(in, manifest) || manifest["version"].asInt() != 1)
+                manifest = MetaData();
+        }
+        
+        std::vector<std::string> roots = File::LibraryLocation;
+        char cwd[PATH_MAX];
+        roots.push_back(getcwd(cwd, sizeof(cwd)) ? cwd : ".");
         
-        std::vector<std::string> dirs = File::LibraryLocation;
-        dirs.push_back(".");
-        const std::vector<std::string>& workerfiles = File::locateAll("(lib)?postr_.*\\.(so|dll)", dirs, 3);
+        MetaData updated;
+        updated["version"] = 1;
+        bool changed = false;
+        int scanned = 0, inspected = 0;
         
-        for(const std::string& filename : workerfiles)
+        m_workers.clear();
+        for(const std::string& root : roots)
         {
-            const char *error;
-            void *handle = dlopen(filename.c_str(), RTLD_LAZY);
-            if (!handle)
+            //a directory's modification time changes whenever an entry is added, removed or renamed
+            MetaData tree = manifest["roots"].get(root, MetaData());
+            bool valid = tree.isObject();
+            for(const std::string& dir : tree["directories"].getMemberNames())
             {
-                //LOG(WARNING) << filename << " is not a valid Worker";
-                continue;
+                if(modificationTime(dir) != tree["directories"][dir].asInt64())
+                {
+                    valid = false;
+                    break;
+                }
             }
-    
-            dlerror();    /* Clear any existing error */
+            if(!valid)
+            {
+                tree = scan(root);
+                changed = true;
+                ++scanned;
+            }
+            updated["roots"][root] = tree;
             
-            std::string workername;
-            const char*(*_name)() = (const char* (*)())(dlsym(handle, "name"));
-            if ((error = dlerror()) != NULL)
+            for(const MetaData& file : tree["files"])
             {
-                LOG(WARNING) << filename << " is not a valid Worker";
-                continue;
+                std::string filename = file.asString();
+                Json::Int64 size = 0;
+                Json::Int64 mtime = modificationTime(filename, &size);
+                
+                MetaData entry = manifest["files"].get(filename, MetaData());
+                if(!entry.isObject() || entry["mtime"].asInt64() != mtime || entry["size"].asInt64() != size)
+                {
+                    entry = inspect(filename);
+                    entry["mtime"] = mtime;
+                    entry["size"] = size;
+                    changed = true;
+                    ++inspected;
+                }
+                updated["files"][filename] = entry;
+                
+                std::string workername = entry["name"].asString();
+                if(!workername.empty())
+                    m_workers[workername] = filename;
+            }
+        }
+        
+        if(changed || updated["files"].size() != manifest["files"].size())
+        {
+            //write to a temporary file first so concurrent processes never read a partial manifest
+            std::string filename = manifestFile();
+            std::string temporary = filename + "." + std::to_string(getpid());
+            std::ofstream out(temporary);
+            if(out)
+            {
+                Json::FastWriter writer;
+                out << writer.write(updated);
+                out.close();
+                if(rename(temporary.c_str(), filename.c_str()) != 0)
+                    unlink(temporary.c_str());
             }
-            if(_name)
-                workername = _name();
             else
-                LOG(WARNING) << filename << " is not a valid Worker";
-            if(!workername.empty() && (name.empty() || workername == name))
-                workers[workername] = filename;
+                LOG(DEBUG) << "cannot write worker manifest " << filename;
+        }
+        
+        LOG(DEBUG) << "discovered " << m_workers.size() << " workers in " 
+                   << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() << " ms "
+                   << "(scanned " << scanned << " of " << roots.size() << " directories, inspected " << inspected << " files)";
+    }
+    
+    MetaData WorkerLoader::scan(const std::string& root)
+    {
+        static const std::regex workerfile("(lib)?postr_.*\\.(so|dll)");
+        
+        //writing the manifest changes the modification time of its directory
+        std::string manifestdir = File::directory(manifestFile());
+        
+        MetaData tree;
+        tree["directories"] = Json::Value(Json::objectValue);
+        tree["files"] = Json::Value(Json::arrayValue);
+        
+        //same depth as the former search with File::locateAll
+        std::vector<std::pair<std::string,int>> pending = {{root, 3}};
+        while(!pending.empty())
+        {
+            std::string dirname = pending.back().first;
+            int depth = pending.back().second;
+            pending.pop_back();
             
-            dlclose(handle);
+            tree["directories"][dirname] = modificationTime(dirname);
+            
+            DIR *dir = opendir(dirname.c_str());
+            if(!dir)
+                continue;
+            
+            struct dirent *ent;
+            while((ent = readdir(dir)) != NULL)
+            {
+                std::string entry = ent->d_name;
+                if(ent->d_type == DT_DIR)
+                {
+                    if(depth != 0 && entry != "." && entry != ".." && dirname + "/" + entry != manifestdir)
+                        pending.push_back(std::make_pair(dirname + "/" + entry, depth-1));
+                }
+                else if(std::regex_match(entry, workerfile))
+                    tree["files"].append(dirname + "/" + entry);
+            }
+            closedir(dir);
         }
-        return workers;
+        return tree;
+    }
+    
+    MetaData WorkerLoader::inspect(const std::string& filename)
+    {
+        MetaData entry;
+        entry["name"] = "";
+        entry["abi"] = 0;
+        
+        void *handle = dlopen(filename.c_str(), RTLD_LAZY);
+        if (!handle)
+        {
+            //LOG(WARNING) << filename << " is not a valid Worker";
+            return entry;
+        }
+        
+        dlerror();    /* Clear any existing error */
+        
+        const char*(*_name)() = (const char* (*)())(dlsym(handle, "name"));
+        if (dlerror() != NULL || !_name)
+            LOG(WARNING) << filename << " is not a valid Worker";
+        else
+            entry["name"] = _name();
+        
+        int(*abiVersion)() = (int(*)())dlsym(handle, "abiVersion");
+        if(dlerror() == NULL && abiVersion)
+            entry["abi"] = abiVersion();
+        
+        dlclose(handle);
+        return entry;
+    }
+    
+    std::string WorkerLoader::manifestFile()
+    {
+        std::string dirname = File::homeDirectory() + "/.cache";
+        mkdir(dirname.c_str(), 0755);
+        dirname += "/postr";
+        mkdir(dirname.c_str(), 0755);
+        return dirname + "/workers.json";
     }
     
 }
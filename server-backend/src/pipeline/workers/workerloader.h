@@ -23,7 +23,10 @@
 #define WORKERLOADER_H
 
 #include "worker.h"
+#include "workerabi.h"
+#include "metadata.h"
 #include <map>
+#include <mutex>
 
 namespace Postr
 {
@@ -34,6 +37,9 @@ namespace Postr
     
     /**
     * @brief Finds Workers in shared objects (.so or .dll-files) and loads them
+    * Discovered workers are recorded in a manifest in ~/.cache/postr. The manifest stores the modification time of every
+    * searched directory and of every shared object with the name and ABI version of the worker it contains.
+    * As long as nothing changed, discovery only needs to stat these files instead of walking the directories and opening every shared object.
     */
     class WorkerLoader 
     {
@@ -51,13 +57,42 @@ namespace Postr
         */
         static SharedWorkerPtr loadWorker(const std::string& name);
         
+        /**
+        * @brief Forget the workers discovered by this process and validate the manifest again on next use
+        */
+        static void refresh();
+        
     private:
         static const std::map<std::string,std::string> findWorkers(const std::string& name = "");
-        static const std::vector<std::string> findWorkerFiles(const std::string& name = "");
+        
+        /**
+        * @brief Validate the manifest against the file system and update it where necessary
+        */
+        static void discover();
+        
+        /**
+        * @brief Walk a directory and record the modification time of every subdirectory and all shared objects that may contain workers
+        */
+        static MetaData scan(const std::string& root);
+        
+        /**
+        * @brief Open a shared object and read the name and ABI version of the worker it contains
+        */
+        static MetaData inspect(const std::string& filename);
+        
+        static std::string manifestFile();
+        
+        static std::map<std::string,std::string> m_workers;
+        static bool m_discovered;
+        static std::mutex m_discovermutex;
     };
     
     /**
      * @brief A base class for Workers that are loaded from shared object files
+     * Data is passed to workers exporting processView (see workerabi.h) as a view of the metadata and image buffers without serializing images.
+     * Workers built against an older interface are called with JSON serialized data.
+     * Each SharedObjectWorker creates its own worker instance if the shared object supports instances (ABI version 2),
+     * so several SharedObjectWorkers of the same shared object process documents in parallel. Otherwise all of them share a single instance.
      */
     class SharedObjectWorker final : public Worker
     {
@@ -69,12 +104,32 @@ namespace Postr
         friend SharedWorkerPtr WorkerLoader::loadWorker(const std::string&);
         SharedObjectWorker(const std::string& name = "", const std::string& filename = "");
     private:
+        struct PendingCall;
+        struct SerializedCall;
+        
+        /**
+         * @brief Receives the result of a call to processView
+         */
+        static void viewCallback(const PostrDataView *result, int status, void *context);
+        
+        /**
+         * @brief Receives the result of a call to the serialized process interface
+         */
+        static void serializedCallback(SerializedCall *call, const char *serialdata, int status);
+        
         std::string m_workername;
         int(* m_process)(const char *serialdata, void *callback);
+        int(* m_processView)(const PostrDataView *view, PostrResultCallback callback, void *context);
+        int(* m_processInstance)(PostrWorker *worker, const PostrDataView *view, PostrResultCallback callback, void *context);
         float(* m_progress)();
+        float(* m_instanceProgress)(PostrWorker *worker);
         void(* m_free)();
+        void(* m_destroy)(PostrWorker *worker);
+        PostrWorker *m_instance;
         void *m_handle;
-        WorkerCallbackSerialized m_serialized_callback;
+        std::map<const PendingCall*, std::shared_ptr<PendingCall>> m_pending;
+        std::map<const SerializedCall*, std::shared_ptr<SerializedCall>> m_serialized;
+        std::mutex m_pendingmutex;
         
         SharedObjectWorker(const SharedObjectWorker& other) = delete;
     };